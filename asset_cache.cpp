@@ -0,0 +1,190 @@
+#include "asset_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nba_vision {
+
+const uint32_t kAssetCacheMagic = 0x4e425641;  // "NBVA"
+const uint32_t kAssetCacheVersion = 1;
+const uint64_t kFnvPrime = 1099511628211ULL;
+// Images and the table start on cache line boundaries.
+const size_t kAssetAlignment = 64;
+
+struct AssetCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    // Of everything after the header.
+    uint64_t checksum;
+    uint32_t num_images;
+    uint32_t table_size;
+    uint64_t table_offset;
+};
+
+struct AssetImageEntry {
+    int32_t rows;
+    int32_t cols;
+    int32_t type;
+    int32_t row_bytes;
+    uint64_t offset;
+};
+
+static size_t Align(const size_t& offset) {
+    return (offset + kAssetAlignment - 1) / kAssetAlignment * kAssetAlignment;
+}
+
+AssetCache::AssetCache() : data_(NULL), mapped_size_(0), table_(NULL),
+        table_size_(0) {}
+
+AssetCache::~AssetCache() {
+    if (data_ != NULL) {
+        munmap(data_, mapped_size_);
+    }
+}
+
+bool AssetCache::Open(const string& filename, const uint64_t& key) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 ||
+            (size_t) file_stat.st_size < sizeof(AssetCacheHeader)) {
+        close(fd);
+        return false;
+    }
+    size_t size = file_stat.st_size;
+    void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    const uchar* bytes = (const uchar*) data;
+    const AssetCacheHeader* header = (const AssetCacheHeader*) bytes;
+    const size_t entries_end = sizeof(AssetCacheHeader) +
+        (size_t) header->num_images * sizeof(AssetImageEntry);
+    bool valid = header->magic == kAssetCacheMagic &&
+        header->version == kAssetCacheVersion && header->key == key &&
+        entries_end <= size &&
+        header->table_offset + header->table_size * sizeof(float) <= size &&
+        HashBytes(bytes + sizeof(AssetCacheHeader),
+                size - sizeof(AssetCacheHeader)) ==
+        header->checksum;
+    const AssetImageEntry* entries =
+        (const AssetImageEntry*) (bytes + sizeof(AssetCacheHeader));
+    for (uint32_t i = 0; valid && i < header->num_images; i++) {
+        valid = entries[i].rows >= 0 && entries[i].cols >= 0 &&
+            entries[i].offset + (size_t) entries[i].rows *
+            entries[i].row_bytes <= size;
+    }
+    if (!valid) {
+        cout << "Ignoring stale or corrupt asset cache: " << filename << endl;
+        munmap(data, size);
+        return false;
+    }
+    if (data_ != NULL) {
+        munmap(data_, mapped_size_);
+    }
+    data_ = (uchar*) data;
+    mapped_size_ = size;
+    images_.clear();
+    for (uint32_t i = 0; i < header->num_images; i++) {
+        images_.push_back(Mat(entries[i].rows, entries[i].cols,
+                    entries[i].type, data_ + entries[i].offset,
+                    entries[i].row_bytes));
+    }
+    table_ = (const float*) (data_ + header->table_offset);
+    table_size_ = header->table_size;
+    return true;
+}
+
+bool AssetCache::Write(const string& filename, const uint64_t& key,
+        const vector<Mat>& images, const vector<float>& table) {
+    // Lay the file out in memory first, so the checksum can go in the
+    // header.
+    vector<AssetImageEntry> entries(images.size());
+    size_t offset = Align(sizeof(AssetCacheHeader) +
+            entries.size() * sizeof(AssetImageEntry));
+    for (size_t i = 0; i < images.size(); i++) {
+        entries[i].rows = images[i].rows;
+        entries[i].cols = images[i].cols;
+        entries[i].type = images[i].type();
+        entries[i].row_bytes = images[i].cols * images[i].elemSize();
+        entries[i].offset = offset;
+        offset = Align(offset + (size_t) entries[i].rows *
+                entries[i].row_bytes);
+    }
+    AssetCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = kAssetCacheMagic;
+    header.version = kAssetCacheVersion;
+    header.key = key;
+    header.num_images = images.size();
+    header.table_size = table.size();
+    header.table_offset = offset;
+    vector<uchar> buffer(offset + table.size() * sizeof(float), 0);
+    memcpy(&buffer[sizeof(header)], entries.data(),
+            entries.size() * sizeof(AssetImageEntry));
+    for (size_t i = 0; i < images.size(); i++) {
+        for (int r = 0; r < images[i].rows; r++) {
+            memcpy(&buffer[entries[i].offset + (size_t) r *
+                    entries[i].row_bytes], images[i].ptr<uchar>(r),
+                    entries[i].row_bytes);
+        }
+    }
+    if (!table.empty()) {
+        memcpy(&buffer[offset], table.data(), table.size() * sizeof(float));
+    }
+    header.checksum = HashBytes(&buffer[sizeof(header)],
+            buffer.size() - sizeof(header));
+    memcpy(&buffer[0], &header, sizeof(header));
+
+    string temp_filename = filename + ".tmp";
+    {
+        ofstream output(temp_filename.c_str(), ios::binary | ios::trunc);
+        output.write((const char*) buffer.data(), buffer.size());
+        output.flush();
+        if (!output) {
+            cout << "Cannot write asset cache: " << temp_filename << endl;
+            remove(temp_filename.c_str());
+            return false;
+        }
+    }
+    if (rename(temp_filename.c_str(), filename.c_str()) != 0) {
+        cout << "Cannot write asset cache: " << filename << endl;
+        remove(temp_filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+const vector<Mat>& AssetCache::Images() const {
+    return images_;
+}
+
+const float* AssetCache::Table() const {
+    return table_;
+}
+
+size_t AssetCache::TableSize() const {
+    return table_size_;
+}
+
+uint64_t AssetCache::HashBytes(const void* data, const size_t& size,
+        const uint64_t& seed) {
+    const uchar* bytes = (const uchar*) data;
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * kFnvPrime;
+    }
+    return hash;
+}
+
+}
@@ -0,0 +1,63 @@
+#ifndef ASSET_CACHE_H
+#define ASSET_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <opencv2/highgui/highgui.hpp>
+
+using namespace cv;
+using namespace std;
+
+namespace nba_vision {
+
+// Assets that take a while to compute at startup, e.g. the net template
+// pyramid, stored in one binary file that is mapped into memory instead of
+// being computed again for every clip. The file holds a list of images and
+// a table of floats; what they mean is up to the writer. It is only used if
+// its version and key match and its checksum is right, so a stale or
+// damaged cache is rebuilt rather than trusted.
+class AssetCache {
+public:
+    AssetCache();
+    ~AssetCache();
+
+    // Maps filename. key identifies the inputs and settings the assets were
+    // computed from, see HashBytes. Returns false if the file is missing, was
+    // written for another key or version, or is corrupt.
+    bool Open(const string& filename, const uint64_t& key);
+
+    // Writes the assets to filename, through a temporary file and a rename
+    // so that readers never map a partial cache.
+    static bool Write(const string& filename, const uint64_t& key,
+            const vector<Mat>& images, const vector<float>& table);
+
+    // Images in the order they were written. They point into the mapping,
+    // so they are only valid as long as the cache, and must not be written
+    // to.
+    const vector<Mat>& Images() const;
+
+    const float* Table() const;
+    size_t TableSize() const;
+
+    // FNV-1a, for building keys and checksums. Pass the previous hash as
+    // seed to hash several values; the default is the FNV offset basis.
+    static uint64_t HashBytes(const void* data, const size_t& size,
+            const uint64_t& seed = 14695981039346656037ULL);
+
+private:
+    // Not copyable, it owns the mapping.
+    AssetCache(const AssetCache&);
+    AssetCache& operator=(const AssetCache&);
+
+    uchar* data_;
+    size_t mapped_size_;
+    vector<Mat> images_;
+    const float* table_;
+    size_t table_size_;
+};
+
+}
+
+#endif  // ASSET_CACHE_H
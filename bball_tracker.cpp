@@ -2,8 +2,14 @@
 
 #include <iostream>
 #include <math.h>
+#include <mutex>
+#include <sys/stat.h>
 #include <vector>
 
+#include "parallel_labeling.h"
+#include "serialization.h"
+#include "stage_timer.h"
+
 using namespace cv;
 
 namespace nba_vision {
@@ -11,13 +17,23 @@ namespace nba_vision {
 const int kBballIndex = 0;
 
 const char kBinaryWindowName[] = "Bball Segmentation";
-// Value represents a probability of two standard deviations for each color.
-const double kColorProbThreshold = 0.142625;
 // To get rid of object if it's too small.
 const int kAreaThreshold = 120;
 const double kCircularityThreshold = 0.3;
+// Even blurred, the ball's bounding box is not much longer than it is wide.
+const double kMaxAspectRatio = 3;
 // Basketball cannot move this far between two frames.
 const double kDistanceThreshold = 200;
+// With a model whose innovation covariance can be trusted, the ball is only
+// searched for within this many standard deviations of the prediction, but
+// never closer than kMinGateRadius.
+const double kGateSigmas = 4;
+const double kMinGateRadius = 40;
+// The search area reaches this far past the gate, so that a ball centered on
+// its edge is segmented whole.
+const int kGateRoiMargin = 32;
+// Grid cell size for looking up candidates near the prediction.
+const float kCandidateCellSize = 64;
 // Distance between location and prediction for it to be added to path.
 const double kTighterDistanceThreshold = 50;
 // The location of the template for a net.
@@ -27,25 +43,72 @@ const char kNetTemplateWindowName[] = "Net Template Edges";
 const double kNetDistanceThreshold = 100;
 
 const double kMaxScale = 0.2;
+const double kMinScale = 0.1;
+const double kScaleStep = 0.05;
+// Motion gating works on frames shrunk this much in each direction.
+const int kMotionDownsample = 4;
+// Grey level change for a pixel to count as moving.
+const int kMotionThreshold = 15;
+// In downsampled pixels, so that the inside of the ball, which is the same
+// color in both frames, is kept along with its moving edges.
+const int kMotionDilation = 3;
+
+// Edge detection of the net template.
+const double kCannyLowThreshold = 100;
+const double kCannyHighThreshold = 200;
+const int kCannyApertureSize = 3;
+// Bump when the way the cached assets are computed changes.
+const uint32_t kAssetCacheFormat = 1;
 
 unique_ptr<Mat> BballTracker::template_edges_ = nullptr;
-unique_ptr<Point> BballTracker::prev_net_location_ = nullptr;
-int BballTracker::prev_net_width_ = 0;
-int BballTracker::prev_net_height_ = 0;
+vector<pair<double, Mat> > BballTracker::template_pyramid_;
+string BballTracker::asset_cache_filename_;
+unique_ptr<AssetCache> BballTracker::asset_cache_ = nullptr;
+const float* BballTracker::default_color_seed_ = NULL;
+// Trackers may be created on several threads at once.
+static once_flag template_edges_once;
 
 void BballTracker::InitNetTemplate() {
-    if (template_edges_ == nullptr) {
+    call_once(template_edges_once, [this]() {
+        STAGE_TIMER("InitNetTemplate");
         template_edges_.reset(new Mat());
-        LoadAndCreateEdgesTemplate(kNetTemplateFilename, *template_edges_);
+        if (!LoadAssetCache()) {
+            LoadAndCreateEdgesTemplate(kNetTemplateFilename, *template_edges_);
+            if (template_edges_->data) {
+                for (double scale : TemplateScales()) {
+                    Mat scaled;
+                    resize(*template_edges_, scaled, Size(), scale, scale);
+                    template_pyramid_.push_back(make_pair(scale, scaled));
+                }
+                if (!asset_cache_filename_.empty()) {
+                    WriteAssetCache();
+                }
+            }
+        }
         if (debug_) {
             namedWindow(kNetTemplateWindowName, CV_WINDOW_AUTOSIZE);
             imshow(kNetTemplateWindowName, *template_edges_);
         }
-    }
+    });
 }
 
-BballTracker::BballTracker(MultipleKalmanFilter* mkf, bool debug) {
+BballTracker::BballTracker(MultipleKalmanFilter* mkf, bool debug) :
+        candidate_index_(kCandidateCellSize) {
     debug_ = debug;
+    state_ = DEFAULT;
+    scored_ = false;
+    shot_path_size_ = 0;
+    prev_net_width_ = 0;
+    prev_net_height_ = 0;
+    net_moved_ = false;
+    ball_side_ = 0;
+    last_result_ = TrackResult();
+    local_net_search_ = false;
+    ball_search_radius_ = 0;
+    camera_motion_ = Point2f(0, 0);
+    labeling_threads_ = 1;
+    use_gate_cov_ = false;
+    gate_radius_ = kDistanceThreshold;
     if (debug_) {
         namedWindow(kBinaryWindowName, CV_WINDOW_AUTOSIZE);
     }
@@ -56,8 +119,23 @@ BballTracker::BballTracker(MultipleKalmanFilter* mkf, bool debug) {
 BballTracker::BballTracker(
         MultipleKalmanFilter* mkf,
         const pair<int, int>& init_loc,
-        bool debug) {
+        bool debug) :
+        candidate_index_(kCandidateCellSize) {
     debug_ = debug;
+    state_ = DEFAULT;
+    scored_ = false;
+    shot_path_size_ = 0;
+    prev_net_width_ = 0;
+    prev_net_height_ = 0;
+    net_moved_ = false;
+    ball_side_ = 0;
+    last_result_ = TrackResult();
+    local_net_search_ = false;
+    ball_search_radius_ = 0;
+    camera_motion_ = Point2f(0, 0);
+    labeling_threads_ = 1;
+    use_gate_cov_ = false;
+    gate_radius_ = kDistanceThreshold;
     if (debug_) {
         cout << "Initial location: " << init_loc.first << ", " <<
             init_loc.second << endl;
@@ -69,36 +147,80 @@ BballTracker::BballTracker(
             (Mat_<float>(2, 1) << init_loc.first, init_loc.second));
 }
 
-bool area_filter(RegionMetrics* region_metrics) {
-    return region_metrics->area < kAreaThreshold;
-}
-
 bool circularity_filter(RegionMetrics* region_metrics) {
     return region_metrics->circularity < kCircularityThreshold;
 }
 
-void BballTracker::TrackBall(Mat& frame) {
+void BballTracker::TrackBall(const Mat& frame) {
+    STAGE_TIMER("TrackBall");
+    last_result_.event = NO_EVENT;
     // Find the hoop.
     Rect rect;
     bool found_net = FindNet(frame, rect);
 
-    if (debug_) {
-        cout << "Existing prediction: " << prediction_(0) << ", " <<
-            prediction_(1) << endl;
+    // Only look for the ball near the prediction when asked to, or when the
+    // gate is small enough to say where it can be.
+    UpdateGate();
+    int search_radius = ball_search_radius_;
+    if (use_gate_cov_) {
+        int gate_search_radius = gate_radius_ + kGateRoiMargin;
+        search_radius = search_radius > 0 ?
+            min(search_radius, gate_search_radius) : gate_search_radius;
+    }
+    Rect roi(0, 0, frame.cols, frame.rows);
+    if (search_radius > 0 && !prediction_.empty()) {
+        Rect near_prediction = roi & Rect(
+                prediction_(0) - search_radius,
+                prediction_(1) - search_radius,
+                2 * search_radius, 2 * search_radius);
+        if (near_prediction.area() > 0) {
+            roi = near_prediction;
+        }
     }
     Mat binary_image;
-    BballTracker::ColorSegmentation(frame, binary_image);
+    BballTracker::ColorSegmentation(frame(roi), binary_image);
+    if (motion_mask_ != nullptr) {
+        motion_mask_->Update(frame, camera_motion_);
+        motion_mask_->Apply(binary_image, roi.tl());
+    }
     Mat components_image;
-    int num_components = ComputeConnectedComponents(binary_image, components_image);
+    int num_components = labeling_threads_ > 1 ?
+        ComputeConnectedComponentsParallel(binary_image, components_image,
+                labeling_threads_) :
+        ComputeConnectedComponents(binary_image, components_image);
     vector<RegionMetrics*> region_metrics_list =
-        ComputeRegionMetrics(components_image, num_components);
-    // Filter the region_metrics_list by area.
-    FilterRegionMetrics(components_image, region_metrics_list, area_filter);
-    // Filter the region_metrics_list by circularity.
-    FilterRegionMetrics(components_image, region_metrics_list, circularity_filter);
+        FindCandidates(components_image, num_components, roi.tl());
     if (debug_) {
-        ConvertComponentsImageToBinary(components_image, binary_image);
-        imshow(kBinaryWindowName, binary_image);
+        // Only show the candidates.
+        vector<bool> is_candidate(num_components + 2, false);
+        for (auto region_metrics : region_metrics_list) {
+            is_candidate[region_metrics->component_index] = true;
+        }
+        Mat candidates_image = Mat::zeros(components_image.rows,
+                components_image.cols, CV_8UC1);
+        for (int r = 0; r < components_image.rows; r++) {
+            for (int c = 0; c < components_image.cols; c++) {
+                if (is_candidate[components_image.at<uchar>(r, c)]) {
+                    candidates_image.at<uchar>(r, c) = 255;
+                }
+            }
+        }
+        imshow(kBinaryWindowName, candidates_image);
+    }
+    if (prediction_.empty() && !InitFromBestRegion(region_metrics_list)) {
+        // Nothing looks like the ball yet, so only the net was tracked.
+        for (auto region_metrics : region_metrics_list) {
+            delete region_metrics;
+        }
+        last_result_.found_ball = false;
+        last_result_.found_net = found_net;
+        last_result_.net_rect = rect;
+        last_result_.state = state_;
+        return;
+    }
+    if (debug_) {
+        cout << "Existing prediction: " << prediction_(0) << ", " <<
+            prediction_(1) << endl;
     }
     RegionMetrics* region_metrics = FindClosestRegionToPrediction(
             region_metrics_list);
@@ -113,116 +235,358 @@ void BballTracker::TrackBall(Mat& frame) {
             cout << *region_metrics;
             cout << "Distance to prediction: " << dist << endl;
         }
-        if (dist < kDistanceThreshold) {
-            // Update the prediction with the actual values found in the frame.
-            // Otherwise, just use the prediction from the filter because the
-            // ball was not correctly found in this frame (it was too far).
-            new_loc(0) = region_metrics->avg_x;
-            new_loc(1) = region_metrics->avg_y;
-            // Draw an orange rectangle where the basketball is.
-            int side = sqrt(region_metrics->area);
-            int top_left_x = region_metrics->avg_x - side/2;
-            int top_left_y = region_metrics->avg_y - side/2;
-            rectangle(frame, Rect(top_left_x, top_left_y, side, side),
-                    Scalar(0, 165, 255), 2);
-        } else {
-            new_loc(0) = prediction_(0);
-            new_loc(1) = prediction_(1);
+        // Update the prediction with the actual values found in the frame.
+        new_loc(0) = region_metrics->avg_x;
+        new_loc(1) = region_metrics->avg_y;
+        ball_side_ = sqrt(region_metrics->area);
+        if (adaptive_color_model_ != nullptr &&
+                dist < kTighterDistanceThreshold) {
+            STAGE_TIMER("UpdateColorModel");
+            adaptive_color_model_->Update(frame(roi), binary_image,
+                    components_image, region_metrics->component_index,
+                    Point2f(region_metrics->avg_x - roi.x,
+                        region_metrics->avg_y - roi.y),
+                    sqrt(region_metrics->area / M_PI));
         }
     } else {
+        // Just use the prediction from the filter because the ball was not
+        // correctly found in this frame (it was too far).
         new_loc(0) = prediction_(0);
         new_loc(1) = prediction_(1);
     }
-    prediction_ = mkf_->CorrectAndPredictForObject(kBballIndex, new_loc);
-    // Draw a point for the current prediction.
-    circle(frame, Point(prediction_(0), prediction_(1)),
-            5, Scalar(255, 255, 255), CV_FILLED, 8, 0);
+    if (region_metrics == NULL && use_gate_cov_) {
+        // Coast, so that the gate widens while the ball is lost instead of
+        // shrinking around a prediction that agrees with itself.
+        prediction_ = mkf_->PredictForObject(kBballIndex);
+    } else {
+        prediction_ = mkf_->CorrectAndPredictForObject(kBballIndex, new_loc);
+    }
     if (debug_) {
         cout << "Updated prediction: " << prediction_(0) << ", " <<
             prediction_(1) << endl;
     }
+    last_result_.found_ball = region_metrics != NULL;
+    last_result_.ball_location = Point2f(new_loc(0), new_loc(1));
+    last_result_.prediction = Point2f(prediction_(0), prediction_(1));
+    last_result_.found_net = found_net;
+    last_result_.net_rect = rect;
     // Update state of the ball based on its location.
     if (found_net) { 
          UpdateBallState(rect, new_loc);
     }
 
-    if (state_ == SHOT) {
-        if (dist != -1 && dist < kTighterDistanceThreshold) {
-            AddLocationToPath(pair<int, int>(new_loc(0), new_loc(1)));
+    last_result_.state = state_;
+
+    // The path is kept before the shot too, so that the shot can start from
+    // where the ball was released rather than where it rose above the net.
+    if (dist != -1 && dist < kTighterDistanceThreshold) {
+        AddLocationToPath(pair<int, int>(new_loc(0), new_loc(1)));
+    }
+    for (auto region_metrics : region_metrics_list) {
+        delete region_metrics;
+    }
+}
+
+vector<RegionMetrics*> BballTracker::FindCandidates(
+        const Mat& components_image, const int& num_components,
+        const Point& offset) {
+    vector<ComponentStats> stats = labeling_threads_ > 1 ?
+        ComputeComponentStatsParallel(components_image, num_components,
+                labeling_threads_) :
+        ComputeComponentStats(components_image, num_components);
+    STAGE_TIMER("FindCandidates");
+    vector<RegionMetrics*> candidates;
+    for (const auto& component : stats) {
+        if (component.area < kAreaThreshold) {
+            continue;
         }
-        DrawPath(frame);
+        // Before the ball is found, it may be anywhere.
+        if (!prediction_.empty() && !InGate(
+                    component.sum_x / (double) component.area + offset.x -
+                        prediction_(0),
+                    component.sum_y / (double) component.area + offset.y -
+                        prediction_(1))) {
+            continue;
+        }
+        int width = component.max_x - component.min_x + 1;
+        int height = component.max_y - component.min_y + 1;
+        if (max(width, height) > kMaxAspectRatio * min(width, height)) {
+            continue;
+        }
+        RegionMetrics* region_metrics =
+            ComputeRegionMetricsForComponent(components_image, component);
+        if (circularity_filter(region_metrics)) {
+            delete region_metrics;
+            continue;
+        }
+        region_metrics->avg_x += offset.x;
+        region_metrics->avg_y += offset.y;
+        candidates.push_back(region_metrics);
     }
+    return candidates;
 }
 
-RegionMetrics* BballTracker::FindClosestRegionToPrediction(
-        vector<RegionMetrics*>& region_metrics_list) {
-    double closest = -1;
-    RegionMetrics* closest_metrics = NULL;
+void BballTracker::SaveState(ostream& output) const {
+    WriteValue(output, (int32_t) state_);
+    WriteValue(output, (uint8_t) scored_);
+    WriteMat(output, prediction_);
+    WriteValue(output, last_result_);
+    WriteRingBuffer(output, path_);
+    WriteValue(output, (int32_t) shot_path_size_);
+    WriteValue(output, (uint8_t) (prev_net_location_ != nullptr));
+    if (prev_net_location_ != nullptr) {
+        WriteValue(output, *prev_net_location_);
+    }
+    WriteValue(output, (int32_t) prev_net_width_);
+    WriteValue(output, (int32_t) prev_net_height_);
+    WriteValue(output, (uint8_t) (adaptive_color_model_ != nullptr));
+    if (adaptive_color_model_ != nullptr) {
+        adaptive_color_model_->SaveState(output);
+    }
+    WriteValue(output, camera_motion_);
+    WriteValue(output, (uint8_t) (motion_mask_ != nullptr));
+    if (motion_mask_ != nullptr) {
+        motion_mask_->SaveState(output);
+    }
+}
+
+bool BballTracker::LoadState(istream& input) {
+    int32_t state, shot_path_size, net_width, net_height;
+    uint8_t scored, has_net;
+    Mat prediction;
+    if (!ReadValue(input, state) || !ReadValue(input, scored) ||
+            !ReadMat(input, prediction) || !ReadValue(input, last_result_) ||
+            !ReadRingBuffer(input, path_) ||
+            !ReadValue(input, shot_path_size) || shot_path_size < 0 ||
+            shot_path_size > path_.Size() || !ReadValue(input, has_net)) {
+        return false;
+    }
+    Point net_location;
+    if (has_net && !ReadValue(input, net_location)) {
+        return false;
+    }
+    if (!ReadValue(input, net_width) || !ReadValue(input, net_height)) {
+        return false;
+    }
+    // The learned colors are only restored into a tracker that adapts too.
+    uint8_t has_adaptive_color;
+    if (!ReadValue(input, has_adaptive_color) ||
+            has_adaptive_color != (adaptive_color_model_ != nullptr)) {
+        cout << "The checkpoint was saved " <<
+            (has_adaptive_color ? "with" : "without") <<
+            " --adaptive-color." << endl;
+        return false;
+    }
+    if (has_adaptive_color && !adaptive_color_model_->LoadState(input)) {
+        return false;
+    }
+    // Likewise the motion mask, whose previous frame gates the first frame
+    // after resuming.
+    Point2f camera_motion;
+    uint8_t has_motion_mask;
+    if (!ReadValue(input, camera_motion) ||
+            !ReadValue(input, has_motion_mask)) {
+        return false;
+    }
+    if (has_motion_mask != (motion_mask_ != nullptr)) {
+        cout << "The checkpoint was saved " <<
+            (has_motion_mask ? "with" : "without") << " --motion-gating." <<
+            endl;
+        return false;
+    }
+    if (has_motion_mask && !motion_mask_->LoadState(input)) {
+        return false;
+    }
+    camera_motion_ = camera_motion;
+    state_ = state;
+    scored_ = scored != 0;
+    shot_path_size_ = shot_path_size;
+    prediction_ = prediction;
+    prev_net_location_.reset(has_net ? new Point(net_location) : nullptr);
+    prev_net_width_ = net_width;
+    prev_net_height_ = net_height;
+    return true;
+}
+
+bool BballTracker::InitFromBestRegion(
+        const vector<RegionMetrics*>& region_metrics_list) {
+    RegionMetrics* best = NULL;
     for (auto region_metrics : region_metrics_list) {
-        double dist = ComputeDistance(
-                region_metrics->avg_x, region_metrics->avg_y,
-                prediction_(0), prediction_(1));
-        if (closest == -1 || dist < closest) {
-            closest = dist;
-            closest_metrics = region_metrics;
+        if (best == NULL || region_metrics->circularity > best->circularity) {
+            best = region_metrics;
         }
     }
-    return closest_metrics;
+    if (best == NULL) {
+        return false;
+    }
+    if (debug_) {
+        cout << "Initial location: " << best->avg_x << ", " << best->avg_y <<
+            endl;
+    }
+    prediction_ = mkf_->CorrectAndPredictForObject(kBballIndex,
+            (Mat_<float>(2, 1) << best->avg_x, best->avg_y));
+    return true;
 }
 
-void BballTracker::ColorSegmentation(const Mat& frame, Mat& binary_image) const {
-    // Apply color rules to segment out the basketball from the frame.
-    binary_image = Mat::zeros(frame.rows, frame.cols, CV_8UC1); 
-    for (int r = 0; r < frame.rows; r++) {
-        for (int c = 0; c < frame.cols; c++) {
-            if (IsBballColor(frame.at<Vec3b>(r, c))) {
-                binary_image.at<uchar>(r, c) = 255;
-            }
-        }
+void BballTracker::SetLocalNetSearch(const bool& local_net_search) {
+    local_net_search_ = local_net_search;
+}
+
+void BballTracker::SetBallSearchRadius(const int& ball_search_radius) {
+    ball_search_radius_ = ball_search_radius;
+}
+
+void BballTracker::SetMotionGating(const bool& motion_gating) {
+    if (!motion_gating) {
+        motion_mask_.reset();
+    } else if (motion_mask_ == nullptr) {
+        motion_mask_.reset(new MotionMask(kMotionDownsample, kMotionThreshold,
+                    kMotionDilation));
     }
 }
 
-bool BballTracker::IsBballColor(const Vec3b& color) const {
-    // Determines whether a color is potentially that of a basketball.
-    int R, G, B;
-    B = color[0]; G = color[1]; R = color[2];
-    // Check the ranges for the colors first. Calculate a pseudo probability for that the bball is
-    // right color.
-    double prob = abs((Phi(R, 110.6875, 10.98134071) - 0.5) * (Phi(G, 74.1875, 9.001518969) - 0.5) *
-        (Phi(B, 46.6875, 8.541946134) - 0.5));
-    // 0.125 is the max value of prob and the least likely value to be the basketball.
-    prob = (0.125 - prob) / 0.125;
-    // If all three colors are within two standard deviations, this condition should pass.
-    if (prob < kColorProbThreshold) {
+void BballTracker::SetCameraMotion(const Point2f& camera_motion) {
+    camera_motion_ = camera_motion;
+}
+
+void BballTracker::SetLabelingThreads(const int& labeling_threads) {
+    labeling_threads_ = max(1, labeling_threads);
+}
+
+const TrackResult& BballTracker::GetLastResult() const {
+    return last_result_;
+}
+
+void BballTracker::UpdateGate() {
+    use_gate_cov_ = false;
+    gate_radius_ = kDistanceThreshold;
+    Matx22f cov;
+    if (prediction_.empty() ||
+            mkf_->GetMotionModel() == MOTION_CONSTANT_VELOCITY ||
+            !mkf_->GetInnovationCov(kBballIndex, cov)) {
+        return;
+    }
+    double det = cov(0, 0) * cov(1, 1) - cov(0, 1) * cov(1, 0);
+    if (!(det > 0)) {
+        return;
+    }
+    // The longest axis of the gate ellipse comes from the largest
+    // eigenvalue of the covariance.
+    double half_trace = (cov(0, 0) + cov(1, 1)) / 2;
+    double max_variance = half_trace +
+        sqrt(max(0.0, half_trace * half_trace - det));
+    gate_radius_ = min(kDistanceThreshold,
+            max(kMinGateRadius, kGateSigmas * sqrt(max_variance)));
+    gate_inverse_cov_ = Matx22f(cov(1, 1) / det, -cov(0, 1) / det,
+            -cov(1, 0) / det, cov(0, 0) / det);
+    use_gate_cov_ = true;
+}
+
+bool BballTracker::InGate(const double& dx, const double& dy) const {
+    double squared_distance = dx * dx + dy * dy;
+    if (squared_distance > gate_radius_ * gate_radius_) {
         return false;
     }
-    // Check the relationships between the colors to further shrink the space.
-    double tmp = 0.7618*R - 10.14;
-    // Look for two errors out of three to rule out pixel.
-    int count = 0;
-    if (G > tmp + 7.5 || G < tmp - 7.5) {
-        count++;
+    if (!use_gate_cov_ || squared_distance <= kMinGateRadius * kMinGateRadius) {
+        return true;
     }
-    if (B > 5*R/8.0 - 45/4.0 || B < R - 80) {
-        if (count > 0) {
-            return false;
-        }
-        count++;
+    const Matx22f& inverse = gate_inverse_cov_;
+    double mahalanobis = dx * (inverse(0, 0) * dx + inverse(0, 1) * dy) +
+        dy * (inverse(1, 0) * dx + inverse(1, 1) * dy);
+    return mahalanobis <= kGateSigmas * kGateSigmas;
+}
+
+RegionMetrics* BballTracker::FindClosestRegionToPrediction(
+        vector<RegionMetrics*>& region_metrics_list) {
+    STAGE_TIMER("FindClosestRegionToPrediction");
+    candidate_index_.Build(region_metrics_list);
+    int closest = candidate_index_.FindNearest(
+            prediction_(0), prediction_(1), gate_radius_);
+    if (closest == -1) {
+        return NULL;
     }
-    if (B > 5*G/7.0 + 40/7.0 || B < 5*G/4.0 - 255/4.0) {
-        if (count > 0) {
-            return false;
-        }
+    return region_metrics_list[closest];
+}
+
+// The color model measured in metadata/BballColor.xlsx, shared by all
+// trackers.
+static const ColorClassifier<DefaultBballColorModel>& DefaultColorClassifier() {
+    static const ColorClassifier<DefaultBballColorModel> classifier;
+    return classifier;
+}
+
+bool BballTracker::LoadColorModel(const char* filename) {
+    RuntimeColorModel model;
+    if (!model.LoadFromCsv(filename)) {
+        return false;
     }
-    // If we get here, its the color of a basketball.
+    custom_color_classifier_.reset(
+            new ColorClassifier<RuntimeColorModel>(model));
     return true;
 }
 
-bool BballTracker::FindNet(Mat& detect, Rect& rect) {
+void BballTracker::SetAdaptiveColor(const bool& adaptive_color) {
+    if (!adaptive_color) {
+        adaptive_color_model_.reset();
+    } else if (custom_color_classifier_ != nullptr) {
+        adaptive_color_model_.reset(
+                new AdaptiveColorModel(*custom_color_classifier_));
+    } else if (default_color_seed_ != NULL) {
+        adaptive_color_model_.reset(
+                new AdaptiveColorModel(default_color_seed_));
+    } else {
+        adaptive_color_model_.reset(
+                new AdaptiveColorModel(DefaultColorClassifier()));
+    }
+}
+
+void BballTracker::ColorSegmentation(const Mat& frame, Mat& binary_image) const {
+    STAGE_TIMER("ColorSegmentation");
+    // Apply color rules to segment out the basketball from the frame.
+    if (adaptive_color_model_ != nullptr) {
+        adaptive_color_model_->Segment(frame, binary_image);
+    } else if (custom_color_classifier_ != nullptr) {
+        custom_color_classifier_->Segment(frame, binary_image);
+    } else {
+        DefaultColorClassifier().Segment(frame, binary_image);
+    }
+}
+
+bool BballTracker::IsBballColor(const Vec3b& color) const {
+    if (adaptive_color_model_ != nullptr) {
+        return adaptive_color_model_->IsColor(color);
+    }
+    if (custom_color_classifier_ != nullptr) {
+        return custom_color_classifier_->IsColor(color);
+    }
+    return DefaultColorClassifier().IsColor(color);
+}
+
+bool BballTracker::FindNet(const Mat& detect, Rect& rect) {
+    STAGE_TIMER("FindNet");
     Mat detect_templ;
     // Assume that the net will be on the top half of the image.
-    Mat detect_portion = detect(
-            cv::Range(0, detect.rows / 2), cv::Range(0, detect.cols));
+    Rect search_area(0, 0, detect.cols, detect.rows / 2);
+    // Scales of the template to try, from max_scale down to min_scale.
+    double max_scale = kMaxScale;
+    double min_scale = kMinScale;
+    bool local_search = local_net_search_ && prev_net_location_ != nullptr &&
+        prev_net_width_ > 0;
+    if (local_search) {
+        // Only look at the last scale, within the distance the net may move.
+        int margin = kNetDistanceThreshold;
+        Rect near_net = search_area & Rect(prev_net_location_->x - margin,
+                prev_net_location_->y - margin,
+                prev_net_width_ + 2 * margin, prev_net_height_ + 2 * margin);
+        // The last net may have been found at the edge of the top half.
+        local_search = near_net.area() > 0;
+        if (local_search) {
+            search_area = near_net;
+            max_scale = prev_net_width_ / (double) template_edges_->cols;
+            min_scale = max_scale - kScaleStep / 2;
+        }
+    }
+    Mat detect_portion = detect(search_area);
     // Convert to greyscale.
     cvtColor(detect_portion, detect_templ, CV_BGR2GRAY); 
     // Find edges in the template image, using Canny edge detection algorithm.
@@ -231,22 +595,26 @@ bool BballTracker::FindNet(Mat& detect, Rect& rect) {
     Mat resized_templ; 
     Mat result;
     // Compute max scale value.
-    double max_scale = detect_templ.size().height /
-        (double) template_edges_->size().height; 
-    if (max_scale > kMaxScale) {
-        max_scale = kMaxScale;
+    if (!local_search) {
+        max_scale = min(kMaxScale, detect_templ.size().height /
+                (double) template_edges_->size().height);
     }
     double max_correlation_value = 0.0;
     Point max_correlation_location; 
     double max_correlation_scalar = 0.0;
-    for (double scale = max_scale; scale > 0.1; scale -= 0.05) {
-        resize(*template_edges_, resized_templ, Size(), scale, scale);
+    for (double scale = max_scale; scale > min_scale; scale -= kScaleStep) {
+        // The pyramid has the scales of a search of the whole frame.
+        const Mat* scaled_templ = FindScaledTemplate(scale);
+        if (scaled_templ == NULL) {
+            resize(*template_edges_, resized_templ, Size(), scale, scale);
+            scaled_templ = &resized_templ;
+        }
         // Make sure the resized template does not exceed the frame size width.
-        if (resized_templ.size().width > detect_templ.size().width) {
+        if (scaled_templ->size().width > detect_templ.size().width) {
             continue;
         }
         // Perform correlation coefficient template matching.
-        matchTemplate(detect_templ, resized_templ, result, CV_TM_CCOEFF);
+        matchTemplate(detect_templ, *scaled_templ, result, CV_TM_CCOEFF);
         
         double current_max_value; Point current_max_location;
         // Get the maximum value and its location.
@@ -260,6 +628,8 @@ bool BballTracker::FindNet(Mat& detect, Rect& rect) {
             max_correlation_scalar = scale;
         }
     }
+    max_correlation_location.x += search_area.x;
+    max_correlation_location.y += search_area.y;
 
     int height = template_edges_->rows * max_correlation_scalar;
     int width = template_edges_->cols * max_correlation_scalar;
@@ -271,7 +641,8 @@ bool BballTracker::FindNet(Mat& detect, Rect& rect) {
     } else {
         rect = Rect(prev_net_location_->x, prev_net_location_->y,
                 prev_net_width_, prev_net_height_);
-        rectangle(detect, rect, Scalar(0, 0, 128), 2);
+        prev_net_rect_ = rect;
+        net_moved_ = false;
         if (ComputeDistance(
                     max_correlation_location.x,
                     max_correlation_location.y,
@@ -283,7 +654,7 @@ bool BballTracker::FindNet(Mat& detect, Rect& rect) {
             prev_net_width_ = width;
             prev_net_height_ = height;
             rect = Rect(prev_net_location_->x, prev_net_location_->y, width, height);
-            rectangle(detect, rect, Scalar(0, 0, 255), 2);
+            net_moved_ = true;
         }
     }
     return true;
@@ -299,7 +670,99 @@ void BballTracker::LoadAndCreateEdgesTemplate(
     // Convert to greyscale.
     cvtColor(edges, edges, CV_BGR2GRAY); 
     // Find edges in the template image, using Canny edge detection algorithm.
-    Canny(edges, edges, 100, 200, 3, true);
+    Canny(edges, edges, kCannyLowThreshold, kCannyHighThreshold,
+            kCannyApertureSize, true);
+}
+
+vector<double> BballTracker::TemplateScales() {
+    // The same steps as FindNet, so that the scales compare equal.
+    vector<double> scales;
+    for (double scale = kMaxScale; scale > kMinScale; scale -= kScaleStep) {
+        scales.push_back(scale);
+    }
+    return scales;
+}
+
+const Mat* BballTracker::FindScaledTemplate(const double& scale) {
+    for (const auto& scaled : template_pyramid_) {
+        if (scaled.first == scale) {
+            return &scaled.second;
+        }
+    }
+    return NULL;
+}
+
+void BballTracker::SetAssetCache(const char* filename) {
+    asset_cache_filename_ = filename;
+}
+
+bool BballTracker::ComputeAssetCacheKey(uint64_t& key) {
+    struct stat file_stat;
+    if (stat(kNetTemplateFilename, &file_stat) != 0) {
+        return false;
+    }
+    // Also differs between byte orders, which the cache is written in.
+    const uint32_t format = kAssetCacheFormat;
+    key = AssetCache::HashBytes(&format, sizeof(format));
+    const int64_t file_identity[] = {
+        (int64_t) file_stat.st_size, (int64_t) file_stat.st_mtime };
+    key = AssetCache::HashBytes(file_identity, sizeof(file_identity), key);
+    key = AssetCache::HashBytes(kNetTemplateFilename,
+            sizeof(kNetTemplateFilename), key);
+    const double settings[] = {
+        kCannyLowThreshold, kCannyHighThreshold,
+        (double) kCannyApertureSize, kMaxScale, kMinScale, kScaleStep,
+        (double) AdaptiveColorModel::NumBins(),
+        DefaultBballColorModel::Red().mean,
+        DefaultBballColorModel::Red().stddev,
+        DefaultBballColorModel::Green().mean,
+        DefaultBballColorModel::Green().stddev,
+        DefaultBballColorModel::Blue().mean,
+        DefaultBballColorModel::Blue().stddev,
+        DefaultBballColorModel::ProbThreshold() };
+    key = AssetCache::HashBytes(settings, sizeof(settings), key);
+    const ColorBand bands[] = {
+        DefaultBballColorModel::GreenRed(), DefaultBballColorModel::BlueRed(),
+        DefaultBballColorModel::BlueGreen() };
+    key = AssetCache::HashBytes(bands, sizeof(bands), key);
+    return true;
+}
+
+bool BballTracker::LoadAssetCache() {
+    uint64_t key;
+    if (asset_cache_filename_.empty() || !ComputeAssetCacheKey(key)) {
+        return false;
+    }
+    unique_ptr<AssetCache> cache(new AssetCache());
+    vector<double> scales = TemplateScales();
+    if (!cache->Open(asset_cache_filename_, key) ||
+            cache->Images().size() != scales.size() + 1 ||
+            (int) cache->TableSize() != AdaptiveColorModel::NumBins()) {
+        return false;
+    }
+    *template_edges_ = cache->Images()[0];
+    template_pyramid_.clear();
+    for (size_t i = 0; i < scales.size(); i++) {
+        template_pyramid_.push_back(make_pair(scales[i],
+                    cache->Images()[i + 1]));
+    }
+    default_color_seed_ = cache->Table();
+    asset_cache_ = move(cache);
+    return true;
+}
+
+void BballTracker::WriteAssetCache() {
+    uint64_t key;
+    if (!ComputeAssetCacheKey(key)) {
+        return;
+    }
+    vector<Mat> images;
+    images.push_back(*template_edges_);
+    for (const auto& scaled : template_pyramid_) {
+        images.push_back(scaled.second);
+    }
+    AssetCache::Write(asset_cache_filename_, key, images,
+            AdaptiveColorModel::SeedFractions(DefaultColorClassifier()));
 }
 
 void BballTracker::UpdateBallState(const Rect& net_rect,
@@ -312,10 +775,13 @@ void BballTracker::UpdateBallState(const Rect& net_rect,
                     cout << "Basketball state changed to DEFAULT." << endl;
                 }
                 state_ = DEFAULT;
+                ComputeShotFeatures(net_rect, last_result_.shot_features);
                 if (scored_) {
                     cout << "Shot went into the hoop!" << endl;
+                    last_result_.event = SHOT_MADE;
                 } else {
                     cout << "Shot was a miss!" << endl;
+                    last_result_.event = SHOT_MISSED;
                 }
             }
             // Check that the ball is in the rect.
@@ -337,6 +803,8 @@ void BballTracker::UpdateBallState(const Rect& net_rect,
                 }
                 state_ = SHOT;
                 scored_ = false;
+                shot_path_size_ = CountRisingPoints();
+                last_result_.event = SHOT_TAKEN;
             }
             break;
         }
@@ -344,22 +812,98 @@ void BballTracker::UpdateBallState(const Rect& net_rect,
 }
 
 void BballTracker::AddLocationToPath(const pair<int, int>& location) {
-    path_.push_back(location);
-    // Delete the first element of the path if the size of the path gets too large.
-    if (path_.size() > PATH_SIZE) {
-        path_.erase(path_.begin());
+    // Overwrites the oldest location once the history is full.
+    path_.PushBack(location);
+    if (state_ == SHOT) {
+        shot_path_size_ = min(shot_path_size_ + 1, PATH_HISTORY_SIZE);
     }
 }
 
-void BballTracker::DrawPath(Mat& frame) {
-    int counter = 0;
-    for (int i = path_.size() - 1; i >= 1 && counter < PATH_SIZE; i--) {
-        line(frame, Point(path_[i].first, path_[i].second),
-                Point(path_[i - 1].first, path_[i - 1].second),
+int BballTracker::CountRisingPoints() const {
+    if (path_.Empty()) {
+        return 0;
+    }
+    // Image rows grow downwards, so each older point of the rise is at the
+    // same or a larger row.
+    int num_points = 1;
+    while (num_points < path_.Size() &&
+            path_.FromBack(num_points).second >=
+                path_.FromBack(num_points - 1).second) {
+        num_points++;
+    }
+    return num_points;
+}
+
+void BballTracker::ComputeShotFeatures(const Rect& net_rect,
+        ShotFeatures& features) const {
+    features.made = scored_;
+    features.num_points = 0;
+    features.release_height = 0;
+    features.apex_height = 0;
+    features.entry_angle = 0;
+    features.has_entry_angle = false;
+    if (shot_path_size_ == 0 || net_rect.height <= 0) {
+        return;
+    }
+    // Image rows grow downwards.
+    double scale = 1.0 / net_rect.height;
+    const pair<int, int>* prev = NULL;
+    for (const auto& location : path_.Last(shot_path_size_)) {
+        double height = (net_rect.y - location.second) * scale;
+        if (prev == NULL) {
+            features.release_height = height;
+            features.apex_height = height;
+        } else {
+            features.apex_height = max(features.apex_height, height);
+            int dx = location.first - prev->first;
+            int dy = location.second - prev->second;
+            // The path goes on through and under the net, where the rim and
+            // the net change the angle, so only steps that end above it
+            // count.
+            if (dy > 0 && location.second < net_rect.y) {
+                features.entry_angle = atan2(dy, abs(dx)) * 180 / M_PI;
+                features.has_entry_angle = true;
+            }
+        }
+        features.num_points++;
+        prev = &location;
+    }
+}
+
+void BballTracker::DrawResult(Mat& frame) const {
+    if (last_result_.found_net) {
+        rectangle(frame, prev_net_rect_, Scalar(0, 0, 128), 2);
+        if (net_moved_) {
+            rectangle(frame, last_result_.net_rect, Scalar(0, 0, 255), 2);
+        }
+    }
+    if (last_result_.found_ball) {
+        // Draw an orange rectangle where the basketball is.
+        int top_left_x = last_result_.ball_location.x - ball_side_ / 2;
+        int top_left_y = last_result_.ball_location.y - ball_side_ / 2;
+        rectangle(frame, Rect(top_left_x, top_left_y, ball_side_, ball_side_),
                 Scalar(0, 165, 255), 2);
-        counter++;
+    }
+    if (!prediction_.empty()) {
+        // Draw a point for the current prediction.
+        circle(frame, Point(prediction_(0), prediction_(1)),
+                5, Scalar(255, 255, 255), CV_FILLED, 8, 0);
+    }
+    if (state_ == SHOT) {
+        DrawPath(frame);
     }
 }
 
+void BballTracker::DrawPath(Mat& frame) const {
+    const pair<int, int>* prev = NULL;
+    for (const auto& location : path_.Last(PATH_SIZE)) {
+        if (prev != NULL) {
+            line(frame, Point(prev->first, prev->second),
+                    Point(location.first, location.second),
+                    Scalar(0, 165, 255), 2);
+        }
+        prev = &location;
+    }
 }
 
+}
@@ -1,12 +1,20 @@
 #ifndef BBALL_TRACKER_H
 #define BBALL_TRACKER_H
 
+#include <istream>
+#include <ostream>
 #include <vector>
 #include <utility>
 
 #include <opencv2/highgui/highgui.hpp>
 
+#include "asset_cache.h"
+#include "color_model.h"
+#include "motion_mask.h"
 #include "multiple_kalman_filter.h"
+#include "ring_buffer.h"
+#include "shot_statistics.h"
+#include "spatial_index.h"
 #include "util.h"
 
 using namespace std;
@@ -16,12 +24,41 @@ using namespace cv;
 #define DEFAULT 0
 #define SHOT 1
 
+// Shot events raised by UpdateBallState.
+#define NO_EVENT 0
+#define SHOT_TAKEN 1
+#define SHOT_MADE 2
+#define SHOT_MISSED 3
+
+// Number of path points drawn on the frame.
 #define PATH_SIZE 14
+// Number of path points kept for analyzing the shot arc.
+#define PATH_HISTORY_SIZE 512
 
 namespace nba_vision {
 
+// What TrackBall found in the last frame.
+struct TrackResult {
+    // Whether a region close enough to the prediction was found.
+    bool found_ball;
+    // The centroid of that region, or the prediction when it wasn't found.
+    Point2f ball_location;
+    // Prediction of the ball location for the next frame.
+    Point2f prediction;
+    bool found_net;
+    Rect net_rect;
+    // State of the ball (DEFAULT or SHOT) after this frame.
+    int state;
+    // The shot event raised in this frame, if any.
+    int event;
+    // The arc of the shot that ended, for SHOT_MADE and SHOT_MISSED events.
+    ShotFeatures shot_features;
+};
+
 class BballTracker {
 public:
+    // Without a starting location, the tracker starts from the most
+    // circular candidate of the first frame that has one.
     BballTracker(MultipleKalmanFilter* mkf, bool debug=false);
 
     // Initialize the tracker with a starting location.
@@ -30,14 +67,64 @@ public:
     
     // Performs color segmentation, connected components, circularity, size filtering,
     // finds basketball using prediction from Kalman filter or where it should be (if
-    // it is hidden) and then draws the location of the ball on the frame.
-    void TrackBall(Mat& frame);
+    // it is hidden). The frame is only read, so it may point into read-only
+    // memory such as a mapped file or a shared memory slot.
+    void TrackBall(const Mat& frame);
 
-private:
-    // Loops through the region_metrics_list and finds the region closest to the
-    // prediction.
-    RegionMetrics* FindClosestRegionToPrediction(
-            vector<RegionMetrics*>& region_metrics_list);
+    // Returns the results of the last call to TrackBall.
+    const TrackResult& GetLastResult() const;
+
+    // Draws the net, the ball, the prediction and the path of the shot found
+    // by the last call to TrackBall on frame, which is usually a copy of the
+    // frame that was tracked.
+    void DrawResult(Mat& frame) const;
+
+    // Keeps the net template pyramid and the starting adaptive color table
+    // in an AssetCache at filename, which is built on the first run and
+    // mapped on the next ones. Must be called before the first tracker is
+    // created.
+    static void SetAssetCache(const char* filename);
+
+    // Replaces the default ball color model with one fitted to the R,G,B
+    // samples in a CSV file. Returns false if the file can't be used.
+    bool LoadColorModel(const char* filename);
+
+    // Switches to an AdaptiveColorModel that starts from the current color
+    // model and learns from every confident detection of the ball.
+    void SetAdaptiveColor(const bool& adaptive_color);
+
+    // Cheaper settings for when tracking falls behind a live feed. With
+    // local_net_search, FindNet only matches the last scale of the net
+    // around its last location. A ball_search_radius above 0 only segments
+    // the square of that half size around the prediction.
+    void SetLocalNetSearch(const bool& local_net_search);
+    void SetBallSearchRadius(const int& ball_search_radius);
+
+    // With motion gating, only ball colored pixels that moved relative to
+    // the camera are labeled, which leaves out the static parts of the
+    // arena. The mask is built from the frame before anything is drawn on
+    // it. The camera motion comes from OpticalFlow, which must have seen the
+    // frame before SetCameraMotion and TrackBall are called with it, so that
+    // it is the motion from the last frame to this one.
+    void SetMotionGating(const bool& motion_gating);
+    void SetCameraMotion(const Point2f& camera_motion);
+
+    // Labels components and computes their metrics on this many threads,
+    // which pays off on large frames. 1 by default.
+    void SetLabelingThreads(const int& labeling_threads);
+
+    // Writes the ball and net state, the colors learned with
+    // SetAdaptiveColor and the last frame of SetMotionGating, for a
+    // checkpoint. The MultipleKalmanFilter is saved separately by its owner.
+    void SaveState(ostream& output) const;
+
+    // Restores the state written by SaveState into a tracker set up with the
+    // same SetAdaptiveColor and SetMotionGating. Returns false if the stream
+    // is malformed or was saved with other settings.
+    bool LoadState(istream& input);
+
+    // The stages of TrackBall below are public so they can be benchmarked
+    // on their own.
 
     // Segments the image into background and foreground by finding pixels in the
     // range of the color of the ball.
@@ -46,22 +133,76 @@ private:
     // Returns true if the color could be that of the basketball. False otherwise.
     bool IsBballColor(const Vec3b& color) const;
 
-    // Uses template matching algorithm to find the net in the frame and
-    // draws a rectangle around it.Returns true if the net was found in
-    // the current frame and rect is not null. False otherwise.
-    static bool FindNet(Mat& detect, Rect& rect);
-    
+    // Uses template matching algorithm to find the net in the frame. Returns
+    // true if the net was found in the current frame and rect is not null.
+    // False otherwise.
+    bool FindNet(const Mat& detect, Rect& rect);
+
+private:
+    // Returns the components that could be the ball, cheapest tests first:
+    // area, distance to the prediction and bounding box aspect. The full
+    // metrics are only computed for the components that pass, which then
+    // must be circular enough. offset is where the components_image starts
+    // in the frame. The caller owns the returned metrics.
+    vector<RegionMetrics*> FindCandidates(const Mat& components_image,
+            const int& num_components, const Point& offset);
+
+    // Sets the gate for this frame from the innovation covariance of the
+    // ball's filter. Only models other than constant velocity are tuned to
+    // the noise of a real centroid; with that one, or before the ball is
+    // found, the gate is a circle of kDistanceThreshold.
+    void UpdateGate();
+
+    // Whether a region dx, dy from the prediction is inside the gate.
+    bool InGate(const double& dx, const double& dy) const;
+
+    // Finds the region closest to the prediction, or NULL if no region is
+    // close enough for the ball to have moved there since the last frame.
+    RegionMetrics* FindClosestRegionToPrediction(
+            vector<RegionMetrics*>& region_metrics_list);
+
+    // Starts tracking from the most circular region. Returns false if there
+    // is none.
+    bool InitFromBestRegion(const vector<RegionMetrics*>& region_metrics_list);
+
     // Loads net template from disk and computes an edge detected image.
+    // Thread safe.
     void InitNetTemplate();
 
     static void LoadAndCreateEdgesTemplate(const char* filename, Mat& edges);
 
+    // The scales FindNet tries when the whole frame is searched.
+    static vector<double> TemplateScales();
+
+    // The net template resized to scale, or NULL if it isn't one of
+    // TemplateScales.
+    static const Mat* FindScaledTemplate(const double& scale);
+
+    // Identifies the template file and every setting the cached assets
+    // depend on. Returns false if the template file can't be found.
+    static bool ComputeAssetCacheKey(uint64_t& key);
+
+    // Sets the template and its pyramid from the asset cache. Returns false
+    // if there is no usable cache.
+    static bool LoadAssetCache();
+
+    static void WriteAssetCache();
+
     // Updates the balls state.
     void UpdateBallState(const Rect& net_rect, const Mat_<float>& current_loc);
 
     void AddLocationToPath(const pair<int, int>& location);
 
-    void DrawPath(Mat& frame);
+    // The number of newest points of path_ over which the ball kept rising,
+    // from the lowest one, where it left the shooter's hands.
+    int CountRisingPoints() const;
+
+    // Computes the features of the shot that just ended from its points in
+    // path_.
+    void ComputeShotFeatures(const Rect& net_rect,
+            ShotFeatures& features) const;
+
+    void DrawPath(Mat& frame) const;
 
     // A pointer to the MultipleKalmanFilter object owned by calling program.
     MultipleKalmanFilter* mkf_; 
@@ -69,17 +210,56 @@ private:
     bool debug_;
     // Save the predicted values from the kalman filter.
     Mat_<float> prediction_;
+    // Saves the results of the last frame.
+    TrackResult last_result_;
     // Saves the state of the ball.
     int state_;
     // Stores whether the ball went in.
     bool scored_;
     // Stores the path of the ball.
-    vector< pair<int, int> > path_;
+    RingBuffer<pair<int, int>, PATH_HISTORY_SIZE> path_;
+    // Newest points of path_ that belong to the current shot, from the start
+    // of the rise that took the ball above the net.
+    int shot_path_size_;
+    // Color model loaded with LoadColorModel, or NULL for the default.
+    unique_ptr<ColorClassifier<RuntimeColorModel> > custom_color_classifier_;
+    // Set with SetAdaptiveColor, and then used instead of the above.
+    unique_ptr<AdaptiveColorModel> adaptive_color_model_;
+    // Grid over the candidate centroids of the current frame.
+    SpatialIndex candidate_index_;
     // Stores the template edges for the net template.
     static unique_ptr<Mat> template_edges_;
-    static unique_ptr<Point> prev_net_location_;
-    static int prev_net_width_;
-    static int prev_net_height_;
+    // The template at each of TemplateScales.
+    static vector<pair<double, Mat> > template_pyramid_;
+    static string asset_cache_filename_;
+    // Owns the memory of the template and pyramid when they were loaded
+    // from the cache.
+    static unique_ptr<AssetCache> asset_cache_;
+    // SeedFractions of the default color model from the cache, or NULL.
+    static const float* default_color_seed_;
+    // Where the net was last found, per tracker so that several trackers
+    // can run in one process.
+    unique_ptr<Point> prev_net_location_;
+    int prev_net_width_;
+    int prev_net_height_;
+    // Where the net was before the last call to FindNet, and whether that
+    // call moved it, for DrawResult.
+    Rect prev_net_rect_;
+    bool net_moved_;
+    // Side of the box DrawResult draws around the ball.
+    int ball_side_;
+    // Load shedding settings, off by default.
+    bool local_net_search_;
+    int ball_search_radius_;
+    // Set when motion gating is on.
+    unique_ptr<MotionMask> motion_mask_;
+    Point2f camera_motion_;
+    int labeling_threads_;
+    // The gate of the current frame, see UpdateGate. Within gate_radius_ and,
+    // with use_gate_cov_, a Mahalanobis distance of kGateSigmas.
+    bool use_gate_cov_;
+    double gate_radius_;
+    Matx22f gate_inverse_cov_;
 };
 
 }
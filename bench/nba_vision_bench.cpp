@@ -0,0 +1,409 @@
+// Benchmarks the stages of the tracking pipeline on frames pre-decoded from
+// the sample clips, plus an end-to-end frames-per-second run, and writes the
+// results as JSON so they can be compared between releases. A clip may also
+// be a generated scene such as synthetic:3840x2160:200, see
+// ParseSyntheticSpec, for scaling runs; the end-to-end run then also checks
+// the ball against the scene's ground truth.
+//
+// usage: nba_vision_bench [--frames <n>] [--min-time <seconds>]
+//                         [--output <file.json>] [clip ...]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "opencv2/highgui/highgui.hpp"
+
+#include "bball_tracker.h"
+#include "frame_source.h"
+#include "kalman_filter_bank.h"
+#include "multi_target_tracker.h"
+#include "multiple_kalman_filter.h"
+#include "optical_flow.h"
+#include "parallel_labeling.h"
+#include "synthetic_scene.h"
+#include "util.h"
+
+using namespace cv;
+using namespace std;
+using namespace nba_vision;
+
+const char* kDefaultClips[] = {
+    "data-samples/sample1.mov",
+    "data-samples/sample2.mov",
+    "data-samples/sample3.mov",
+};
+const int kDefaultFramesPerClip = 60;
+const double kDefaultMinTime = 1.0;
+const char kDefaultOutput[] = "bench_results.json";
+// Number of objects for the KalmanFilterBank benchmark.
+const int kBankSize = 256;
+// Threads for the parallel labeling benchmarks.
+const int kLabelingThreads = 4;
+// Targets, on a grid of kTargetSpacing pixels, for the MultiTargetTracker
+// benchmark.
+const int kNumTargets = 64;
+const int kTargetSpacing = 60;
+// A ball found within this many radii of the ground truth counts as found.
+const double kAccuracyRadii = 2;
+
+struct BenchmarkResult {
+    string name;
+    int iterations;
+    // Number of items (pixels, frames, objects...) processed per iteration.
+    double items_per_iteration;
+    double mean_ms;
+    double median_ms;
+    double min_ms;
+    double stddev_ms;
+};
+
+// How well the end-to-end run followed the ball of the synthetic frames.
+struct BallAccuracy {
+    int num_frames;
+    int num_found;
+    // Over the frames where the ball was found.
+    double mean_error_px;
+};
+
+typedef chrono::steady_clock Clock;
+
+double ElapsedMillis(const Clock::time_point& start) {
+    return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+// Runs benchmark once to warm up, then repeatedly until min_time seconds have
+// passed, timing each iteration. setup runs before each iteration, untimed.
+BenchmarkResult RunBenchmark(const string& name, const double& min_time,
+        const double& items_per_iteration, const function<void()>& benchmark,
+        const function<void()>& setup = function<void()>()) {
+    if (setup) setup();
+    benchmark();
+    vector<double> times;
+    Clock::time_point bench_start = Clock::now();
+    while (ElapsedMillis(bench_start) < min_time * 1000 || times.size() < 3) {
+        if (setup) setup();
+        Clock::time_point start = Clock::now();
+        benchmark();
+        times.push_back(ElapsedMillis(start));
+    }
+    BenchmarkResult result;
+    result.name = name;
+    result.iterations = times.size();
+    result.items_per_iteration = items_per_iteration;
+    double sum = 0;
+    for (double time : times) {
+        sum += time;
+    }
+    result.mean_ms = sum / times.size();
+    double squared_error = 0;
+    for (double time : times) {
+        squared_error += (time - result.mean_ms) * (time - result.mean_ms);
+    }
+    result.stddev_ms = sqrt(squared_error / times.size());
+    sort(times.begin(), times.end());
+    result.median_ms = times[times.size() / 2];
+    result.min_ms = times[0];
+    cout << name << ": " << result.median_ms << " ms median over " <<
+        result.iterations << " iterations" << endl;
+    return result;
+}
+
+void FreeRegionMetrics(vector<RegionMetrics*>& region_metrics_list) {
+    for (auto region_metrics : region_metrics_list) {
+        delete region_metrics;
+    }
+    region_metrics_list.clear();
+}
+
+// Decodes the frames, and the ground truth of the synthetic ones.
+bool LoadFrames(const vector<string>& clips, const int& frames_per_clip,
+        vector<Mat>& frames, vector<SyntheticGroundTruth>& truths,
+        vector<bool>& has_truth) {
+    for (const auto& clip : clips) {
+        unique_ptr<FrameSource> source(OpenFrameSource(clip, 0, 0));
+        if (source == nullptr) {
+            return false;
+        }
+        SyntheticScene* scene = dynamic_cast<SyntheticScene*>(source.get());
+        for (int i = 0; i < frames_per_clip; i++) {
+            Mat frame;
+            if (!source->Read(frame)) {
+                break;
+            }
+            // Sources may reuse their buffer for the next frame.
+            frames.push_back(frame.clone());
+            truths.push_back(scene != NULL ? scene->LastGroundTruth() :
+                    SyntheticGroundTruth());
+            has_truth.push_back(scene != NULL);
+        }
+    }
+    return !frames.empty();
+}
+
+void WriteJson(const string& filename, const vector<string>& clips,
+        const int& num_frames, const vector<BenchmarkResult>& results,
+        const double& end_to_end_fps, const BallAccuracy& accuracy) {
+    ofstream output(filename.c_str());
+    output << "{" << endl;
+    output << "  \"timestamp\": " << time(NULL) << "," << endl;
+    output << "  \"num_frames\": " << num_frames << "," << endl;
+    output << "  \"clips\": [";
+    for (size_t i = 0; i < clips.size(); i++) {
+        output << (i > 0 ? ", " : "") << "\"" << clips[i] << "\"";
+    }
+    output << "]," << endl;
+    output << "  \"end_to_end_fps\": " << end_to_end_fps << "," << endl;
+    if (accuracy.num_frames > 0) {
+        output << "  \"ball_accuracy\": {\"frames\": " <<
+            accuracy.num_frames << ", \"detection_rate\": " <<
+            accuracy.num_found / (double) accuracy.num_frames <<
+            ", \"mean_error_px\": " << accuracy.mean_error_px << "}," << endl;
+    }
+    output << "  \"benchmarks\": [" << endl;
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult& result = results[i];
+        output << "    {\"name\": \"" << result.name << "\"" <<
+            ", \"iterations\": " << result.iterations <<
+            ", \"mean_ms\": " << result.mean_ms <<
+            ", \"median_ms\": " << result.median_ms <<
+            ", \"min_ms\": " << result.min_ms <<
+            ", \"stddev_ms\": " << result.stddev_ms <<
+            ", \"items_per_second\": " <<
+            result.items_per_iteration / (result.median_ms / 1000) << "}" <<
+            (i + 1 < results.size() ? "," : "") << endl;
+    }
+    output << "  ]" << endl;
+    output << "}" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    int frames_per_clip = kDefaultFramesPerClip;
+    double min_time = kDefaultMinTime;
+    string output_filename = kDefaultOutput;
+    vector<string> clips;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--frames" && i + 1 < argc) {
+            frames_per_clip = atoi(argv[++i]);
+        } else if (arg == "--min-time" && i + 1 < argc) {
+            min_time = atof(argv[++i]);
+        } else if (arg == "--output" && i + 1 < argc) {
+            output_filename = argv[++i];
+        } else {
+            clips.push_back(arg);
+        }
+    }
+    if (clips.empty()) {
+        clips.assign(kDefaultClips, kDefaultClips + 3);
+    }
+
+    vector<Mat> frames;
+    vector<SyntheticGroundTruth> truths;
+    vector<bool> has_truth;
+    if (!LoadFrames(clips, frames_per_clip, frames, truths, has_truth)) {
+        return -1;
+    }
+    const int num_frames = frames.size();
+    const double pixels_per_frame = frames[0].rows * frames[0].cols;
+    cout << "Decoded " << num_frames << " frames." << endl;
+
+    MultipleKalmanFilter mkf(0, NULL);
+    BballTracker tracker(&mkf, pair<int, int>(frames[0].cols / 2,
+                frames[0].rows / 2));
+    vector<BenchmarkResult> results;
+    int frame_idx = 0;
+
+    // Inputs of the later stages, computed once from the first frame.
+    Mat binary_image;
+    tracker.ColorSegmentation(frames[0], binary_image);
+    Mat components_image;
+    int num_components = ComputeConnectedComponents(binary_image,
+            components_image);
+
+    results.push_back(RunBenchmark("IsBballColor", min_time, pixels_per_frame,
+        [&]() {
+            const Mat& frame = frames[frame_idx++ % num_frames];
+            volatile int count = 0;
+            for (int r = 0; r < frame.rows; r++) {
+                for (int c = 0; c < frame.cols; c++) {
+                    count += tracker.IsBballColor(frame.at<Vec3b>(r, c));
+                }
+            }
+        }));
+
+    results.push_back(RunBenchmark("ColorSegmentation", min_time,
+        pixels_per_frame, [&]() {
+            Mat binary;
+            tracker.ColorSegmentation(frames[frame_idx++ % num_frames], binary);
+        }));
+
+    results.push_back(RunBenchmark("ComputeConnectedComponents", min_time,
+        pixels_per_frame, [&]() {
+            Mat components;
+            ComputeConnectedComponents(binary_image, components);
+        }));
+
+    results.push_back(RunBenchmark("ComputeRegionMetrics", min_time,
+        pixels_per_frame, [&]() {
+            vector<RegionMetrics*> region_metrics_list =
+                ComputeRegionMetrics(components_image, num_components);
+            FreeRegionMetrics(region_metrics_list);
+        }));
+
+    results.push_back(RunBenchmark("ComputeConnectedComponentsParallel",
+        min_time, pixels_per_frame, [&]() {
+            Mat components;
+            ComputeConnectedComponentsParallel(binary_image, components,
+                    kLabelingThreads);
+        }));
+
+    results.push_back(RunBenchmark("ComputeRegionMetricsParallel", min_time,
+        pixels_per_frame, [&]() {
+            vector<RegionMetrics*> region_metrics_list =
+                ComputeRegionMetricsParallel(components_image, num_components,
+                        kLabelingThreads);
+            FreeRegionMetrics(region_metrics_list);
+        }));
+
+    Mat filter_components;
+    vector<RegionMetrics*> filter_list;
+    results.push_back(RunBenchmark("FilterRegionMetrics", min_time,
+        pixels_per_frame, [&]() {
+            FilterRegionMetrics(filter_components, filter_list,
+                [](RegionMetrics* region_metrics) {
+                    return region_metrics->area < 120;
+                });
+        }, [&]() {
+            components_image.copyTo(filter_components);
+            FreeRegionMetrics(filter_list);
+            filter_list = ComputeRegionMetrics(components_image, num_components);
+        }));
+    FreeRegionMetrics(filter_list);
+
+    Mat net_frame;
+    results.push_back(RunBenchmark("FindNet", min_time, 1, [&]() {
+            Rect rect;
+            tracker.FindNet(net_frame, rect);
+        }, [&]() {
+            frames[frame_idx++ % num_frames].copyTo(net_frame);
+        }));
+
+    OpticalFlow optical_flow;
+    Mat flow_frame;
+    results.push_back(RunBenchmark("computeOpticalFlow", min_time, 1, [&]() {
+            optical_flow.computeOpticalFlow(flow_frame);
+        }, [&]() {
+            frames[frame_idx++ % num_frames].copyTo(flow_frame);
+        }));
+
+    results.push_back(RunBenchmark("CorrectAndPredictForObject", min_time,
+        1000, [&]() {
+            for (int i = 0; i < 1000; i++) {
+                mkf.CorrectAndPredictForObject(1,
+                        (Mat_<float>(2, 1) << i % 640, i % 480));
+            }
+        }));
+
+    MultipleKalmanFilter imm_mkf(0, NULL, MOTION_IMM);
+    results.push_back(RunBenchmark("CorrectAndPredictForObjectIMM", min_time,
+        1000, [&]() {
+            for (int i = 0; i < 1000; i++) {
+                imm_mkf.CorrectAndPredictForObject(1,
+                        (Mat_<float>(2, 1) << i % 640, i % 480));
+            }
+        }));
+
+    KalmanFilterBank bank(kBankSize);
+    vector<float> measurement_x(kBankSize), measurement_y(kBankSize);
+    vector<uchar> has_measurement(kBankSize, 1);
+    for (int i = 0; i < kBankSize; i++) {
+        bank.AddObject(i, i);
+        measurement_x[i] = i + 1;
+        measurement_y[i] = i + 1;
+    }
+    results.push_back(RunBenchmark("KalmanFilterBank", min_time, kBankSize,
+        [&]() {
+            bank.CorrectAll(measurement_x.data(), measurement_y.data(),
+                    has_measurement.data());
+            bank.PredictAll();
+        }));
+
+    // The targets sway back and forth by half the grid spacing, so that
+    // they keep their tracks.
+    MultiTargetTracker multi_target_tracker(kNumTargets, kTargetSpacing / 2);
+    vector<Point2f> targets(kNumTargets);
+    int target_frame = 0;
+    results.push_back(RunBenchmark("MultiTargetTracker", min_time,
+        kNumTargets, [&]() {
+            multi_target_tracker.Update(targets);
+        }, [&]() {
+            int step = target_frame++ % kTargetSpacing;
+            float sway = step < kTargetSpacing / 2 ? step : kTargetSpacing - step;
+            for (int i = 0; i < kNumTargets; i++) {
+                targets[i] = Point2f((i % 8) * kTargetSpacing + sway,
+                        (i / 8) * kTargetSpacing + sway / 2);
+            }
+        }));
+
+    // End to end: the per-frame work of nba_vision_main, without the GUI.
+    MultipleKalmanFilter end_to_end_mkf(0, NULL);
+    // A synthetic scene says where its ball starts.
+    pair<int, int> init_loc(frames[0].cols / 2, frames[0].rows / 2);
+    if (has_truth[0]) {
+        init_loc = pair<int, int>(truths[0].ball_location.x,
+                truths[0].ball_location.y);
+    }
+    BballTracker end_to_end_tracker(&end_to_end_mkf, init_loc);
+    OpticalFlow end_to_end_flow;
+    vector<TrackResult> end_to_end_results(num_frames);
+    Mat output;
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < num_frames; i++) {
+        frames[i].copyTo(output);
+        end_to_end_flow.computeOpticalFlow(frames[i], &output);
+        end_to_end_tracker.SetCameraMotion(end_to_end_flow.getCameraMotion());
+        end_to_end_tracker.TrackBall(frames[i]);
+        end_to_end_results[i] = end_to_end_tracker.GetLastResult();
+        end_to_end_tracker.DrawResult(output);
+    }
+    double end_to_end_fps = num_frames / (ElapsedMillis(start) / 1000);
+    cout << "End to end: " << end_to_end_fps << " fps" << endl;
+
+    BallAccuracy accuracy = {0, 0, 0};
+    double error_sum = 0;
+    for (int i = 0; i < num_frames; i++) {
+        if (!has_truth[i]) {
+            continue;
+        }
+        accuracy.num_frames++;
+        const TrackResult& result = end_to_end_results[i];
+        double error = ComputeDistance(result.ball_location.x,
+                result.ball_location.y, truths[i].ball_location.x,
+                truths[i].ball_location.y);
+        if (result.found_ball &&
+                error <= kAccuracyRadii * truths[i].ball_radius) {
+            accuracy.num_found++;
+            error_sum += error;
+        }
+    }
+    if (accuracy.num_frames > 0) {
+        accuracy.mean_error_px = accuracy.num_found > 0 ?
+            error_sum / accuracy.num_found : 0;
+        cout << "Ball found in " << accuracy.num_found << " of " <<
+            accuracy.num_frames << " synthetic frames, " <<
+            accuracy.mean_error_px << " px mean error" << endl;
+    }
+
+    WriteJson(output_filename, clips, num_frames, results, end_to_end_fps,
+            accuracy);
+    cout << "Wrote " << output_filename << endl;
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+
+#include "serialization.h"
+#include "stage_timer.h"
+
+namespace nba_vision {
+
+const uint32_t kCheckpointMagic = 0x4e425643;  // "NBVC"
+const uint32_t kCheckpointVersion = 5;
+const char kCheckpointExtension[] = ".ckpt";
+
+Checkpointer::Checkpointer(const string& prefix, const int& interval_frames) :
+        prefix_(prefix), interval_frames_(interval_frames), last_frame_(-1) {}
+
+bool Checkpointer::Update(const int& frame_idx, const BballTracker& tracker,
+        const MultipleKalmanFilter& mkf, const OpticalFlow& optical_flow) {
+    if ((frame_idx + 1) % interval_frames_ != 0) {
+        return true;
+    }
+    return Write(frame_idx, tracker, mkf, optical_flow);
+}
+
+bool Checkpointer::Write(const int& frame_idx, const BballTracker& tracker,
+        const MultipleKalmanFilter& mkf, const OpticalFlow& optical_flow) {
+    STAGE_TIMER("WriteCheckpoint");
+    string filename = Filename(frame_idx);
+    string temp_filename = filename + ".tmp";
+    {
+        ofstream output(temp_filename.c_str(), ios::binary | ios::trunc);
+        WriteValue(output, kCheckpointMagic);
+        WriteValue(output, kCheckpointVersion);
+        WriteValue(output, (int32_t) frame_idx);
+        tracker.SaveState(output);
+        mkf.SaveState(output);
+        optical_flow.saveState(output);
+        output.flush();
+        if (!output) {
+            cout << "Cannot write checkpoint: " << temp_filename << endl;
+            remove(temp_filename.c_str());
+            return false;
+        }
+    }
+    if (rename(temp_filename.c_str(), filename.c_str()) != 0) {
+        cout << "Cannot write checkpoint: " << filename << endl;
+        remove(temp_filename.c_str());
+        return false;
+    }
+    if (last_frame_ != -1 && last_frame_ != frame_idx) {
+        remove(Filename(last_frame_).c_str());
+    }
+    last_frame_ = frame_idx;
+    return true;
+}
+
+bool Checkpointer::Restore(int& frame_idx, BballTracker& tracker,
+        MultipleKalmanFilter& mkf, OpticalFlow& optical_flow) {
+    int latest = FindLatest();
+    if (latest == -1) {
+        cout << "No checkpoint found for " << prefix_ << endl;
+        return false;
+    }
+    string filename = Filename(latest);
+    ifstream input(filename.c_str(), ios::binary);
+    uint32_t magic, version;
+    int32_t checkpoint_frame;
+    if (!ReadValue(input, magic) || magic != kCheckpointMagic ||
+            !ReadValue(input, version) || version != kCheckpointVersion ||
+            !ReadValue(input, checkpoint_frame) ||
+            !tracker.LoadState(input) || !mkf.LoadState(input) ||
+            !optical_flow.loadState(input)) {
+        cout << "Cannot read checkpoint: " << filename << endl;
+        return false;
+    }
+    frame_idx = checkpoint_frame;
+    last_frame_ = checkpoint_frame;
+    return true;
+}
+
+int Checkpointer::FindLatest() const {
+    size_t slash = prefix_.rfind('/');
+    string directory = slash == string::npos ? "." : prefix_.substr(0, slash);
+    string base = slash == string::npos ? prefix_ : prefix_.substr(slash + 1);
+    DIR* dir = opendir(directory.c_str());
+    if (dir == NULL) {
+        return -1;
+    }
+    int latest = -1;
+    const size_t extension_length = strlen(kCheckpointExtension);
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        // Looks for <base>.<frame>.ckpt.
+        string name = entry->d_name;
+        if (name.size() <= base.size() + 1 + extension_length ||
+                name.compare(0, base.size(), base) != 0 ||
+                name[base.size()] != '.' ||
+                name.compare(name.size() - extension_length, extension_length,
+                    kCheckpointExtension) != 0) {
+            continue;
+        }
+        string number = name.substr(base.size() + 1,
+                name.size() - base.size() - 1 - extension_length);
+        char* end;
+        long frame_idx = strtol(number.c_str(), &end, 10);
+        if (*end == '\0' && !number.empty() && frame_idx > latest) {
+            latest = frame_idx;
+        }
+    }
+    closedir(dir);
+    return latest;
+}
+
+string Checkpointer::Filename(const int& frame_idx) const {
+    return prefix_ + "." + to_string(frame_idx) + kCheckpointExtension;
+}
+
+}
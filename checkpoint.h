@@ -0,0 +1,53 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+
+#include "bball_tracker.h"
+#include "multiple_kalman_filter.h"
+#include "optical_flow.h"
+
+using namespace std;
+
+namespace nba_vision {
+
+// Periodic snapshots of the tracking state of a long job, so that it can be
+// resumed after a crash instead of starting over. Snapshots are written to
+// <prefix>.<frame>.ckpt, through a temporary file and a rename so that a
+// crash while writing never leaves a partial snapshot behind. Only the
+// newest snapshot is kept.
+class Checkpointer {
+public:
+    Checkpointer(const string& prefix, const int& interval_frames);
+
+    // Writes a snapshot after every interval_frames frames. frame_idx is the
+    // index of the frame that was just tracked. Returns false if the snapshot
+    // could not be written.
+    bool Update(const int& frame_idx, const BballTracker& tracker,
+            const MultipleKalmanFilter& mkf, const OpticalFlow& optical_flow);
+
+    // Writes a snapshot now.
+    bool Write(const int& frame_idx, const BballTracker& tracker,
+            const MultipleKalmanFilter& mkf, const OpticalFlow& optical_flow);
+
+    // Restores the newest snapshot for the prefix and sets frame_idx to the
+    // last frame it had tracked. Returns false if there is none or it can't
+    // be read.
+    bool Restore(int& frame_idx, BballTracker& tracker,
+            MultipleKalmanFilter& mkf, OpticalFlow& optical_flow);
+
+private:
+    // Returns the frame of the newest snapshot on disk, or -1.
+    int FindLatest() const;
+
+    string Filename(const int& frame_idx) const;
+
+    string prefix_;
+    int interval_frames_;
+    // Frame of the last snapshot written or restored, or -1.
+    int last_frame_;
+};
+
+}
+
+#endif  // CHECKPOINT_H
@@ -0,0 +1,190 @@
+#include "chunked_processor.h"
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include "bball_tracker.h"
+#include "multiple_kalman_filter.h"
+#include "optical_flow.h"
+#include "stage_timer.h"
+
+using namespace cv;
+
+namespace nba_vision {
+
+// A chunk stops this many frames after its end even if its last shot isn't
+// over, so a lost ball can't make it run to the end of the video.
+const int kMaxShotFrames = 300;
+// Shots of neighbouring chunks that start this close are the same shot.
+const int kDuplicateShotFrames = 15;
+
+ChunkedProcessor::ChunkedProcessor(const string& filename,
+        const int& num_threads, const int& overlap_frames) :
+        filename_(filename), num_threads_(num_threads),
+        overlap_frames_(overlap_frames), metrics_exporter_(NULL),
+        motion_model_(MOTION_CONSTANT_VELOCITY), color_model_filename_(NULL),
+        motion_gating_(false), labeling_threads_(1), adaptive_color_(false) {}
+
+void ChunkedProcessor::SetMetrics(MetricsExporter* metrics_exporter) {
+    metrics_exporter_ = metrics_exporter;
+}
+
+void ChunkedProcessor::SetMotionModel(const MotionModelType& motion_model) {
+    motion_model_ = motion_model;
+}
+
+void ChunkedProcessor::SetColorModel(const char* color_model_filename) {
+    color_model_filename_ = color_model_filename;
+}
+
+void ChunkedProcessor::SetMotionGating(const bool& motion_gating) {
+    motion_gating_ = motion_gating;
+}
+
+void ChunkedProcessor::SetLabelingThreads(const int& labeling_threads) {
+    labeling_threads_ = labeling_threads;
+}
+
+void ChunkedProcessor::SetAdaptiveColor(const bool& adaptive_color) {
+    adaptive_color_ = adaptive_color;
+}
+
+bool ChunkedProcessor::Run(vector<DetectedShot>& shots) {
+    VideoCapture video_capture(filename_);
+    if (!video_capture.isOpened()) {
+        cout << "Cannot open the video file: " << filename_ << endl;
+        return false;
+    }
+    // The frame count comes from the container and may be slightly off, so
+    // the last chunk reads until the end of the video instead.
+    int num_frames = video_capture.get(CV_CAP_PROP_FRAME_COUNT);
+    video_capture.release();
+    int num_chunks = num_threads_;
+    if (num_frames <= 0 || num_frames < num_chunks * overlap_frames_) {
+        num_chunks = 1;
+    }
+    vector<Chunk> chunks(num_chunks);
+    for (int i = 0; i < num_chunks; i++) {
+        chunks[i].start_frame = (long) num_frames * i / num_chunks;
+        chunks[i].end_frame = i + 1 < num_chunks ?
+            (long) num_frames * (i + 1) / num_chunks : -1;
+        chunks[i].success = false;
+        chunks[i].metrics = metrics_exporter_ == NULL ? NULL :
+            metrics_exporter_->AddWorker("chunk" + to_string(i));
+    }
+
+    vector<thread> threads;
+    for (int i = 0; i < num_chunks; i++) {
+        threads.push_back(thread(&ChunkedProcessor::ProcessChunk, this,
+                    ref(chunks[i])));
+    }
+    for (auto& worker : threads) {
+        worker.join();
+    }
+
+    // Stitch the chunks together. A shot is taken by the chunk it starts
+    // in, but the next chunk may see it start a few frames later, once its
+    // own tracker has settled.
+    shots.clear();
+    for (const auto& chunk : chunks) {
+        if (!chunk.success) {
+            return false;
+        }
+        for (const auto& shot : chunk.shots) {
+            if (!shots.empty() && (shot.start_frame <= shots.back().end_frame ||
+                        shot.start_frame - shots.back().start_frame <
+                            kDuplicateShotFrames)) {
+                // Prefer the chunk that saw the shot end.
+                if (shots.back().end_frame == -1) {
+                    shots.back() = shot;
+                }
+                continue;
+            }
+            shots.push_back(shot);
+        }
+    }
+    return true;
+}
+
+void ChunkedProcessor::ProcessChunk(Chunk& chunk) const {
+    STAGE_TIMER("ProcessChunk");
+    VideoCapture video_capture(filename_);
+    if (!video_capture.isOpened()) {
+        cout << "Cannot open the video file: " << filename_ << endl;
+        return;
+    }
+    int frame_idx = max(0, chunk.start_frame - overlap_frames_);
+    // Seeking decodes from the keyframe before frame_idx.
+    if (frame_idx > 0 &&
+            !video_capture.set(CV_CAP_PROP_POS_FRAMES, frame_idx)) {
+        cout << "Cannot seek to frame " << frame_idx << " of " << filename_ <<
+            endl;
+        return;
+    }
+    // The tracker starts from the best candidate, as nobody clicks on the
+    // ball of a chunk.
+    MultipleKalmanFilter mkf(0, NULL, motion_model_);
+    BballTracker tracker(&mkf);
+    if (color_model_filename_ != NULL &&
+            !tracker.LoadColorModel(color_model_filename_)) {
+        return;
+    }
+    tracker.SetMotionGating(motion_gating_);
+    tracker.SetLabelingThreads(labeling_threads_);
+    tracker.SetAdaptiveColor(adaptive_color_);
+    // Motion gating takes the camera motion out, which is measured as in
+    // nba_vision_main. Without gating, the optical flow isn't needed.
+    unique_ptr<OpticalFlow> optical_flow;
+    if (motion_gating_) {
+        optical_flow.reset(new OpticalFlow());
+    }
+    Mat frame;
+    bool in_shot = false;
+    for (; video_capture.read(frame); frame_idx++) {
+        bool past_end = chunk.end_frame != -1 && frame_idx >= chunk.end_frame;
+        if (past_end && (!in_shot ||
+                    frame_idx >= chunk.end_frame + kMaxShotFrames)) {
+            break;
+        }
+        if (optical_flow != nullptr) {
+            optical_flow->computeOpticalFlow(frame);
+            tracker.SetCameraMotion(optical_flow->getCameraMotion());
+        }
+        chrono::steady_clock::time_point track_start =
+            chrono::steady_clock::now();
+        tracker.TrackBall(frame);
+        const TrackResult& result = tracker.GetLastResult();
+        uint64_t track_nanos = chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now() - track_start).count();
+        if (frame_idx < chunk.start_frame) {
+            // Warming up: the previous chunk owns these frames.
+            continue;
+        }
+        // Only frames the chunk owns are counted, so that the shots of all
+        // chunks add up to those of the video.
+        if (chunk.metrics != NULL && !past_end) {
+            chunk.metrics->RecordFrame(result, track_nanos);
+        }
+        if (result.event == SHOT_TAKEN && !past_end) {
+            DetectedShot shot;
+            shot.start_frame = frame_idx;
+            shot.end_frame = -1;
+            shot.made = false;
+            chunk.shots.push_back(shot);
+            in_shot = true;
+        } else if ((result.event == SHOT_MADE ||
+                    result.event == SHOT_MISSED) && in_shot) {
+            chunk.shots.back().end_frame = frame_idx;
+            chunk.shots.back().made = result.event == SHOT_MADE;
+            chunk.shots.back().features = result.shot_features;
+            in_shot = false;
+        }
+    }
+    chunk.success = true;
+}
+
+}
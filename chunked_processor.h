@@ -0,0 +1,86 @@
+#ifndef CHUNKED_PROCESSOR_H
+#define CHUNKED_PROCESSOR_H
+
+#include <string>
+#include <vector>
+
+#include "metrics_exporter.h"
+#include "motion_model.h"
+#include "shot_statistics.h"
+
+using namespace std;
+
+namespace nba_vision {
+
+// A shot found by TrackBall, in frames of the whole video.
+struct DetectedShot {
+    // Frame of the SHOT_TAKEN event.
+    int start_frame;
+    // Frame of the SHOT_MADE or SHOT_MISSED event, or -1 if the video ended
+    // during the shot.
+    int end_frame;
+    bool made;
+    // Set when the shot ended.
+    ShotFeatures features;
+};
+
+// Tracks one long video on several cores. The video is split into one
+// time range per thread and each range is tracked by its own BballTracker,
+// starting overlap_frames early so that the Kalman filter and the net
+// location are settled when the range starts. A range owns the shots taken
+// inside it and keeps tracking past its end until its last shot is over, so
+// shots that cross a boundary are counted once.
+class ChunkedProcessor {
+public:
+    ChunkedProcessor(const string& filename, const int& num_threads,
+            const int& overlap_frames);
+
+    // Tracks the whole video and returns its shots in order. Returns false
+    // if the video can't be read.
+    bool Run(vector<DetectedShot>& shots);
+
+    // Exports the metrics of each chunk as a worker of metrics_exporter,
+    // labelled chunk<i>. It must outlive Run.
+    void SetMetrics(MetricsExporter* metrics_exporter);
+
+    // The motion model of the ball in every chunk, constant velocity by
+    // default.
+    void SetMotionModel(const MotionModelType& motion_model);
+
+    // The settings of the tracker of every chunk, as the BballTracker
+    // methods of the same names. color_model_filename may be NULL for the
+    // default model and must outlive Run.
+    void SetColorModel(const char* color_model_filename);
+    void SetMotionGating(const bool& motion_gating);
+    void SetLabelingThreads(const int& labeling_threads);
+    void SetAdaptiveColor(const bool& adaptive_color);
+
+private:
+    // A range of frames [start_frame, end_frame), where end_frame is -1 for
+    // the range that runs to the end of the video.
+    struct Chunk {
+        int start_frame;
+        int end_frame;
+        bool success;
+        vector<DetectedShot> shots;
+        // NULL unless metrics are exported.
+        WorkerMetrics* metrics;
+    };
+
+    // Tracks a chunk, filling its shots.
+    void ProcessChunk(Chunk& chunk) const;
+
+    string filename_;
+    int num_threads_;
+    int overlap_frames_;
+    MetricsExporter* metrics_exporter_;
+    MotionModelType motion_model_;
+    const char* color_model_filename_;
+    bool motion_gating_;
+    int labeling_threads_;
+    bool adaptive_color_;
+};
+
+}
+
+#endif  // CHUNKED_PROCESSOR_H
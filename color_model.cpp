@@ -0,0 +1,246 @@
+#include "color_model.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "serialization.h"
+
+namespace nba_vision {
+
+// Lines are stored with this many steps per unit of color.
+const int kLineScale = 10000;
+// Half width of a band around a fitted line, in standard deviations of the
+// residuals. 2.25 gives the 7.5 of the default G vs R band.
+const double kLineBandStddevs = 2.25;
+// Need more samples than this to fit a model.
+const int kMinSamples = 2;
+// Weight of the starting model in samples per bin. The starting model's
+// colors stay the ball's until the tracker has seen about this many pixels
+// of a bin on other things.
+const double kPriorWeight = 20;
+// Growth of the sample weight per update, so that a sample counts half as
+// much about 35 updates later.
+const double kWeightGrowth = 1.02;
+// The histograms are scaled down when the sample weight reaches this.
+const double kMaxWeight = 1e6;
+
+// Mean and population standard deviation, as STDEV.P in the spreadsheet.
+static ChannelGaussian FitGaussian(const vector<double>& values) {
+    double sum = 0;
+    for (double value : values) {
+        sum += value;
+    }
+    double mean = sum / values.size();
+    double squared_error = 0;
+    for (double value : values) {
+        squared_error += (value - mean) * (value - mean);
+    }
+    return ChannelGaussian(mean, sqrt(squared_error / values.size()));
+}
+
+// Fits y = slope * x + intercept by least squares and returns the band
+// around it, or false if x doesn't vary.
+static bool FitBand(const vector<double>& y, const vector<double>& x,
+        ColorBand& band) {
+    ChannelGaussian x_gaussian = FitGaussian(x);
+    ChannelGaussian y_gaussian = FitGaussian(y);
+    double covariance = 0;
+    for (size_t i = 0; i < x.size(); i++) {
+        covariance += (x[i] - x_gaussian.mean) * (y[i] - y_gaussian.mean);
+    }
+    double x_variance = x_gaussian.stddev * x_gaussian.stddev * x.size();
+    if (x_variance == 0) {
+        return false;
+    }
+    double slope = covariance / x_variance;
+    double intercept = y_gaussian.mean - slope * x_gaussian.mean;
+    double squared_error = 0;
+    for (size_t i = 0; i < x.size(); i++) {
+        double residual = y[i] - (slope * x[i] + intercept);
+        squared_error += residual * residual;
+    }
+    double half_width = kLineBandStddevs * sqrt(squared_error / x.size());
+    int x_scale = lround(slope * kLineScale);
+    band = ColorBand(
+            ColorLine(kLineScale, x_scale,
+                lround((intercept + half_width) * kLineScale)),
+            ColorLine(kLineScale, x_scale,
+                lround((intercept - half_width) * kLineScale)));
+    return true;
+}
+
+RuntimeColorModel::RuntimeColorModel() :
+        red_(DefaultBballColorModel::Red()),
+        green_(DefaultBballColorModel::Green()),
+        blue_(DefaultBballColorModel::Blue()),
+        green_red_(DefaultBballColorModel::GreenRed()),
+        blue_red_(DefaultBballColorModel::BlueRed()),
+        blue_green_(DefaultBballColorModel::BlueGreen()),
+        prob_threshold_(DefaultBballColorModel::ProbThreshold()) {}
+
+bool RuntimeColorModel::LoadFromCsv(const char* filename) {
+    ifstream input(filename);
+    if (!input.is_open()) {
+        cout << "Could not open color samples: " << filename << endl;
+        return false;
+    }
+    vector<double> red, green, blue;
+    string line;
+    while (getline(input, line)) {
+        double r, g, b;
+        if (sscanf(line.c_str(), "%lf,%lf,%lf", &r, &g, &b) == 3) {
+            red.push_back(r);
+            green.push_back(g);
+            blue.push_back(b);
+        }
+    }
+    if ((int) red.size() <= kMinSamples) {
+        cout << "Not enough color samples in " << filename << endl;
+        return false;
+    }
+    ChannelGaussian red_gaussian = FitGaussian(red);
+    ChannelGaussian green_gaussian = FitGaussian(green);
+    ChannelGaussian blue_gaussian = FitGaussian(blue);
+    ColorBand green_red = green_red_;
+    ColorBand blue_red = blue_red_;
+    ColorBand blue_green = blue_green_;
+    if (red_gaussian.stddev == 0 || green_gaussian.stddev == 0 ||
+            blue_gaussian.stddev == 0 || !FitBand(green, red, green_red) ||
+            !FitBand(blue, red, blue_red) || !FitBand(blue, green, blue_green)) {
+        cout << "Color samples in " << filename << " don't vary enough." <<
+            endl;
+        return false;
+    }
+    red_ = red_gaussian;
+    green_ = green_gaussian;
+    blue_ = blue_gaussian;
+    green_red_ = green_red;
+    blue_red_ = blue_red;
+    blue_green_ = blue_green;
+    return true;
+}
+
+void AdaptiveColorModel::Init(const float* ball_fraction) {
+    ball_.resize(kNumBins);
+    background_.assign(kNumBins, kPriorWeight / 2);
+    table_.resize(kNumBins);
+    for (int bin = 0; bin < kNumBins; bin++) {
+        ball_[bin] = kPriorWeight * ball_fraction[bin];
+        table_[bin] = ball_[bin] > background_[bin];
+    }
+    weight_ = 1;
+}
+
+NBA_VISION_HOT_KERNEL
+void AdaptiveColorModel::Segment(const Mat& frame, Mat& binary_image) const {
+    binary_image.create(frame.rows, frame.cols, CV_8UC1);
+    for (int r = 0; r < frame.rows; r++) {
+        const Vec3b* pixel = frame.ptr<Vec3b>(r);
+        uchar* output = binary_image.ptr<uchar>(r);
+        for (int c = 0; c < frame.cols; c++) {
+            output[c] = table_[BinIndex(pixel[c])] ? 255 : 0;
+        }
+    }
+}
+
+void AdaptiveColorModel::Update(const Mat& frame, const Mat& binary_image,
+        const Mat& components_image, const int& component_index,
+        const Point2f& center, const float& radius) {
+    // The component only holds the pixels the table already accepts, so the
+    // ball is taken as the whole disc around it. Otherwise the colors the
+    // table rejects could never be learned.
+    Rect box = Rect(floor(center.x - radius), floor(center.y - radius),
+            ceil(2 * radius) + 2, ceil(2 * radius) + 2) &
+        Rect(0, 0, frame.cols, frame.rows);
+    float radius_squared = radius * radius;
+    int num_ball_pixels = 0;
+    for (int r = box.y; r < box.y + box.height; r++) {
+        const Vec3b* pixel = frame.ptr<Vec3b>(r);
+        float dy = r - center.y;
+        for (int c = box.x; c < box.x + box.width; c++) {
+            float dx = c - center.x;
+            if (dx * dx + dy * dy <= radius_squared) {
+                AddSample(ball_, pixel[c]);
+                num_ball_pixels++;
+            }
+        }
+    }
+    if (num_ball_pixels == 0) {
+        return;
+    }
+    // The ball colored pixels elsewhere are what the model should stop
+    // accepting. Take about as many of them as there were ball pixels, so
+    // that both histograms grow at the same rate.
+    int num_other_pixels = 0;
+    for (int r = 0; r < binary_image.rows; r++) {
+        const uchar* mask = binary_image.ptr<uchar>(r);
+        const uchar* label = components_image.ptr<uchar>(r);
+        float dy = r - center.y;
+        for (int c = 0; c < binary_image.cols; c++) {
+            float dx = c - center.x;
+            num_other_pixels += mask[c] != 0 && label[c] != component_index &&
+                dx * dx + dy * dy > radius_squared;
+        }
+    }
+    int stride = max(1, num_other_pixels / num_ball_pixels);
+    int index = 0;
+    for (int r = 0; r < binary_image.rows; r++) {
+        const Vec3b* pixel = frame.ptr<Vec3b>(r);
+        const uchar* mask = binary_image.ptr<uchar>(r);
+        const uchar* label = components_image.ptr<uchar>(r);
+        float dy = r - center.y;
+        for (int c = 0; c < binary_image.cols; c++) {
+            float dx = c - center.x;
+            if (mask[c] != 0 && label[c] != component_index &&
+                    dx * dx + dy * dy > radius_squared &&
+                    index++ % stride == 0) {
+                AddSample(background_, pixel[c]);
+            }
+        }
+    }
+    weight_ *= kWeightGrowth;
+    if (weight_ > kMaxWeight) {
+        // Both histograms are scaled alike, so the table stays the same.
+        for (int bin = 0; bin < kNumBins; bin++) {
+            ball_[bin] /= weight_;
+            background_[bin] /= weight_;
+        }
+        weight_ = 1;
+    }
+}
+
+void AdaptiveColorModel::SaveState(ostream& output) const {
+    WriteVector(output, ball_);
+    WriteVector(output, background_);
+    WriteValue(output, weight_);
+}
+
+bool AdaptiveColorModel::LoadState(istream& input) {
+    vector<double> ball, background;
+    double weight;
+    if (!ReadVector(input, ball) || (int) ball.size() != kNumBins ||
+            !ReadVector(input, background) ||
+            (int) background.size() != kNumBins ||
+            !ReadValue(input, weight) || !(weight > 0)) {
+        return false;
+    }
+    ball_.swap(ball);
+    background_.swap(background);
+    weight_ = weight;
+    for (int bin = 0; bin < kNumBins; bin++) {
+        table_[bin] = ball_[bin] > background_[bin];
+    }
+    return true;
+}
+
+void AdaptiveColorModel::AddSample(vector<double>& histogram,
+        const Vec3b& color) {
+    int bin = BinIndex(color);
+    histogram[bin] += weight_;
+    table_[bin] = ball_[bin] > background_[bin];
+}
+
+}
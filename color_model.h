@@ -0,0 +1,326 @@
+#ifndef COLOR_MODEL_H
+#define COLOR_MODEL_H
+
+#include <cmath>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include "multiversion.h"
+#include "util.h"
+
+using namespace cv;
+using namespace std;
+
+namespace nba_vision {
+
+// A line in the plane of two color channels, scaled to integers:
+// y_scale * y = x_scale * x + offset.
+struct ColorLine {
+    constexpr ColorLine(int y_scale_, int x_scale_, int offset_) :
+            y_scale(y_scale_), x_scale(x_scale_), offset(offset_) {}
+
+    constexpr bool IsAbove(const int& y, const int& x) const {
+        return y_scale * y > x_scale * x + offset;
+    }
+
+    constexpr bool IsBelow(const int& y, const int& x) const {
+        return y_scale * y < x_scale * x + offset;
+    }
+
+    int y_scale;
+    int x_scale;
+    int offset;
+};
+
+// The region between two lines where the ball colors lie.
+struct ColorBand {
+    constexpr ColorBand(ColorLine upper_, ColorLine lower_) :
+            upper(upper_), lower(lower_) {}
+
+    constexpr bool IsOutside(const int& y, const int& x) const {
+        return upper.IsAbove(y, x) || lower.IsBelow(y, x);
+    }
+
+    ColorLine upper;
+    ColorLine lower;
+};
+
+// The distribution of one channel over the ball samples.
+struct ChannelGaussian {
+    constexpr ChannelGaussian(double mean_, double stddev_) :
+            mean(mean_), stddev(stddev_) {}
+
+    double mean;
+    double stddev;
+};
+
+// The ball color model measured in metadata/BballColor.xlsx, as a
+// compile-time policy for ColorClassifier. The lines of the spreadsheet
+// are scaled to integers, e.g. G > 0.7618 * R - 10.14 + 7.5 becomes
+// 10000 * G > 7618 * R - 26400.
+struct DefaultBballColorModel {
+    static constexpr ChannelGaussian Red() {
+        return ChannelGaussian(110.6875, 10.98134071);
+    }
+    static constexpr ChannelGaussian Green() {
+        return ChannelGaussian(74.1875, 9.001518969);
+    }
+    static constexpr ChannelGaussian Blue() {
+        return ChannelGaussian(46.6875, 8.541946134);
+    }
+    // G within 7.5 of 0.7618 * R - 10.14.
+    static constexpr ColorBand GreenRed() {
+        return ColorBand(ColorLine(10000, 7618, -26400),
+                ColorLine(10000, 7618, -176400));
+    }
+    // R - 80 < B < 5 * R / 8 - 45 / 4.
+    static constexpr ColorBand BlueRed() {
+        return ColorBand(ColorLine(8, 5, -90), ColorLine(1, 1, -80));
+    }
+    // 5 * G / 4 - 255 / 4 < B < 5 * G / 7 + 40 / 7.
+    static constexpr ColorBand BlueGreen() {
+        return ColorBand(ColorLine(7, 5, 40), ColorLine(4, 5, -255));
+    }
+    // Value represents a probability of two standard deviations for each
+    // color.
+    static constexpr double ProbThreshold() { return 0.142625; }
+};
+
+// A color model fitted at runtime to samples of the ball color, for balls or
+// uniforms with other colors than the default model was measured on.
+class RuntimeColorModel {
+public:
+    // Starts as a copy of DefaultBballColorModel.
+    RuntimeColorModel();
+
+    // Fits the model to a CSV file with one R,G,B sample per line, e.g. the
+    // sample columns of metadata/BballColor.xlsx exported to CSV. Lines that
+    // are not three numbers (headers, comments) are skipped. Each channel
+    // gets the mean and population standard deviation of the samples, and
+    // each pair of channels a band around its least squares line. Returns
+    // false and keeps the current model if the file can't be used.
+    //
+    // Fitting metadata/BballColor.csv gives back the channels and the G-R
+    // band of DefaultBballColorModel, but not its B-R and B-G bands, which
+    // were picked by hand and are wider on the low blue side: the fit gives
+    // B within 12.1 of 0.6045 * R - 20.23 and within 12.7 of
+    // 0.7111 * G - 6.07, so the loaded model accepts fewer dark blue pixels.
+    bool LoadFromCsv(const char* filename);
+
+    ChannelGaussian Red() const { return red_; }
+    ChannelGaussian Green() const { return green_; }
+    ChannelGaussian Blue() const { return blue_; }
+    ColorBand GreenRed() const { return green_red_; }
+    ColorBand BlueRed() const { return blue_red_; }
+    ColorBand BlueGreen() const { return blue_green_; }
+    double ProbThreshold() const { return prob_threshold_; }
+
+private:
+    ChannelGaussian red_;
+    ChannelGaussian green_;
+    ChannelGaussian blue_;
+    ColorBand green_red_;
+    ColorBand blue_red_;
+    ColorBand blue_green_;
+    double prob_threshold_;
+};
+
+// Decides whether pixels have the color of the ball under Model, which is
+// DefaultBballColorModel or a RuntimeColorModel. The Gaussian test is turned
+// into per-channel tables when the classifier is built, so that the
+// per-pixel test is a few integer compares in the common case.
+template <typename Model>
+class ColorClassifier {
+public:
+    explicit ColorClassifier(const Model& model = Model()) : model_(model) {
+        BuildChannelTable(model_.Red(), red_factor_, red_near_);
+        BuildChannelTable(model_.Green(), green_factor_, green_near_);
+        BuildChannelTable(model_.Blue(), blue_factor_, blue_near_);
+    }
+
+    // Returns true if the color could be that of the basketball.
+    bool IsColor(const Vec3b& color) const {
+        int B = color[0], G = color[1], R = color[2];
+        // A pseudo probability that the ball is this color, from how far each
+        // channel is from its mean. A channel near its mean is enough to
+        // pass, otherwise the product of the three is compared.
+        if (!red_near_[R] && !green_near_[G] && !blue_near_[B]) {
+            double prob = abs(red_factor_[R] * green_factor_[G] *
+                    blue_factor_[B]);
+            // 0.125 is the max value of prob and the least likely value to
+            // be the basketball.
+            if ((0.125 - prob) / 0.125 < model_.ProbThreshold()) {
+                return false;
+            }
+        }
+        // Check the relationships between the colors to further shrink the
+        // space. Look for two errors out of three to rule out the pixel.
+        int count = model_.GreenRed().IsOutside(G, R);
+        if (model_.BlueRed().IsOutside(B, R)) {
+            if (count > 0) {
+                return false;
+            }
+            count++;
+        }
+        if (model_.BlueGreen().IsOutside(B, G) && count > 0) {
+            return false;
+        }
+        return true;
+    }
+
+    // Sets the pixels of binary_image that have the color of the ball to
+    // 255 and the others to 0.
+    NBA_VISION_HOT_KERNEL
+    void Segment(const Mat& frame, Mat& binary_image) const {
+        binary_image.create(frame.rows, frame.cols, CV_8UC1);
+        for (int r = 0; r < frame.rows; r++) {
+            const Vec3b* pixel = frame.ptr<Vec3b>(r);
+            uchar* output = binary_image.ptr<uchar>(r);
+            for (int c = 0; c < frame.cols; c++) {
+                output[c] = IsColor(pixel[c]) ? 255 : 0;
+            }
+        }
+    }
+
+    const Model& GetModel() const { return model_; }
+
+private:
+    // factor[v] is the signed distance of Phi from 0.5 at value v. near[v] is
+    // set when that distance alone keeps the product of the three under the
+    // threshold, whatever the other channels are.
+    void BuildChannelTable(const ChannelGaussian& gaussian, double* factor,
+            bool* near) {
+        // Each factor is at most 0.5, so the product of the other two is at
+        // most 0.25. Shrunk slightly so rounding can't let a pixel through
+        // that the product would reject.
+        double max_near = 0.125 * (1 - model_.ProbThreshold()) / 0.25 *
+            (1 - 1e-9);
+        for (int v = 0; v < 256; v++) {
+            factor[v] = Phi(v, gaussian.mean, gaussian.stddev) - 0.5;
+            near[v] = abs(factor[v]) <= max_near;
+        }
+    }
+
+    Model model_;
+    double red_factor_[256];
+    double green_factor_[256];
+    double blue_factor_[256];
+    bool red_near_[256];
+    bool green_near_[256];
+    bool blue_near_[256];
+};
+
+// A ball color model that adapts to the lighting of the arena. Colors are
+// quantized to 32 levels per channel, and each bin keeps how often it was
+// seen on the ball and on ball colored things that were not the ball. A bin
+// is the ball's color while the first outweighs the second, which is kept in
+// a table so that segmenting is one lookup per pixel. Learning from a
+// detection only touches the bins of the pixels it sees.
+class AdaptiveColorModel {
+public:
+    // Starts from classifier: a bin is the ball's color when most of its
+    // colors pass the classifier.
+    template <typename Model>
+    explicit AdaptiveColorModel(const ColorClassifier<Model>& classifier) {
+        Init(SeedFractions(classifier).data());
+    }
+
+    // Starts from the NumBins() fractions from SeedFractions, e.g. kept in
+    // an AssetCache.
+    explicit AdaptiveColorModel(const float* ball_fraction) {
+        Init(ball_fraction);
+    }
+
+    // The fraction of the colors of each bin that pass classifier. Takes a
+    // few million classifier tests.
+    template <typename Model>
+    static vector<float> SeedFractions(
+            const ColorClassifier<Model>& classifier) {
+        vector<float> ball_fraction(kNumBins);
+        // Samples every other value of each channel in the bin.
+        const int step = 2;
+        const int samples_per_bin = (kBinWidth / step) * (kBinWidth / step) *
+            (kBinWidth / step);
+        for (int bin = 0; bin < kNumBins; bin++) {
+            Vec3b base = BinColor(bin);
+            int num_ball = 0;
+            for (int b = 0; b < kBinWidth; b += step) {
+                for (int g = 0; g < kBinWidth; g += step) {
+                    for (int r = 0; r < kBinWidth; r += step) {
+                        num_ball += classifier.IsColor(Vec3b(base[0] + b,
+                                    base[1] + g, base[2] + r));
+                    }
+                }
+            }
+            ball_fraction[bin] = num_ball / (float) samples_per_bin;
+        }
+        return ball_fraction;
+    }
+
+    static int NumBins() { return kNumBins; }
+
+    // Returns true if the color could be that of the basketball.
+    bool IsColor(const Vec3b& color) const {
+        return table_[BinIndex(color)] != 0;
+    }
+
+    // Sets the pixels of binary_image that have the color of the ball to
+    // 255 and the others to 0.
+    void Segment(const Mat& frame, Mat& binary_image) const;
+
+    // Learns from a detection of the ball: every pixel within radius of
+    // center is the ball, whether the table accepted it or not, and the
+    // pixels that binary_image marks as ball colored but are outside the
+    // disc and in other components than component_index are not. The images
+    // all cover the same area.
+    void Update(const Mat& frame, const Mat& binary_image,
+            const Mat& components_image, const int& component_index,
+            const Point2f& center, const float& radius);
+
+    // Writes the learned histograms for a checkpoint.
+    void SaveState(ostream& output) const;
+
+    // Restores the histograms written by SaveState. Returns false if the
+    // stream is malformed.
+    bool LoadState(istream& input);
+
+private:
+    // 5 bits per channel.
+    static const int kBinBits = 5;
+    static const int kBinWidth = 1 << (8 - kBinBits);
+    static const int kNumBins = 1 << (3 * kBinBits);
+
+    static int BinIndex(const Vec3b& color) {
+        return ((color[0] >> (8 - kBinBits)) << (2 * kBinBits)) |
+            ((color[1] >> (8 - kBinBits)) << kBinBits) |
+            (color[2] >> (8 - kBinBits));
+    }
+
+    // The darkest color of the bin.
+    static Vec3b BinColor(const int& bin) {
+        const int mask = (1 << kBinBits) - 1;
+        return Vec3b(((bin >> (2 * kBinBits)) & mask) * kBinWidth,
+                ((bin >> kBinBits) & mask) * kBinWidth,
+                (bin & mask) * kBinWidth);
+    }
+
+    void Init(const float* ball_fraction);
+
+    // Adds a sample at the current weight and updates the table for its bin.
+    void AddSample(vector<double>& histogram, const Vec3b& color);
+
+    vector<double> ball_;
+    vector<double> background_;
+    vector<uchar> table_;
+    // Weight of a new sample. It grows with every update rather than the
+    // histograms decaying, so that older samples count for less without
+    // touching every bin.
+    double weight_;
+};
+
+}
+
+#endif  // COLOR_MODEL_H
@@ -0,0 +1,372 @@
+#include "frame_source.h"
+
+#include <chrono>
+#include <fcntl.h>
+#include <iostream>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include "synthetic_scene.h"
+
+namespace nba_vision {
+
+const char kSharedMemoryPrefix[] = "shm:";
+const char kRawFileExtension[] = ".bgr";
+const char kSyntheticPrefix[] = "synthetic:";
+// How long the consumer sleeps while the ring is empty.
+const int kEmptyRingSleepMicros = 500;
+
+bool VideoCaptureSource::Open(const string& filename) {
+    if (!video_capture_.open(filename)) {
+        return false;
+    }
+    frame_size_ = Size(video_capture_.get(CV_CAP_PROP_FRAME_WIDTH),
+            video_capture_.get(CV_CAP_PROP_FRAME_HEIGHT));
+    return true;
+}
+
+bool VideoCaptureSource::Read(Mat& frame) {
+    return video_capture_.read(frame);
+}
+
+bool VideoCaptureSource::Skip() {
+    return video_capture_.grab();
+}
+
+Size VideoCaptureSource::FrameSize() const {
+    return frame_size_;
+}
+
+bool VideoCaptureSource::SkipTo(const int& frame_idx) {
+    return video_capture_.set(CV_CAP_PROP_POS_FRAMES, frame_idx);
+}
+
+RawFileSource::RawFileSource() : data_(NULL), mapped_size_(0), width_(0),
+        height_(0), num_frames_(0), next_frame_(0) {}
+
+RawFileSource::~RawFileSource() {
+    if (data_ != NULL) {
+        munmap(data_, mapped_size_);
+    }
+}
+
+bool RawFileSource::Open(const string& filename, const int& width,
+        const int& height) {
+    if (width <= 0 || height <= 0) {
+        cout << "The frame size of " << filename << " must be given." << endl;
+        return false;
+    }
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cout << "Cannot open the raw frame file: " << filename << endl;
+        return false;
+    }
+    struct stat file_stat;
+    size_t frame_bytes = (size_t) width * height * 3;
+    if (fstat(fd, &file_stat) != 0 ||
+            (size_t) file_stat.st_size < frame_bytes) {
+        cout << filename << " doesn't hold a single " << width << "x" <<
+            height << " frame." << endl;
+        close(fd);
+        return false;
+    }
+    void* data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        cout << "Cannot map the raw frame file: " << filename << endl;
+        return false;
+    }
+    madvise(data, file_stat.st_size, MADV_SEQUENTIAL);
+    data_ = (uchar*) data;
+    mapped_size_ = file_stat.st_size;
+    width_ = width;
+    height_ = height;
+    num_frames_ = mapped_size_ / frame_bytes;
+    next_frame_ = 0;
+    return true;
+}
+
+bool RawFileSource::Read(Mat& frame) {
+    if (next_frame_ >= num_frames_) {
+        return false;
+    }
+    size_t frame_bytes = (size_t) width_ * height_ * 3;
+    if (next_frame_ > 0) {
+        // The previous frame is no longer valid, so its pages are dropped;
+        // the page it shares with this frame is kept.
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t start = (next_frame_ - 1) * frame_bytes / page_size * page_size;
+        size_t end = next_frame_ * frame_bytes / page_size * page_size;
+        if (end > start) {
+            madvise(data_ + start, end - start, MADV_DONTNEED);
+        }
+    }
+    frame = Mat(height_, width_, CV_8UC3, data_ + next_frame_ * frame_bytes);
+    next_frame_++;
+    return true;
+}
+
+bool RawFileSource::Skip() {
+    if (next_frame_ >= num_frames_) {
+        return false;
+    }
+    next_frame_++;
+    return true;
+}
+
+Size RawFileSource::FrameSize() const {
+    return Size(width_, height_);
+}
+
+bool RawFileSource::SkipTo(const int& frame_idx) {
+    if (frame_idx < 0 || frame_idx > num_frames_) {
+        return false;
+    }
+    next_frame_ = frame_idx;
+    return true;
+}
+
+int RawFileSource::NumFrames() const {
+    return num_frames_;
+}
+
+SharedMemorySource::SharedMemorySource() : header_(NULL), slots_(NULL),
+        slots_size_(0), frame_bytes_(0), holds_slot_(false) {}
+
+SharedMemorySource::~SharedMemorySource() {
+    if (header_ != NULL) {
+        ReleaseSlot();
+        munmap(header_, SharedFrameRingHeader::kSlotsOffset);
+        munmap((void*) slots_, slots_size_);
+    }
+}
+
+bool SharedMemorySource::Open(const string& name) {
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        cout << "Cannot open the shared memory: " << name << endl;
+        return false;
+    }
+    struct stat shm_stat;
+    if (fstat(fd, &shm_stat) != 0 ||
+            (size_t) shm_stat.st_size < SharedFrameRingHeader::kSlotsOffset) {
+        cout << name << " is not a frame ring." << endl;
+        close(fd);
+        return false;
+    }
+    void* data = mmap(NULL, SharedFrameRingHeader::kSlotsOffset,
+            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        cout << "Cannot map the shared memory: " << name << endl;
+        close(fd);
+        return false;
+    }
+    SharedFrameRingHeader* header = (SharedFrameRingHeader*) data;
+    size_t frame_bytes = (size_t) header->width * header->height * 3;
+    if (header->magic != SharedFrameRingHeader::kMagic ||
+            header->version != SharedFrameRingHeader::kVersion ||
+            header->num_slots == 0 || frame_bytes == 0 ||
+            (size_t) shm_stat.st_size < SharedFrameRingHeader::kSlotsOffset +
+                header->num_slots * frame_bytes) {
+        cout << name << " is not a frame ring of version " <<
+            SharedFrameRingHeader::kVersion << "." << endl;
+        munmap(data, SharedFrameRingHeader::kSlotsOffset);
+        close(fd);
+        return false;
+    }
+    size_t slots_size = header->num_slots * frame_bytes;
+    void* slots = mmap(NULL, slots_size, PROT_READ, MAP_SHARED, fd,
+            SharedFrameRingHeader::kSlotsOffset);
+    close(fd);
+    if (slots == MAP_FAILED) {
+        cout << "Cannot map the shared memory: " << name << endl;
+        munmap(data, SharedFrameRingHeader::kSlotsOffset);
+        return false;
+    }
+    header_ = header;
+    slots_ = (const uchar*) slots;
+    slots_size_ = slots_size;
+    frame_bytes_ = frame_bytes;
+    return true;
+}
+
+bool SharedMemorySource::Read(Mat& frame) {
+    ReleaseSlot();
+    uint64_t read_index;
+    if (!WaitForFrame(read_index)) {
+        return false;
+    }
+    const uchar* slot = slots_ + (read_index % header_->num_slots) *
+        frame_bytes_;
+    // Writing to the frame faults, as the slot is mapped read-only.
+    frame = Mat(header_->height, header_->width, CV_8UC3, (void*) slot);
+    holds_slot_ = true;
+    return true;
+}
+
+bool SharedMemorySource::Skip() {
+    ReleaseSlot();
+    uint64_t read_index;
+    if (!WaitForFrame(read_index)) {
+        return false;
+    }
+    header_->read_index.fetch_add(1, memory_order_release);
+    return true;
+}
+
+bool SharedMemorySource::WaitForFrame(uint64_t& read_index) const {
+    read_index = header_->read_index.load(memory_order_relaxed);
+    while (header_->write_index.load(memory_order_acquire) <= read_index) {
+        if (header_->closed.load(memory_order_acquire) &&
+                header_->write_index.load(memory_order_acquire) <= read_index) {
+            return false;
+        }
+        this_thread::sleep_for(chrono::microseconds(kEmptyRingSleepMicros));
+    }
+    return true;
+}
+
+void SharedMemorySource::ReleaseSlot() {
+    if (holds_slot_) {
+        header_->read_index.fetch_add(1, memory_order_release);
+        holds_slot_ = false;
+    }
+}
+
+Size SharedMemorySource::FrameSize() const {
+    return Size(header_->width, header_->height);
+}
+
+bool SharedMemorySource::SkipTo(const int& frame_idx) {
+    cout << "Cannot seek in a shared memory ring." << endl;
+    return false;
+}
+
+int SharedMemorySource::QueueDepth() const {
+    return header_->write_index.load(memory_order_acquire) -
+        header_->read_index.load(memory_order_relaxed) - (holds_slot_ ? 1 : 0);
+}
+
+SharedFrameRingWriter::SharedFrameRingWriter() : header_(NULL),
+        mapped_size_(0), frame_bytes_(0) {}
+
+SharedFrameRingWriter::~SharedFrameRingWriter() {
+    if (header_ != NULL) {
+        Close();
+        munmap(header_, mapped_size_);
+        shm_unlink(name_.c_str());
+    }
+}
+
+bool SharedFrameRingWriter::Create(const string& name, const int& width,
+        const int& height, const int& num_slots) {
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        cout << "Cannot create the shared memory: " << name << endl;
+        return false;
+    }
+    size_t frame_bytes = (size_t) width * height * 3;
+    size_t size = SharedFrameRingHeader::kSlotsOffset + num_slots * frame_bytes;
+    void* data = MAP_FAILED;
+    if (ftruncate(fd, size) == 0) {
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) {
+        cout << "Cannot map the shared memory: " << name << endl;
+        shm_unlink(name.c_str());
+        return false;
+    }
+    SharedFrameRingHeader* header = new (data) SharedFrameRingHeader();
+    header->width = width;
+    header->height = height;
+    header->num_slots = num_slots;
+    header->version = SharedFrameRingHeader::kVersion;
+    header->closed.store(0, memory_order_relaxed);
+    header->write_index.store(0, memory_order_relaxed);
+    header->read_index.store(0, memory_order_relaxed);
+    // Written last, so a consumer never sees a valid magic with a partly
+    // written header.
+    atomic_thread_fence(memory_order_release);
+    header->magic = SharedFrameRingHeader::kMagic;
+    name_ = name;
+    header_ = header;
+    mapped_size_ = size;
+    frame_bytes_ = frame_bytes;
+    return true;
+}
+
+uchar* SharedFrameRingWriter::AcquireSlot() {
+    uint64_t write_index = header_->write_index.load(memory_order_relaxed);
+    if (write_index - header_->read_index.load(memory_order_acquire) >=
+            header_->num_slots) {
+        return NULL;
+    }
+    return (uchar*) header_ + SharedFrameRingHeader::kSlotsOffset +
+        (write_index % header_->num_slots) * frame_bytes_;
+}
+
+void SharedFrameRingWriter::Publish() {
+    header_->write_index.fetch_add(1, memory_order_release);
+}
+
+void SharedFrameRingWriter::Close() {
+    header_->closed.store(1, memory_order_release);
+}
+
+bool IsVideoFileSource(const string& name) {
+    const size_t prefix_length = sizeof(kSharedMemoryPrefix) - 1;
+    const size_t extension_length = sizeof(kRawFileExtension) - 1;
+    const size_t synthetic_prefix_length = sizeof(kSyntheticPrefix) - 1;
+    return name.compare(0, prefix_length, kSharedMemoryPrefix) != 0 &&
+        name.compare(0, synthetic_prefix_length, kSyntheticPrefix) != 0 &&
+        !(name.size() > extension_length && name.compare(
+                    name.size() - extension_length, extension_length,
+                    kRawFileExtension) == 0);
+}
+
+FrameSource* OpenFrameSource(const string& name, const int& width,
+        const int& height) {
+    const size_t prefix_length = sizeof(kSharedMemoryPrefix) - 1;
+    const size_t extension_length = sizeof(kRawFileExtension) - 1;
+    const size_t synthetic_prefix_length = sizeof(kSyntheticPrefix) - 1;
+    if (name.compare(0, prefix_length, kSharedMemoryPrefix) == 0) {
+        SharedMemorySource* source = new SharedMemorySource();
+        if (!source->Open(name.substr(prefix_length))) {
+            delete source;
+            return NULL;
+        }
+        return source;
+    }
+    if (name.compare(0, synthetic_prefix_length, kSyntheticPrefix) == 0) {
+        SyntheticSceneConfig config;
+        if (!ParseSyntheticSpec(name.substr(synthetic_prefix_length),
+                    config)) {
+            cout << "Malformed synthetic scene: " << name << endl;
+            return NULL;
+        }
+        return new SyntheticScene(config);
+    }
+    if (name.size() > extension_length && name.compare(
+                name.size() - extension_length, extension_length,
+                kRawFileExtension) == 0) {
+        RawFileSource* source = new RawFileSource();
+        if (!source->Open(name, width, height)) {
+            delete source;
+            return NULL;
+        }
+        return source;
+    }
+    VideoCaptureSource* source = new VideoCaptureSource();
+    if (!source->Open(name)) {
+        cout << "Cannot open the video file: " << name << endl;
+        delete source;
+        return NULL;
+    }
+    return source;
+}
+
+}
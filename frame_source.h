@@ -0,0 +1,201 @@
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include <opencv2/highgui/highgui.hpp>
+
+using namespace cv;
+using namespace std;
+
+namespace nba_vision {
+
+// Where the frames of a game come from. Read points frame at the next frame,
+// which stays valid until the next call to Read or until the source is
+// destroyed. Sources of already decoded frames wrap their memory in the Mat
+// header without copying, and that memory may be read-only, so frames are
+// only read; overlays are drawn on a copy.
+class FrameSource {
+public:
+    virtual ~FrameSource() {}
+
+    // Returns false when there are no more frames.
+    virtual bool Read(Mat& frame) = 0;
+
+    // Moves past the next frame as cheaply as the source allows, e.g. to
+    // drop a late frame of a live feed. Returns false when there are no more
+    // frames.
+    virtual bool Skip() = 0;
+
+    virtual Size FrameSize() const = 0;
+
+    // Makes frame_idx the next frame read, e.g. to resume from a checkpoint.
+    // Returns false if the source can't seek.
+    virtual bool SkipTo(const int& frame_idx) = 0;
+
+    // Frames that are ready but not read yet, for sources fed from outside
+    // such as a live feed. Files are never behind, so this is 0 by default.
+    virtual int QueueDepth() const { return 0; }
+};
+
+// Decodes a video file with OpenCV.
+class VideoCaptureSource : public FrameSource {
+public:
+    bool Open(const string& filename);
+
+    bool Read(Mat& frame);
+
+    // Only demuxes the frame, without decoding it.
+    bool Skip();
+
+    Size FrameSize() const;
+
+    bool SkipTo(const int& frame_idx);
+
+private:
+    VideoCapture video_capture_;
+    Size frame_size_;
+};
+
+// A file of raw BGR frames of a known size, back to back, e.g. from
+// ffmpeg -pix_fmt bgr24 -f rawvideo. The file is mapped read-only, and the
+// pages of each frame are dropped from the mapping once the next one is
+// read, so that a long game doesn't stay resident.
+class RawFileSource : public FrameSource {
+public:
+    RawFileSource();
+    ~RawFileSource();
+
+    bool Open(const string& filename, const int& width, const int& height);
+
+    bool Read(Mat& frame);
+
+    bool Skip();
+
+    Size FrameSize() const;
+
+    bool SkipTo(const int& frame_idx);
+
+    int NumFrames() const;
+
+private:
+    uchar* data_;
+    size_t mapped_size_;
+    int width_;
+    int height_;
+    int num_frames_;
+    int next_frame_;
+};
+
+// The start of a shared memory frame ring. A producer publishes a frame by
+// writing it into slot write_index % num_slots and then incrementing
+// write_index. The consumer owns the slot of read_index until it increments
+// read_index, so the producer must wait while write_index - read_index ==
+// num_slots. Slots start at kSlotsOffset and are width * height * 3 bytes of
+// BGR each.
+struct SharedFrameRingHeader {
+    static const uint32_t kMagic = 0x4e425652;  // "NBVR"
+    static const uint32_t kVersion = 1;
+    static const size_t kSlotsOffset = 4096;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t num_slots;
+    // Set by the producer after its last frame.
+    atomic<uint32_t> closed;
+    atomic<uint64_t> write_index;
+    atomic<uint64_t> read_index;
+};
+
+// Reads frames from a ring created by SharedFrameRingWriter, or by another
+// process following SharedFrameRingHeader. Frames point straight into their
+// slot, which is mapped read-only so that nothing reaches the producer or
+// other readers, and which is only handed back to the producer by the next
+// Read.
+class SharedMemorySource : public FrameSource {
+public:
+    SharedMemorySource();
+    ~SharedMemorySource();
+
+    // name is a POSIX shared memory name, e.g. "/nba_vision_frames".
+    bool Open(const string& name);
+
+    // Hands the slot of the last frame back to the producer and waits for
+    // the next frame. Returns false once the producer has closed the ring and
+    // every frame was read.
+    bool Read(Mat& frame);
+
+    // Hands the next frame back to the producer without looking at it.
+    bool Skip();
+
+    Size FrameSize() const;
+
+    // A live ring can't be replayed, so this only fails.
+    bool SkipTo(const int& frame_idx);
+
+    // Frames published by the producer after the last one read.
+    int QueueDepth() const;
+
+private:
+    // Hands the slot of the last frame read back to the producer.
+    void ReleaseSlot();
+
+    // Waits for a frame in the slot of read_index. Returns false once the
+    // producer has closed the ring and every frame was read.
+    bool WaitForFrame(uint64_t& read_index) const;
+
+    // The header page is mapped read-write for read_index, the slots after
+    // it read-only.
+    SharedFrameRingHeader* header_;
+    const uchar* slots_;
+    size_t slots_size_;
+    size_t frame_bytes_;
+    // Whether the slot of read_index holds the last frame read.
+    bool holds_slot_;
+};
+
+// The producer side of a shared memory frame ring.
+class SharedFrameRingWriter {
+public:
+    SharedFrameRingWriter();
+    // Closes the ring and unlinks the shared memory.
+    ~SharedFrameRingWriter();
+
+    bool Create(const string& name, const int& width, const int& height,
+            const int& num_slots);
+
+    // Returns the slot to write the next frame into, or NULL if the consumer
+    // hasn't released enough slots yet.
+    uchar* AcquireSlot();
+
+    // Makes the frame written into the acquired slot visible to the consumer.
+    void Publish();
+
+    // Tells the consumer that no more frames will be published.
+    void Close();
+
+private:
+    string name_;
+    SharedFrameRingHeader* header_;
+    size_t mapped_size_;
+    size_t frame_bytes_;
+};
+
+// Opens the source for name: "shm:<name>" for a shared memory ring,
+// "synthetic:<spec>" for a SyntheticScene (see ParseSyntheticSpec), a .bgr
+// file of raw frames of width x height, and a video file otherwise. Returns
+// NULL if it can't be opened.
+FrameSource* OpenFrameSource(const string& name, const int& width,
+        const int& height);
+
+// Returns true if OpenFrameSource opens name as a video file, which is the
+// only source whose packets can be copied out of it again.
+bool IsVideoFileSource(const string& name);
+
+}
+
+#endif  // FRAME_SOURCE_H
@@ -0,0 +1,326 @@
+#include "highlight_extractor.h"
+
+#include <algorithm>
+#include <iostream>
+
+#ifdef NBA_VISION_HIGHLIGHTS
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/mathematics.h>
+}
+#endif
+
+#include "bball_tracker.h"
+#include "stage_timer.h"
+
+namespace nba_vision {
+
+// A shot that is still in the air when the video ends is cut this long
+// after it was taken.
+const double kMaxShotSeconds = 5;
+
+HighlightExtractor::HighlightExtractor(const double& pre_roll_seconds,
+        const double& post_roll_seconds) :
+        pre_roll_seconds_(pre_roll_seconds),
+        post_roll_seconds_(post_roll_seconds), in_shot_(false) {}
+
+void HighlightExtractor::AddEvent(const int& frame_idx, const int& event) {
+    if (event == SHOT_TAKEN) {
+        DetectedShot shot;
+        shot.start_frame = frame_idx;
+        shot.end_frame = -1;
+        shot.made = false;
+        shots_.push_back(shot);
+        in_shot_ = true;
+    } else if ((event == SHOT_MADE || event == SHOT_MISSED) && in_shot_) {
+        shots_.back().end_frame = frame_idx;
+        shots_.back().made = event == SHOT_MADE;
+        in_shot_ = false;
+    }
+}
+
+void HighlightExtractor::AddShots(const vector<DetectedShot>& shots) {
+    shots_.insert(shots_.end(), shots.begin(), shots.end());
+}
+
+static bool IsEarlier(const HighlightWindow& a, const HighlightWindow& b) {
+    return a.start_seconds < b.start_seconds;
+}
+
+vector<HighlightWindow> HighlightExtractor::BuildWindows(
+        const double& fps) const {
+    vector<HighlightWindow> windows;
+    for (const auto& shot : shots_) {
+        HighlightWindow window;
+        window.start_seconds = max(0.0,
+                shot.start_frame / fps - pre_roll_seconds_);
+        window.end_seconds = (shot.end_frame == -1 ?
+                shot.start_frame / fps + kMaxShotSeconds :
+                shot.end_frame / fps) + post_roll_seconds_;
+        window.num_shots = 1;
+        windows.push_back(window);
+    }
+    sort(windows.begin(), windows.end(), IsEarlier);
+    vector<HighlightWindow> merged;
+    for (const auto& window : windows) {
+        if (!merged.empty() &&
+                window.start_seconds <= merged.back().end_seconds) {
+            merged.back().end_seconds = max(merged.back().end_seconds,
+                    window.end_seconds);
+            merged.back().num_shots += window.num_shots;
+        } else {
+            merged.push_back(window);
+        }
+    }
+    return merged;
+}
+
+#ifdef NBA_VISION_HIGHLIGHTS
+
+// Copies time ranges of the main video stream and the audio streams of one
+// container into another, without decoding. Times are in microseconds from
+// the first video frame.
+class StreamCopier {
+public:
+    StreamCopier() : input_(NULL), output_(NULL), video_stream_(-1),
+            video_start_(0), output_time_(0), header_written_(false) {}
+
+    ~StreamCopier() {
+        if (output_ != NULL) {
+            if (!(output_->oformat->flags & AVFMT_NOFILE)) {
+                avio_closep(&output_->pb);
+            }
+            avformat_free_context(output_);
+        }
+        avformat_close_input(&input_);
+    }
+
+    bool Open(const string& input_filename, const string& output_filename) {
+        if (avformat_open_input(&input_, input_filename.c_str(), NULL,
+                    NULL) < 0 || avformat_find_stream_info(input_, NULL) < 0) {
+            cout << "Cannot open the video file: " << input_filename << endl;
+            return false;
+        }
+        video_stream_ = av_find_best_stream(input_, AVMEDIA_TYPE_VIDEO, -1,
+                -1, NULL, 0);
+        if (video_stream_ < 0) {
+            cout << "No video stream in " << input_filename << endl;
+            return false;
+        }
+        AVStream* video = input_->streams[video_stream_];
+        if (video->start_time != AV_NOPTS_VALUE) {
+            video_start_ = av_rescale_q(video->start_time, video->time_base,
+                    AV_TIME_BASE_Q);
+        }
+        if (avformat_alloc_output_context2(&output_, NULL, NULL,
+                    output_filename.c_str()) < 0) {
+            cout << "Cannot pick a container for " << output_filename << endl;
+            return false;
+        }
+        stream_map_.assign(input_->nb_streams, -1);
+        for (unsigned int i = 0; i < input_->nb_streams; i++) {
+            const AVCodecParameters* codecpar = input_->streams[i]->codecpar;
+            bool copied = (int) i == video_stream_ ||
+                codecpar->codec_type == AVMEDIA_TYPE_AUDIO;
+            if (!copied) {
+                continue;
+            }
+            AVStream* stream = avformat_new_stream(output_, NULL);
+            if (stream == NULL ||
+                    avcodec_parameters_copy(stream->codecpar, codecpar) < 0) {
+                cout << "Cannot copy stream " << i << " of " <<
+                    input_filename << endl;
+                return false;
+            }
+            // The tag of the input container may mean nothing in the output.
+            stream->codecpar->codec_tag = 0;
+            stream->time_base = input_->streams[i]->time_base;
+            stream_map_[i] = stream->index;
+        }
+        last_dts_.assign(output_->nb_streams, AV_NOPTS_VALUE);
+        if (!(output_->oformat->flags & AVFMT_NOFILE) &&
+                avio_open(&output_->pb, output_filename.c_str(),
+                    AVIO_FLAG_WRITE) < 0) {
+            cout << "Cannot write " << output_filename << endl;
+            return false;
+        }
+        if (avformat_write_header(output_, NULL) < 0) {
+            cout << "Cannot write " << output_filename << endl;
+            return false;
+        }
+        header_written_ = true;
+        return true;
+    }
+
+    double FramesPerSecond() const {
+        const AVStream* video = input_->streams[video_stream_];
+        AVRational rate = video->avg_frame_rate.num > 0 ?
+            video->avg_frame_rate : video->r_frame_rate;
+        return rate.den > 0 ? av_q2d(rate) : 0;
+    }
+
+    // Appends [start, end) to the output, from the video keyframe at or
+    // before start.
+    bool CopyWindow(const int64_t& start, const int64_t& end) {
+        AVStream* video = input_->streams[video_stream_];
+        if (av_seek_frame(input_, video_stream_,
+                    av_rescale_q(video_start_ + start, AV_TIME_BASE_Q,
+                        video->time_base), AVSEEK_FLAG_BACKWARD) < 0) {
+            cout << "Cannot seek to " << start / 1e6 << " s" << endl;
+            return false;
+        }
+        const int64_t window_end = video_start_ + end;
+        // Input time of the first video keyframe after the seek, where the
+        // window is cut. Nothing before it could be decoded.
+        int64_t cut_time = AV_NOPTS_VALUE;
+        bool success = true;
+        AVPacket* packet = av_packet_alloc();
+        while (av_read_frame(input_, packet) >= 0) {
+            const int stream_index = packet->stream_index;
+            const int output_index = stream_map_[stream_index];
+            if (output_index < 0 || packet->pts == AV_NOPTS_VALUE) {
+                av_packet_unref(packet);
+                continue;
+            }
+            const AVStream* input_stream = input_->streams[stream_index];
+            int64_t time = av_rescale_q(packet->pts, input_stream->time_base,
+                    AV_TIME_BASE_Q);
+            if (cut_time == AV_NOPTS_VALUE &&
+                    stream_index == video_stream_ &&
+                    (packet->flags & AV_PKT_FLAG_KEY)) {
+                cut_time = time;
+            }
+            if (time >= window_end && stream_index == video_stream_) {
+                av_packet_unref(packet);
+                break;
+            }
+            if (cut_time == AV_NOPTS_VALUE || time < cut_time ||
+                    time >= window_end) {
+                av_packet_unref(packet);
+                continue;
+            }
+            if (!WritePacket(packet, input_stream,
+                        output_time_ - cut_time)) {
+                success = false;
+                break;
+            }
+        }
+        av_packet_free(&packet);
+        if (cut_time != AV_NOPTS_VALUE && cut_time < window_end) {
+            output_time_ += window_end - cut_time;
+        }
+        return success;
+    }
+
+    bool Finish() {
+        return header_written_ && av_write_trailer(output_) == 0;
+    }
+
+    double OutputSeconds() const {
+        return output_time_ / 1e6;
+    }
+
+private:
+    // Writes packet shifted by shift microseconds. Each window restarts the
+    // decoding delay of the video stream, so the first decode times of a
+    // window may fall before the last ones of the previous window; they are
+    // pushed forward as far as the presentation times allow.
+    bool WritePacket(AVPacket* packet, const AVStream* input_stream,
+            const int64_t& shift) {
+        const int output_index = stream_map_[packet->stream_index];
+        const AVStream* output_stream = output_->streams[output_index];
+        const int64_t stream_shift = av_rescale_q(shift, AV_TIME_BASE_Q,
+                input_stream->time_base);
+        packet->pts += stream_shift;
+        if (packet->dts != AV_NOPTS_VALUE) {
+            packet->dts += stream_shift;
+        }
+        av_packet_rescale_ts(packet, input_stream->time_base,
+                output_stream->time_base);
+        int64_t& last_dts = last_dts_[output_index];
+        if (packet->dts != AV_NOPTS_VALUE && last_dts != AV_NOPTS_VALUE &&
+                packet->dts <= last_dts) {
+            if (packet->pts <= last_dts) {
+                av_packet_unref(packet);
+                return true;
+            }
+            packet->dts = last_dts + 1;
+        }
+        if (packet->dts != AV_NOPTS_VALUE) {
+            last_dts = packet->dts;
+        }
+        packet->stream_index = output_index;
+        packet->pos = -1;
+        if (av_interleaved_write_frame(output_, packet) < 0) {
+            cout << "Cannot write a packet of the highlights" << endl;
+            return false;
+        }
+        return true;
+    }
+
+    AVFormatContext* input_;
+    AVFormatContext* output_;
+    int video_stream_;
+    // Start of the video stream in the input, in microseconds.
+    int64_t video_start_;
+    // Output stream of each input stream, or -1 if it is left out.
+    vector<int> stream_map_;
+    // Where the next window starts in the output.
+    int64_t output_time_;
+    // Last decode time written to each output stream.
+    vector<int64_t> last_dts_;
+    bool header_written_;
+};
+
+bool HighlightExtractor::Extract(const string& input_filename,
+        const string& output_filename) const {
+    STAGE_TIMER("ExtractHighlights");
+    StreamCopier copier;
+    if (!copier.Open(input_filename, output_filename)) {
+        return false;
+    }
+    double fps = copier.FramesPerSecond();
+    if (fps <= 0) {
+        cout << "Unknown frame rate in " << input_filename << endl;
+        return false;
+    }
+    vector<HighlightWindow> windows = BuildWindows(fps);
+    int num_shots = 0;
+    for (const auto& window : windows) {
+        if (!copier.CopyWindow(window.start_seconds * 1e6,
+                    window.end_seconds * 1e6)) {
+            return false;
+        }
+        num_shots += window.num_shots;
+    }
+    if (!copier.Finish()) {
+        cout << "Cannot finish " << output_filename << endl;
+        return false;
+    }
+    cout << "Wrote " << num_shots << " shots in " << windows.size() <<
+        " clips (" << copier.OutputSeconds() << " s) to " << output_filename <<
+        endl;
+    return true;
+}
+
+bool HighlightExtractor::IsSupported() {
+    return true;
+}
+
+#else
+
+bool HighlightExtractor::Extract(const string& input_filename,
+        const string& output_filename) const {
+    cout << "Highlights need a build with -DNBA_VISION_HIGHLIGHTS=ON" <<
+        " and FFmpeg's libavformat." << endl;
+    return false;
+}
+
+bool HighlightExtractor::IsSupported() {
+    return false;
+}
+
+#endif
+
+}
@@ -0,0 +1,66 @@
+#ifndef HIGHLIGHT_EXTRACTOR_H
+#define HIGHLIGHT_EXTRACTOR_H
+
+#include <string>
+#include <vector>
+
+#include "chunked_processor.h"
+
+using namespace std;
+
+namespace nba_vision {
+
+// A stretch of the source video that goes into the highlights, in seconds
+// from its first frame.
+struct HighlightWindow {
+    double start_seconds;
+    double end_seconds;
+    // Shots this close together share one window.
+    int num_shots;
+};
+
+// Cuts the shots out of a game. The shot events of TrackBall are collected
+// into a time index of windows, from a little before each SHOT_TAKEN to a
+// little after its make or miss, and the windows are copied out of the
+// source container packet by packet. Each window starts at the keyframe at
+// or before it, so nothing is decoded or encoded and a whole game takes
+// about as long as reading the bytes of its shots.
+//
+// The copying needs FFmpeg's libavformat and a build with
+// -DNBA_VISION_HIGHLIGHTS=ON; the index is always available.
+class HighlightExtractor {
+public:
+    HighlightExtractor(const double& pre_roll_seconds,
+            const double& post_roll_seconds);
+
+    // Called once per frame, in order, with the event TrackBall raised for
+    // it.
+    void AddEvent(const int& frame_idx, const int& event);
+
+    // Adds the shots found by a ChunkedProcessor.
+    void AddShots(const vector<DetectedShot>& shots);
+
+    // The windows of the shots so far at fps, in order, with overlapping
+    // windows merged.
+    vector<HighlightWindow> BuildWindows(const double& fps) const;
+
+    // Writes the windows of input_filename to output_filename, whose
+    // container is picked from its extension. Returns false if either file
+    // can't be used or the build has no libavformat.
+    bool Extract(const string& input_filename,
+            const string& output_filename) const;
+
+    // Whether the build has libavformat, without which Extract always fails.
+    static bool IsSupported();
+
+private:
+    double pre_roll_seconds_;
+    double post_roll_seconds_;
+    vector<DetectedShot> shots_;
+    // Whether the last shot added by AddEvent is still in the air.
+    bool in_shot_;
+};
+
+}
+
+#endif  // HIGHLIGHT_EXTRACTOR_H
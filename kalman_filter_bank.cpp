@@ -0,0 +1,161 @@
+#include "kalman_filter_bank.h"
+
+namespace nba_vision {
+
+// Same noise parameters as ConstantVelocityModel.
+const float kProcessNoise = 1e-6f;
+const float kMeasurementNoise = 1e-4f;
+const float kInitErrorCov = .01f;
+
+KalmanFilterBank::KalmanFilterBank(const int& capacity) :
+        x_(capacity, 0), y_(capacity, 0), vx_(capacity, 0), vy_(capacity, 0),
+        p_pos_pos_(capacity, 0), p_pos_vel_(capacity, 0),
+        p_vel_vel_(capacity, 0), active_(capacity, 0) {
+    free_slots_.reserve(capacity);
+    // Hand out the lowest slots first.
+    for (int i = capacity - 1; i >= 0; i--) {
+        free_slots_.push_back(i);
+    }
+}
+
+int KalmanFilterBank::AddObject(const float& init_x, const float& init_y) {
+    if (free_slots_.empty()) {
+        return -1;
+    }
+    int slot = free_slots_.back();
+    free_slots_.pop_back();
+    x_[slot] = init_x;
+    y_[slot] = init_y;
+    vx_[slot] = 0;
+    vy_[slot] = 0;
+    p_pos_pos_[slot] = kInitErrorCov;
+    p_pos_vel_[slot] = 0;
+    p_vel_vel_[slot] = kInitErrorCov;
+    active_[slot] = 1;
+    // Match MultipleKalmanFilter, which predicts once on initialization.
+    x_[slot] += vx_[slot];
+    y_[slot] += vy_[slot];
+    p_pos_pos_[slot] += 2 * p_pos_vel_[slot] + p_vel_vel_[slot] + kProcessNoise;
+    p_pos_vel_[slot] += p_vel_vel_[slot];
+    p_vel_vel_[slot] += kProcessNoise;
+    return slot;
+}
+
+void KalmanFilterBank::RemoveObject(const int& slot) {
+    if (active_[slot] == 0) {
+        return;
+    }
+    active_[slot] = 0;
+    free_slots_.push_back(slot);
+}
+
+void KalmanFilterBank::PredictAll() {
+    const int n = x_.size();
+    float* x = x_.data();
+    float* y = y_.data();
+    const float* vx = vx_.data();
+    const float* vy = vy_.data();
+    float* pp = p_pos_pos_.data();
+    float* pv = p_pos_vel_.data();
+    float* vv = p_vel_vel_.data();
+    // Inactive slots are predicted too. It is cheaper than branching and their
+    // contents are reset by AddObject.
+    for (int i = 0; i < n; ++i) {
+        // x' = F x with F = [1 1; 0 1] per axis.
+        x[i] += vx[i];
+        y[i] += vy[i];
+        // P' = F P F^T + Q.
+        pp[i] += 2 * pv[i] + vv[i] + kProcessNoise;
+        pv[i] += vv[i];
+        vv[i] += kProcessNoise;
+    }
+}
+
+void KalmanFilterBank::CorrectAll(const float* measurement_x,
+        const float* measurement_y, const uchar* has_measurement) {
+    const int n = x_.size();
+    float* x = x_.data();
+    float* y = y_.data();
+    float* vx = vx_.data();
+    float* vy = vy_.data();
+    float* pp = p_pos_pos_.data();
+    float* pv = p_pos_vel_.data();
+    float* vv = p_vel_vel_.data();
+    const float* active = active_.data();
+    for (int i = 0; i < n; ++i) {
+        // Slots without a measurement get a zero gain and innovation, which
+        // leaves them untouched without a branch. They are selected rather
+        // than multiplied by a 0 mask, since 0 times the NaN or infinity of
+        // an unused measurement would still poison the state.
+        bool use = active[i] != 0 && has_measurement[i] != 0;
+        // K = P H^T (H P H^T + R)^-1 with H = [1 0] per axis.
+        float inv_innovation_cov = 1.0f / (pp[i] + kMeasurementNoise);
+        float gain_pos = use ? pp[i] * inv_innovation_cov : 0.0f;
+        float gain_vel = use ? pv[i] * inv_innovation_cov : 0.0f;
+        float innovation_x = use ? measurement_x[i] - x[i] : 0.0f;
+        float innovation_y = use ? measurement_y[i] - y[i] : 0.0f;
+        x[i] += gain_pos * innovation_x;
+        y[i] += gain_pos * innovation_y;
+        vx[i] += gain_vel * innovation_x;
+        vy[i] += gain_vel * innovation_y;
+        // P' = (I - K H) P.
+        vv[i] -= gain_vel * pv[i];
+        pv[i] -= gain_pos * pv[i];
+        pp[i] -= gain_pos * pp[i];
+    }
+}
+
+Matx21f KalmanFilterBank::CorrectAndPredict(const int& slot,
+        const float& measurement_x, const float& measurement_y) {
+    // Correct.
+    float inv_innovation_cov = 1.0f / (p_pos_pos_[slot] + kMeasurementNoise);
+    float gain_pos = p_pos_pos_[slot] * inv_innovation_cov;
+    float gain_vel = p_pos_vel_[slot] * inv_innovation_cov;
+    float innovation_x = measurement_x - x_[slot];
+    float innovation_y = measurement_y - y_[slot];
+    x_[slot] += gain_pos * innovation_x;
+    y_[slot] += gain_pos * innovation_y;
+    vx_[slot] += gain_vel * innovation_x;
+    vy_[slot] += gain_vel * innovation_y;
+    p_vel_vel_[slot] -= gain_vel * p_pos_vel_[slot];
+    p_pos_vel_[slot] -= gain_pos * p_pos_vel_[slot];
+    p_pos_pos_[slot] -= gain_pos * p_pos_pos_[slot];
+    // Predict.
+    x_[slot] += vx_[slot];
+    y_[slot] += vy_[slot];
+    p_pos_pos_[slot] += 2 * p_pos_vel_[slot] + p_vel_vel_[slot] + kProcessNoise;
+    p_pos_vel_[slot] += p_vel_vel_[slot];
+    p_vel_vel_[slot] += kProcessNoise;
+    return Matx21f(x_[slot], y_[slot]);
+}
+
+Matx21f KalmanFilterBank::GetPosition(const int& slot) const {
+    return Matx21f(x_[slot], y_[slot]);
+}
+
+Matx41f KalmanFilterBank::GetState(const int& slot) const {
+    return Matx41f(x_[slot], y_[slot], vx_[slot], vy_[slot]);
+}
+
+Matx44f KalmanFilterBank::GetErrorCov(const int& slot) const {
+    Matx44f error_cov = Matx44f::zeros();
+    error_cov(0, 0) = error_cov(1, 1) = p_pos_pos_[slot];
+    error_cov(0, 2) = error_cov(2, 0) = p_pos_vel_[slot];
+    error_cov(1, 3) = error_cov(3, 1) = p_pos_vel_[slot];
+    error_cov(2, 2) = error_cov(3, 3) = p_vel_vel_[slot];
+    return error_cov;
+}
+
+bool KalmanFilterBank::IsActive(const int& slot) const {
+    return active_[slot] != 0;
+}
+
+int KalmanFilterBank::Capacity() const {
+    return x_.size();
+}
+
+int KalmanFilterBank::NumActive() const {
+    return x_.size() - free_slots_.size();
+}
+
+}
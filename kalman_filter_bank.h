@@ -0,0 +1,80 @@
+#ifndef KALMAN_FILTER_BANK_H
+#define KALMAN_FILTER_BANK_H
+
+#include <vector>
+
+#include <opencv2/highgui/highgui.hpp>
+
+using namespace cv;
+using namespace std;
+
+namespace nba_vision {
+
+// A fixed-capacity bank of Kalman filters for many tracked objects. Uses the
+// same model as ConstantVelocityModel (4 dynamic params:
+// position_x, position_y, velocity_x, velocity_y and 2 measurement params),
+// but with the math unrolled by hand and the state stored as struct-of-arrays
+// so that PredictAll and CorrectAll are branch-free loops over contiguous
+// floats that the compiler can vectorize. Nothing is allocated after
+// construction.
+class KalmanFilterBank {
+public:
+    explicit KalmanFilterBank(const int& capacity);
+
+    // Starts filtering a new object at the given location and runs the first
+    // prediction. Returns the slot of the object, or -1 if the bank is full.
+    int AddObject(const float& init_x, const float& init_y);
+
+    // Stops filtering the object in slot so the slot can be reused.
+    void RemoveObject(const int& slot);
+
+    // Time update for every active slot.
+    void PredictAll();
+
+    // Measurement update for every active slot where has_measurement[slot] is
+    // non-zero. All three arrays are indexed by slot and hold Capacity()
+    // entries.
+    void CorrectAll(const float* measurement_x, const float* measurement_y,
+            const uchar* has_measurement);
+
+    // Single object equivalent of MultipleKalmanFilter::CorrectAndPredictForObject.
+    Matx21f CorrectAndPredict(const int& slot, const float& measurement_x,
+            const float& measurement_y);
+
+    // The predicted (or corrected, after CorrectAll) position of an object.
+    Matx21f GetPosition(const int& slot) const;
+
+    // The full state: position_x, position_y, velocity_x, velocity_y.
+    Matx41f GetState(const int& slot) const;
+
+    // The full 4x4 error covariance of the state.
+    Matx44f GetErrorCov(const int& slot) const;
+
+    bool IsActive(const int& slot) const;
+
+    int Capacity() const;
+
+    int NumActive() const;
+
+private:
+    // Per-slot state.
+    vector<float> x_;
+    vector<float> y_;
+    vector<float> vx_;
+    vector<float> vy_;
+    // The x and y axes are independent in this model and receive the same
+    // noise and the same updates, so they share one symmetric 2x2
+    // (position, velocity) covariance per slot.
+    vector<float> p_pos_pos_;
+    vector<float> p_pos_vel_;
+    vector<float> p_vel_vel_;
+    // 1 for slots holding an object, 0 otherwise. Kept as float so it is
+    // tested in the same vector lanes as the state in the branch-free update.
+    vector<float> active_;
+    // Stack of unused slots.
+    vector<int> free_slots_;
+};
+
+}
+
+#endif  // KALMAN_FILTER_BANK_H
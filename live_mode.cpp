@@ -0,0 +1,133 @@
+#include "live_mode.h"
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+namespace nba_vision {
+
+// A level is restored after this many frames in a row under
+// kRecoverFraction of the deadline.
+const int kRecoverFrames = 30;
+const double kRecoverFraction = 0.5;
+// Half size of the ball search area at SHED_BALL_ROI. The ball can't move
+// further than this between two frames anyway.
+const int kShedBallSearchRadius = 200;
+
+PacedFrameSource::PacedFrameSource(FrameSource* source, const double& fps,
+        const bool& loop) : source_(source), fps_(fps), loop_(loop),
+        next_frame_(0), dropped_frames_(0) {}
+
+bool PacedFrameSource::Read(Mat& frame) {
+    LiveClock::time_point now = LiveClock::now();
+    if (next_frame_ == 0) {
+        start_ = now;
+    }
+    // The newest frame that is available by now.
+    long due_frame = chrono::duration<double>(now - start_).count() * fps_;
+    // Late frames are skipped rather than decoded or mapped.
+    while (next_frame_ < due_frame) {
+        if (!Skip()) {
+            return false;
+        }
+        dropped_frames_++;
+    }
+    frame_time_ = start_ + chrono::duration_cast<LiveClock::duration>(
+            chrono::duration<double>(next_frame_ / fps_));
+    this_thread::sleep_until(frame_time_);
+    return ReadNext(frame);
+}
+
+bool PacedFrameSource::ReadNext(Mat& frame) {
+    if (!source_->Read(frame)) {
+        if (!loop_ || !source_->SkipTo(0) || !source_->Read(frame)) {
+            return false;
+        }
+    }
+    next_frame_++;
+    return true;
+}
+
+bool PacedFrameSource::Skip() {
+    if (!source_->Skip()) {
+        if (!loop_ || !source_->SkipTo(0) || !source_->Skip()) {
+            return false;
+        }
+    }
+    next_frame_++;
+    return true;
+}
+
+Size PacedFrameSource::FrameSize() const {
+    return source_->FrameSize();
+}
+
+bool PacedFrameSource::SkipTo(const int& frame_idx) {
+    cout << "Cannot seek in a live feed." << endl;
+    return false;
+}
+
+int PacedFrameSource::QueueDepth() const {
+    if (next_frame_ == 0) {
+        return 0;
+    }
+    long due_frame = chrono::duration<double>(LiveClock::now() - start_)
+        .count() * fps_;
+    return max(0L, due_frame + 1 - next_frame_);
+}
+
+LiveClock::time_point PacedFrameSource::FrameTime() const {
+    return frame_time_;
+}
+
+int PacedFrameSource::DroppedFrames() const {
+    return dropped_frames_;
+}
+
+LoadShedder::LoadShedder(const double& deadline_ms) :
+        deadline_ms_(deadline_ms), level_(SHED_NONE), lag_ms_(0),
+        missed_deadlines_(0), frames_within_deadline_(0) {}
+
+void LoadShedder::EndFrame(const LiveClock::time_point& frame_time) {
+    lag_ms_ = chrono::duration<double, milli>(
+            LiveClock::now() - frame_time).count();
+    if (lag_ms_ > deadline_ms_) {
+        missed_deadlines_++;
+        frames_within_deadline_ = 0;
+        if (level_ < SHED_BALL_ROI) {
+            level_ = (ShedLevel) (level_ + 1);
+        }
+    } else if (lag_ms_ < kRecoverFraction * deadline_ms_) {
+        frames_within_deadline_++;
+        if (frames_within_deadline_ >= kRecoverFrames && level_ > SHED_NONE) {
+            level_ = (ShedLevel) (level_ - 1);
+            frames_within_deadline_ = 0;
+        }
+    } else {
+        frames_within_deadline_ = 0;
+    }
+}
+
+void LoadShedder::Apply(BballTracker* tracker) const {
+    tracker->SetLocalNetSearch(level_ >= SHED_NET_SEARCH);
+    tracker->SetBallSearchRadius(
+            level_ >= SHED_BALL_ROI ? kShedBallSearchRadius : 0);
+}
+
+bool LoadShedder::ShouldSkipOpticalFlow() const {
+    return level_ >= SHED_OPTICAL_FLOW;
+}
+
+ShedLevel LoadShedder::Level() const {
+    return level_;
+}
+
+double LoadShedder::LagMillis() const {
+    return lag_ms_;
+}
+
+int LoadShedder::MissedDeadlines() const {
+    return missed_deadlines_;
+}
+
+}
@@ -0,0 +1,115 @@
+#ifndef LIVE_MODE_H
+#define LIVE_MODE_H
+
+#include <chrono>
+#include <memory>
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include "bball_tracker.h"
+#include "frame_source.h"
+
+using namespace cv;
+using namespace std;
+
+namespace nba_vision {
+
+typedef chrono::steady_clock LiveClock;
+
+// Plays another source back as a live feed: frame i becomes available i / fps
+// seconds after the first one, and frames that are already late when the
+// consumer asks for the next one are dropped, as a capture card would. A
+// file may be looped to stand in for a feed that doesn't end.
+class PacedFrameSource : public FrameSource {
+public:
+    // Takes ownership of source.
+    PacedFrameSource(FrameSource* source, const double& fps, const bool& loop);
+
+    // Waits for the next frame to be due, or drops frames until the newest
+    // one that is.
+    bool Read(Mat& frame);
+
+    // Skips the next frame of the source without waiting for it to be due.
+    bool Skip();
+
+    Size FrameSize() const;
+
+    // A live feed can't seek, so this only fails.
+    bool SkipTo(const int& frame_idx);
+
+    // Frames already due after the last one read, which the next Read drops
+    // all but the newest of.
+    int QueueDepth() const;
+
+    // When the last frame read became available.
+    LiveClock::time_point FrameTime() const;
+
+    // Number of frames dropped so far because the consumer was late.
+    int DroppedFrames() const;
+
+private:
+    // Reads the next frame of the source, looping if asked to.
+    bool ReadNext(Mat& frame);
+
+    unique_ptr<FrameSource> source_;
+    double fps_;
+    bool loop_;
+    LiveClock::time_point start_;
+    // Index in the feed of the next frame of the source.
+    long next_frame_;
+    LiveClock::time_point frame_time_;
+    int dropped_frames_;
+};
+
+// Work that can be skipped, cheapest savings first, when tracking falls
+// behind a live feed.
+enum ShedLevel {
+    // Everything runs.
+    SHED_NONE = 0,
+    // computeOpticalFlow is skipped, and motion gating keeps using the last
+    // camera motion it measured.
+    SHED_OPTICAL_FLOW = 1,
+    // FindNet only matches around the last net location.
+    SHED_NET_SEARCH = 2,
+    // The ball is only searched for near the prediction.
+    SHED_BALL_ROI = 3,
+};
+
+// Keeps the latency of a live feed under a per-frame deadline. The latency of
+// a frame is the time from when it became available to when tracking it
+// finished. When a frame misses the deadline, one more level of work is
+// shed; after a run of frames well within it, one level is restored.
+class LoadShedder {
+public:
+    LoadShedder(const double& deadline_ms);
+
+    // Records that a frame which became available at frame_time has been
+    // tracked, and updates the shed level.
+    void EndFrame(const LiveClock::time_point& frame_time);
+
+    // Applies the shed level to the tracker. Optical flow is left to the
+    // caller, see ShouldSkipOpticalFlow.
+    void Apply(BballTracker* tracker) const;
+
+    bool ShouldSkipOpticalFlow() const;
+
+    ShedLevel Level() const;
+
+    // Latency of the last frame.
+    double LagMillis() const;
+
+    // Number of frames that missed the deadline.
+    int MissedDeadlines() const;
+
+private:
+    double deadline_ms_;
+    ShedLevel level_;
+    double lag_ms_;
+    int missed_deadlines_;
+    // Frames in a row well within the deadline.
+    int frames_within_deadline_;
+};
+
+}
+
+#endif  // LIVE_MODE_H
@@ -0,0 +1,269 @@
+#include "metrics_exporter.h"
+
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace nba_vision {
+
+const char kUnixSocketPrefix[] = "unix:";
+const int kListenBacklog = 16;
+// How often the server thread checks whether it should stop.
+const int kPollTimeoutMillis = 200;
+// A scrape that doesn't send its request within this time is dropped.
+const int kRequestTimeoutSeconds = 1;
+const size_t kMaxRequestBytes = 4096;
+
+// How a field of WorkerMetrics is exported.
+struct MetricDefinition {
+    const char* name;
+    const char* type;
+    const char* help;
+    atomic<uint64_t> WorkerMetrics::* value;
+    // Turns the stored value into the exported unit, e.g. nanoseconds into
+    // seconds.
+    double scale;
+};
+
+const MetricDefinition kMetrics[] = {
+    {"nba_vision_frames_total", "counter", "Frames tracked.",
+        &WorkerMetrics::frames, 1},
+    {"nba_vision_frame_seconds_total", "counter",
+        "Time spent tracking frames.", &WorkerMetrics::frame_nanos, 1e-9},
+    {"nba_vision_ball_predicted_frames_total", "counter",
+        "Frames where the ball position fell back to the Kalman prediction.",
+        &WorkerMetrics::ball_predicted, 1},
+    {"nba_vision_net_missed_frames_total", "counter",
+        "Frames where the net was not found.", &WorkerMetrics::net_missed, 1},
+    {"nba_vision_shots_taken_total", "counter", "Shots taken.",
+        &WorkerMetrics::shots_taken, 1},
+    {"nba_vision_shots_made_total", "counter", "Shots made.",
+        &WorkerMetrics::shots_made, 1},
+    {"nba_vision_shots_missed_total", "counter", "Shots missed.",
+        &WorkerMetrics::shots_missed, 1},
+    {"nba_vision_dropped_frames_total", "counter",
+        "Frames of a live feed dropped because tracking was late.",
+        &WorkerMetrics::dropped_frames, 1},
+    {"nba_vision_queue_depth", "gauge",
+        "Frames that are ready but not read yet.",
+        &WorkerMetrics::queue_depth, 1},
+    {"nba_vision_lag_seconds", "gauge",
+        "Latency of the last frame of a live feed.",
+        &WorkerMetrics::lag_micros, 1e-6},
+    {"nba_vision_shed_level", "gauge",
+        "Work shed to keep up with a live feed, 0 for none.",
+        &WorkerMetrics::shed_level, 1},
+};
+
+// There is a single writer, so a plain load and store is enough, as in
+// StageHistogram::Record.
+static void Increment(atomic<uint64_t>& counter,
+        const uint64_t& amount = 1) {
+    counter.store(counter.load(memory_order_relaxed) + amount,
+            memory_order_relaxed);
+}
+
+WorkerMetrics::WorkerMetrics() : frames(0), frame_nanos(0),
+        ball_predicted(0), net_missed(0), shots_taken(0), shots_made(0),
+        shots_missed(0), dropped_frames(0), queue_depth(0), lag_micros(0),
+        shed_level(0) {}
+
+void WorkerMetrics::RecordFrame(const TrackResult& result,
+        const uint64_t& nanos) {
+    Increment(frames);
+    Increment(frame_nanos, nanos);
+    if (!result.found_ball) {
+        Increment(ball_predicted);
+    }
+    if (!result.found_net) {
+        Increment(net_missed);
+    }
+    if (result.event == SHOT_TAKEN) {
+        Increment(shots_taken);
+    } else if (result.event == SHOT_MADE) {
+        Increment(shots_made);
+    } else if (result.event == SHOT_MISSED) {
+        Increment(shots_missed);
+    }
+}
+
+MetricsExporter::MetricsExporter() : listen_fd_(-1), stopping_(false) {}
+
+MetricsExporter::~MetricsExporter() {
+    stopping_.store(true);
+    if (server_thread_.joinable()) {
+        server_thread_.join();
+    }
+    CloseSocket();
+    if (!unix_path_.empty()) {
+        unlink(unix_path_.c_str());
+    }
+}
+
+WorkerMetrics* MetricsExporter::AddWorker(const string& name) {
+    lock_guard<mutex> lock(workers_mutex_);
+    workers_.push_back(make_pair(name,
+                unique_ptr<WorkerMetrics>(new WorkerMetrics())));
+    return workers_.back().second.get();
+}
+
+bool MetricsExporter::Start(const string& address) {
+    if (listen_fd_ >= 0) {
+        cout << "Metrics are already served." << endl;
+        return false;
+    }
+    const size_t prefix_length = sizeof(kUnixSocketPrefix) - 1;
+    if (address.compare(0, prefix_length, kUnixSocketPrefix) == 0) {
+        string path = address.substr(prefix_length);
+        sockaddr_un socket_address;
+        memset(&socket_address, 0, sizeof(socket_address));
+        socket_address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(socket_address.sun_path)) {
+            cout << "Bad metrics socket path: " << path << endl;
+            return false;
+        }
+        strcpy(socket_address.sun_path, path.c_str());
+        // A socket left behind by an earlier run would make bind fail, but
+        // anything else at the path is not ours to remove.
+        struct stat file_stat;
+        if (stat(path.c_str(), &file_stat) == 0 &&
+                S_ISSOCK(file_stat.st_mode)) {
+            unlink(path.c_str());
+        }
+        listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd_ < 0 || bind(listen_fd_, (sockaddr*) &socket_address,
+                    sizeof(socket_address)) != 0 ||
+                listen(listen_fd_, kListenBacklog) != 0) {
+            cout << "Cannot serve metrics on " << path << endl;
+            CloseSocket();
+            return false;
+        }
+        unix_path_ = path;
+    } else {
+        int port = atoi(address.c_str());
+        if (port <= 0 || port > 65535) {
+            cout << "Bad metrics address: " << address << endl;
+            return false;
+        }
+        sockaddr_in socket_address;
+        memset(&socket_address, 0, sizeof(socket_address));
+        socket_address.sin_family = AF_INET;
+        socket_address.sin_port = htons(port);
+        // Only reachable from this machine.
+        socket_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        if (listen_fd_ < 0 || setsockopt(listen_fd_, SOL_SOCKET,
+                    SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+                bind(listen_fd_, (sockaddr*) &socket_address,
+                    sizeof(socket_address)) != 0 ||
+                listen(listen_fd_, kListenBacklog) != 0) {
+            cout << "Cannot serve metrics on port " << port << endl;
+            CloseSocket();
+            return false;
+        }
+    }
+    server_thread_ = thread(&MetricsExporter::Serve, this);
+    return true;
+}
+
+string MetricsExporter::Render() const {
+    lock_guard<mutex> lock(workers_mutex_);
+    ostringstream output;
+    for (const auto& metric : kMetrics) {
+        output << "# HELP " << metric.name << " " << metric.help << "\n";
+        output << "# TYPE " << metric.name << " " << metric.type << "\n";
+        for (const auto& worker : workers_) {
+            uint64_t value = ((*worker.second).*metric.value).load(
+                    memory_order_relaxed);
+            output << metric.name << "{worker=\"" << worker.first << "\"} ";
+            if (metric.scale == 1) {
+                output << value;
+            } else {
+                output << value * metric.scale;
+            }
+            output << "\n";
+        }
+    }
+    return output.str();
+}
+
+void MetricsExporter::CloseSocket() {
+    if (listen_fd_ >= 0) {
+        close(listen_fd_);
+        listen_fd_ = -1;
+    }
+}
+
+void MetricsExporter::Serve() {
+    while (!stopping_.load()) {
+        pollfd poll_fd;
+        poll_fd.fd = listen_fd_;
+        poll_fd.events = POLLIN;
+        poll_fd.revents = 0;
+        if (poll(&poll_fd, 1, kPollTimeoutMillis) <= 0) {
+            continue;
+        }
+        int fd = accept(listen_fd_, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        Respond(fd);
+        close(fd);
+    }
+}
+
+void MetricsExporter::Respond(const int& fd) const {
+    timeval timeout;
+    timeout.tv_sec = kRequestTimeoutSeconds;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    // Only the request line matters; the rest of the request is read so
+    // that the client isn't reset before it reads the response.
+    string request;
+    char buffer[1024];
+    while (request.size() < kMaxRequestBytes &&
+            request.find("\r\n\r\n") == string::npos) {
+        ssize_t num_read = read(fd, buffer, sizeof(buffer));
+        if (num_read <= 0) {
+            break;
+        }
+        request.append(buffer, num_read);
+    }
+    string body;
+    string status;
+    if (request.compare(0, 13, "GET /metrics ") == 0 ||
+            request.compare(0, 6, "GET / ") == 0) {
+        status = "200 OK";
+        body = Render();
+    } else {
+        status = "404 Not Found";
+        body = "Metrics are at /metrics\n";
+    }
+    ostringstream response;
+    response << "HTTP/1.0 " << status << "\r\n" <<
+        "Content-Type: text/plain; version=0.0.4\r\n" <<
+        "Content-Length: " << body.size() << "\r\n" <<
+        "Connection: close\r\n\r\n" << body;
+    string text = response.str();
+    size_t sent = 0;
+    while (sent < text.size()) {
+        ssize_t num_sent = send(fd, text.data() + sent, text.size() - sent,
+                MSG_NOSIGNAL);
+        if (num_sent <= 0) {
+            break;
+        }
+        sent += num_sent;
+    }
+}
+
+}
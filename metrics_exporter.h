@@ -0,0 +1,87 @@
+#ifndef METRICS_EXPORTER_H
+#define METRICS_EXPORTER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bball_tracker.h"
+
+using namespace std;
+
+namespace nba_vision {
+
+// Counters and gauges of one tracking worker. Each worker is written by one
+// thread, so updates are relaxed loads and stores rather than locked
+// read-modify-writes, and the exporter reads them at any time without
+// stopping the worker.
+struct WorkerMetrics {
+    WorkerMetrics();
+
+    // Counts a frame tracked in nanos, and what TrackBall found in it.
+    void RecordFrame(const TrackResult& result, const uint64_t& nanos);
+
+    atomic<uint64_t> frames;
+    atomic<uint64_t> frame_nanos;
+    // Frames where no region was close enough to the prediction, so
+    // TrackBall fell back to the Kalman filter's prediction.
+    atomic<uint64_t> ball_predicted;
+    atomic<uint64_t> net_missed;
+    atomic<uint64_t> shots_taken;
+    atomic<uint64_t> shots_made;
+    atomic<uint64_t> shots_missed;
+    // Gauges of a live feed, set by the caller.
+    atomic<uint64_t> dropped_frames;
+    atomic<uint64_t> queue_depth;
+    atomic<uint64_t> lag_micros;
+    atomic<uint64_t> shed_level;
+};
+
+// Serves the metrics of the workers of this process in the Prometheus text
+// format, over HTTP on a loopback port or on a Unix socket, from a thread of
+// its own. Reading the metrics never blocks the workers.
+class MetricsExporter {
+public:
+    MetricsExporter();
+
+    // Stops serving and removes the Unix socket.
+    ~MetricsExporter();
+
+    // Returns the metrics of a new worker, labelled name. They are owned by
+    // the exporter and stay valid as long as it does.
+    WorkerMetrics* AddWorker(const string& name);
+
+    // Serves on 127.0.0.1:<port> for a number, or on the Unix socket at
+    // <path> for "unix:<path>". Returns false if it can't listen there.
+    bool Start(const string& address);
+
+    // The metrics of every worker in the Prometheus text format.
+    string Render() const;
+
+private:
+    MetricsExporter(const MetricsExporter&);
+    MetricsExporter& operator=(const MetricsExporter&);
+
+    void CloseSocket();
+
+    // Answers scrapes until the exporter is destroyed.
+    void Serve();
+
+    void Respond(const int& fd) const;
+
+    int listen_fd_;
+    string unix_path_;
+    atomic<bool> stopping_;
+    thread server_thread_;
+    // Guards the list of workers, not their metrics.
+    mutable mutex workers_mutex_;
+    vector<pair<string, unique_ptr<WorkerMetrics> > > workers_;
+};
+
+}
+
+#endif  // METRICS_EXPORTER_H
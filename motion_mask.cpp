@@ -0,0 +1,77 @@
+#include "motion_mask.h"
+
+#include <algorithm>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "serialization.h"
+#include "stage_timer.h"
+
+namespace nba_vision {
+
+MotionMask::MotionMask(const int& downsample, const int& threshold,
+        const int& dilation) : downsample_(max(1, downsample)),
+        threshold_(threshold) {
+    dilation_kernel_ = getStructuringElement(MORPH_ELLIPSE,
+            Size(2 * dilation + 1, 2 * dilation + 1));
+}
+
+void MotionMask::Update(const Mat& frame, const Point2f& camera_motion) {
+    STAGE_TIMER("MotionMask");
+    Mat small_color, small;
+    resize(frame, small_color,
+            Size(frame.cols / downsample_, frame.rows / downsample_), 0, 0,
+            INTER_AREA);
+    cvtColor(small_color, small, COLOR_BGR2GRAY);
+    if (!previous_frame_.empty() && previous_frame_.size() == small.size()) {
+        // Move the background of the previous frame to where it is now. The
+        // strip uncovered at the edge shows up as motion, which only keeps
+        // more of the color mask.
+        Mat translation = Mat::zeros(2, 3, CV_64F);
+        translation.at<double>(0, 0) = 1;
+        translation.at<double>(1, 1) = 1;
+        translation.at<double>(0, 2) = camera_motion.x / downsample_;
+        translation.at<double>(1, 2) = camera_motion.y / downsample_;
+        Mat shifted, difference;
+        warpAffine(previous_frame_, shifted, translation, small.size());
+        absdiff(small, shifted, difference);
+        threshold(difference, mask_, threshold_, 255, THRESH_BINARY);
+        dilate(mask_, mask_, dilation_kernel_);
+    }
+    previous_frame_ = small;
+}
+
+void MotionMask::Apply(Mat& binary_image, const Point& offset) const {
+    if (mask_.empty()) {
+        return;
+    }
+    for (int r = 0; r < binary_image.rows; r++) {
+        const uchar* mask_row = mask_.ptr<uchar>(
+                min((r + offset.y) / downsample_, mask_.rows - 1));
+        uchar* row = binary_image.ptr<uchar>(r);
+        for (int c = 0; c < binary_image.cols; c++) {
+            if (row[c] != 0 &&
+                    mask_row[min((c + offset.x) / downsample_,
+                        mask_.cols - 1)] == 0) {
+                row[c] = 0;
+            }
+        }
+    }
+}
+
+void MotionMask::SaveState(ostream& output) const {
+    WriteMat(output, previous_frame_);
+    WriteMat(output, mask_);
+}
+
+bool MotionMask::LoadState(istream& input) {
+    Mat previous_frame, mask;
+    if (!ReadMat(input, previous_frame) || !ReadMat(input, mask)) {
+        return false;
+    }
+    previous_frame_ = previous_frame;
+    mask_ = mask;
+    return true;
+}
+
+}
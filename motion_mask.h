@@ -0,0 +1,54 @@
+#ifndef MOTION_MASK_H
+#define MOTION_MASK_H
+
+#include <istream>
+#include <ostream>
+
+#include <opencv2/highgui/highgui.hpp>
+
+using namespace cv;
+using namespace std;
+
+namespace nba_vision {
+
+// Marks the parts of a frame that moved relative to the camera, so that the
+// static court, crowd and scoreboard can be left out of the ball search. The
+// mask is a difference of downsampled grey frames, with the previous frame
+// shifted by the camera motion first. It is dilated so that the inside of
+// the ball, which looks the same in both frames, is kept along with its
+// edges.
+class MotionMask {
+public:
+    // Frames are shrunk by downsample in each direction, and pixels that
+    // changed by more than threshold grey levels are dilated by dilation
+    // downsampled pixels.
+    MotionMask(const int& downsample, const int& threshold,
+            const int& dilation);
+
+    // Differences frame with the previous one. camera_motion is how far the
+    // background moved since the previous frame, in pixels.
+    void Update(const Mat& frame, const Point2f& camera_motion);
+
+    // Clears the pixels of binary_image that didn't move. binary_image covers
+    // the area of the frame starting at offset. Does nothing until two frames
+    // have been seen.
+    void Apply(Mat& binary_image, const Point& offset) const;
+
+    // Writes the previous frame and the mask for a checkpoint.
+    void SaveState(ostream& output) const;
+
+    // Restores the state written by SaveState. Returns false if the stream
+    // is malformed.
+    bool LoadState(istream& input);
+
+private:
+    int downsample_;
+    int threshold_;
+    Mat dilation_kernel_;
+    Mat previous_frame_;
+    Mat mask_;
+};
+
+}
+
+#endif  // MOTION_MASK_H
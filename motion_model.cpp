@@ -0,0 +1,421 @@
+#include "motion_model.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include "serialization.h"
+
+namespace nba_vision {
+
+const int kNumMeasurementParams = 2;
+// position_x, position_y, velocity_x, velocity_y.
+const int kConstantVelocityParams = 4;
+// The original tuning of MultipleKalmanFilter.
+const float kConstantVelocityProcessNoise = 1e-6;
+const float kConstantVelocityMeasurementNoise = 1e-4;
+const float kConstantVelocityInitialCov = .01;
+// position_x, position_y, velocity_x, velocity_y, acceleration_x,
+// acceleration_y.
+const int kAccelerationParams = 6;
+// Of the centroid of the ball's region.
+const float kMeasurementStddev = 2;
+// Downward acceleration of a ball in flight in a 720p, 30 fps broadcast, in
+// pixels per frame squared. The filters learn the actual value from the arc.
+const float kImageGravity = 0.5;
+// Change of velocity per frame of a ball that is held, dribbled or passed.
+const float kHandledAccelerationStddev = 5;
+// Change of acceleration per frame of a ball in flight, from drag, spin and
+// the camera.
+const float kFlightJerkStddev = 0.1;
+// Drift of the acceleration carried along while the ball is handled.
+const float kCarriedAccelerationStddev = 0.01;
+// Uncertainty of the first velocity and acceleration.
+const float kInitialVelocityStddev = 20;
+const float kInitialAccelerationStddev = 1;
+// Chance that the ball is still held, or still in flight, in the next frame.
+const double kModeStayProbability = 0.95;
+// Trackers usually start on a ball in someone's hands.
+const double kInitialFlightProbability = 0.1;
+// Modes never become so unlikely that they can't come back.
+const double kMinModeProbability = 1e-4;
+
+// Writes every matrix of a filter.
+static void SaveKalmanFilter(ostream& output,
+        const KalmanFilter& kalman_filter) {
+    WriteMat(output, kalman_filter.statePre);
+    WriteMat(output, kalman_filter.statePost);
+    WriteMat(output, kalman_filter.transitionMatrix);
+    WriteMat(output, kalman_filter.controlMatrix);
+    WriteMat(output, kalman_filter.measurementMatrix);
+    WriteMat(output, kalman_filter.processNoiseCov);
+    WriteMat(output, kalman_filter.measurementNoiseCov);
+    WriteMat(output, kalman_filter.errorCovPre);
+    WriteMat(output, kalman_filter.gain);
+    WriteMat(output, kalman_filter.errorCovPost);
+}
+
+static bool LoadKalmanFilter(istream& input, const int& num_dynamic_params,
+        KalmanFilter& kalman_filter) {
+    // Allocates the temporaries used by predict and correct.
+    kalman_filter.init(num_dynamic_params, kNumMeasurementParams);
+    return ReadMat(input, kalman_filter.statePre) &&
+        ReadMat(input, kalman_filter.statePost) &&
+        ReadMat(input, kalman_filter.transitionMatrix) &&
+        ReadMat(input, kalman_filter.controlMatrix) &&
+        ReadMat(input, kalman_filter.measurementMatrix) &&
+        ReadMat(input, kalman_filter.processNoiseCov) &&
+        ReadMat(input, kalman_filter.measurementNoiseCov) &&
+        ReadMat(input, kalman_filter.errorCovPre) &&
+        ReadMat(input, kalman_filter.gain) &&
+        ReadMat(input, kalman_filter.errorCovPost) &&
+        kalman_filter.statePost.rows == num_dynamic_params &&
+        kalman_filter.errorCovPre.rows == num_dynamic_params;
+}
+
+// H P H' + R for the last prediction. The measurement is the first two
+// states, so H P H' is the top left of P.
+static Matx22f FilterInnovationCov(const KalmanFilter& kalman_filter) {
+    const Mat& error_cov = kalman_filter.errorCovPre;
+    const Mat& noise = kalman_filter.measurementNoiseCov;
+    return Matx22f(
+            error_cov.at<float>(0, 0) + noise.at<float>(0, 0),
+            error_cov.at<float>(0, 1) + noise.at<float>(0, 1),
+            error_cov.at<float>(1, 0) + noise.at<float>(1, 0),
+            error_cov.at<float>(1, 1) + noise.at<float>(1, 1));
+}
+
+// Predicts one more frame from the last prediction.
+static Mat Coast(KalmanFilter& kalman_filter) {
+    kalman_filter.statePre.copyTo(kalman_filter.statePost);
+    kalman_filter.errorCovPre.copyTo(kalman_filter.errorCovPost);
+    return kalman_filter.predict();
+}
+
+// Sets up a six state filter at location, with an acceleration that starts
+// at gravity. With accelerating, the acceleration moves the object;
+// otherwise it is only carried along, so that the gravity learned in flight
+// isn't forgotten while the ball is held.
+static void InitAccelerationFilter(KalmanFilter& kalman_filter,
+        const bool& accelerating, const Point2f& location) {
+    const int n = kAccelerationParams;
+    kalman_filter.init(n, kNumMeasurementParams);
+    Mat_<float> transition(n, n, 0.0f);
+    setIdentity(transition);
+    Mat_<float> noise(n, n, 0.0f);
+    for (int axis = 0; axis < 2; axis++) {
+        const int position = axis;
+        const int velocity = 2 + axis;
+        const int acceleration = 4 + axis;
+        transition(position, velocity) = 1;
+        // How the white noise of one frame enters each state.
+        vector<pair<int, float> > gains;
+        float stddev;
+        if (accelerating) {
+            transition(position, acceleration) = 0.5;
+            transition(velocity, acceleration) = 1;
+            gains.push_back(make_pair(position, 0.5f));
+            gains.push_back(make_pair(velocity, 1.0f));
+            gains.push_back(make_pair(acceleration, 1.0f));
+            stddev = kFlightJerkStddev;
+        } else {
+            gains.push_back(make_pair(position, 0.5f));
+            gains.push_back(make_pair(velocity, 1.0f));
+            stddev = kHandledAccelerationStddev;
+            noise(acceleration, acceleration) =
+                kCarriedAccelerationStddev * kCarriedAccelerationStddev;
+        }
+        for (const auto& row : gains) {
+            for (const auto& column : gains) {
+                noise(row.first, column.first) =
+                    stddev * stddev * row.second * column.second;
+            }
+        }
+    }
+    kalman_filter.transitionMatrix = transition;
+    kalman_filter.processNoiseCov = noise;
+    setIdentity(kalman_filter.measurementMatrix);
+    setIdentity(kalman_filter.measurementNoiseCov,
+            Scalar::all(kMeasurementStddev * kMeasurementStddev));
+    Mat_<float> error_cov(n, n, 0.0f);
+    Mat_<float> state(n, 1, 0.0f);
+    for (int axis = 0; axis < 2; axis++) {
+        error_cov(axis, axis) = kMeasurementStddev * kMeasurementStddev;
+        error_cov(2 + axis, 2 + axis) =
+            kInitialVelocityStddev * kInitialVelocityStddev;
+        error_cov(4 + axis, 4 + axis) =
+            kInitialAccelerationStddev * kInitialAccelerationStddev;
+    }
+    state(0) = location.x;
+    state(1) = location.y;
+    state(5) = kImageGravity;
+    kalman_filter.errorCovPost = error_cov;
+    kalman_filter.statePost = state;
+}
+
+Mat ConstantVelocityModel::Init(const Point2f& location) {
+    kalman_filter_.init(kConstantVelocityParams, kNumMeasurementParams);
+    // Represents position_x, position_y, velocity_x, velocity_y and how they
+    // transition between states.
+    kalman_filter_.transitionMatrix = (Mat_<float>(4, 4) << 1, 0, 1, 0,
+            0, 1, 0, 1, 0, 0, 1, 0, 0, 0, 0, 1);
+    kalman_filter_.statePost.at<float>(0) = location.x;
+    kalman_filter_.statePost.at<float>(1) = location.y;
+    kalman_filter_.statePost.at<float>(2) = 0;
+    kalman_filter_.statePost.at<float>(3) = 0;
+    setIdentity(kalman_filter_.measurementMatrix);
+    setIdentity(kalman_filter_.processNoiseCov,
+            Scalar::all(kConstantVelocityProcessNoise));
+    setIdentity(kalman_filter_.measurementNoiseCov,
+            Scalar::all(kConstantVelocityMeasurementNoise));
+    setIdentity(kalman_filter_.errorCovPost,
+            Scalar::all(kConstantVelocityInitialCov));
+    return kalman_filter_.predict();
+}
+
+Mat ConstantVelocityModel::CorrectAndPredict(const Point2f& measurement) {
+    kalman_filter_.correct((Mat_<float>(2, 1) << measurement.x,
+                measurement.y));
+    return kalman_filter_.predict();
+}
+
+Mat ConstantVelocityModel::Predict() {
+    return Coast(kalman_filter_);
+}
+
+Matx22f ConstantVelocityModel::InnovationCov() const {
+    return FilterInnovationCov(kalman_filter_);
+}
+
+MotionModelType ConstantVelocityModel::Type() const {
+    return MOTION_CONSTANT_VELOCITY;
+}
+
+void ConstantVelocityModel::SaveState(ostream& output) const {
+    SaveKalmanFilter(output, kalman_filter_);
+}
+
+bool ConstantVelocityModel::LoadState(istream& input) {
+    return LoadKalmanFilter(input, kConstantVelocityParams, kalman_filter_);
+}
+
+Mat GravityModel::Init(const Point2f& location) {
+    InitAccelerationFilter(kalman_filter_, true, location);
+    return kalman_filter_.predict();
+}
+
+Mat GravityModel::CorrectAndPredict(const Point2f& measurement) {
+    kalman_filter_.correct((Mat_<float>(2, 1) << measurement.x,
+                measurement.y));
+    return kalman_filter_.predict();
+}
+
+Mat GravityModel::Predict() {
+    return Coast(kalman_filter_);
+}
+
+Matx22f GravityModel::InnovationCov() const {
+    return FilterInnovationCov(kalman_filter_);
+}
+
+MotionModelType GravityModel::Type() const {
+    return MOTION_GRAVITY;
+}
+
+void GravityModel::SaveState(ostream& output) const {
+    SaveKalmanFilter(output, kalman_filter_);
+}
+
+bool GravityModel::LoadState(istream& input) {
+    return LoadKalmanFilter(input, kAccelerationParams, kalman_filter_);
+}
+
+// Chance of moving from one mode to another between two frames.
+static double SwitchProbability(const int& from, const int& to) {
+    return from == to ? kModeStayProbability : 1 - kModeStayProbability;
+}
+
+// Keeps every probability above kMinModeProbability and makes them sum to 1.
+static void NormalizeProbabilities(double* probabilities, const int& size) {
+    double total = 0;
+    for (int i = 0; i < size; i++) {
+        probabilities[i] = max(kMinModeProbability, probabilities[i]);
+        total += probabilities[i];
+    }
+    for (int i = 0; i < size; i++) {
+        probabilities[i] /= total;
+    }
+}
+
+Mat InteractingMultipleModel::Init(const Point2f& location) {
+    InitAccelerationFilter(filters_[HANDLED], false, location);
+    InitAccelerationFilter(filters_[IN_FLIGHT], true, location);
+    probabilities_[HANDLED] = 1 - kInitialFlightProbability;
+    probabilities_[IN_FLIGHT] = kInitialFlightProbability;
+    return MixAndPredict();
+}
+
+Mat InteractingMultipleModel::CorrectAndPredict(const Point2f& measurement) {
+    Mat_<float> measured = (Mat_<float>(2, 1) << measurement.x,
+            measurement.y);
+    double total = 0;
+    for (int mode = 0; mode < NUM_MODES; mode++) {
+        // The likelihood of the measurement under the mode's prediction.
+        Matx22f cov = FilterInnovationCov(filters_[mode]);
+        double dx = measurement.x - filters_[mode].statePre.at<float>(0);
+        double dy = measurement.y - filters_[mode].statePre.at<float>(1);
+        double det = cov(0, 0) * cov(1, 1) - cov(0, 1) * cov(1, 0);
+        double squared_distance = (cov(1, 1) * dx * dx -
+                (cov(0, 1) + cov(1, 0)) * dx * dy + cov(0, 0) * dy * dy) / det;
+        probabilities_[mode] = predicted_probabilities_[mode] *
+            exp(-squared_distance / 2) / (2 * M_PI * sqrt(det));
+        total += probabilities_[mode];
+        filters_[mode].correct(measured);
+    }
+    if (total <= 0) {
+        // The measurement is so far from both predictions that the
+        // likelihoods underflowed, which says nothing about the modes.
+        for (int mode = 0; mode < NUM_MODES; mode++) {
+            probabilities_[mode] = predicted_probabilities_[mode];
+        }
+    }
+    NormalizeProbabilities(probabilities_, NUM_MODES);
+    return MixAndPredict();
+}
+
+Mat InteractingMultipleModel::Predict() {
+    // Without a measurement, nothing tells the modes apart.
+    for (int mode = 0; mode < NUM_MODES; mode++) {
+        filters_[mode].statePre.copyTo(filters_[mode].statePost);
+        filters_[mode].errorCovPre.copyTo(filters_[mode].errorCovPost);
+        probabilities_[mode] = predicted_probabilities_[mode];
+    }
+    return MixAndPredict();
+}
+
+Mat InteractingMultipleModel::MixAndPredict() {
+    const int n = kAccelerationParams;
+    Mat_<float> mixed_states[NUM_MODES];
+    Mat_<float> mixed_covs[NUM_MODES];
+    for (int to = 0; to < NUM_MODES; to++) {
+        double weights[NUM_MODES];
+        predicted_probabilities_[to] = 0;
+        for (int from = 0; from < NUM_MODES; from++) {
+            weights[from] = SwitchProbability(from, to) * probabilities_[from];
+            predicted_probabilities_[to] += weights[from];
+        }
+        for (int from = 0; from < NUM_MODES; from++) {
+            weights[from] /= predicted_probabilities_[to];
+        }
+        Mat_<float>& state = mixed_states[to];
+        state = Mat_<float>(n, 1, 0.0f);
+        for (int from = 0; from < NUM_MODES; from++) {
+            const Mat& from_state = filters_[from].statePost;
+            for (int i = 0; i < n; i++) {
+                state(i) += weights[from] * from_state.at<float>(i);
+            }
+        }
+        // The covariance of each mode, plus the spread of its state around
+        // the mix.
+        Mat_<float>& cov = mixed_covs[to];
+        cov = Mat_<float>(n, n, 0.0f);
+        for (int from = 0; from < NUM_MODES; from++) {
+            const Mat& from_state = filters_[from].statePost;
+            const Mat& from_cov = filters_[from].errorCovPost;
+            for (int i = 0; i < n; i++) {
+                float di = from_state.at<float>(i) - state(i);
+                for (int j = 0; j < n; j++) {
+                    float dj = from_state.at<float>(j) - state(j);
+                    cov(i, j) += weights[from] *
+                        (from_cov.at<float>(i, j) + di * dj);
+                }
+            }
+        }
+    }
+    Mat_<float> combined(n, 1, 0.0f);
+    for (int mode = 0; mode < NUM_MODES; mode++) {
+        filters_[mode].statePost = mixed_states[mode];
+        filters_[mode].errorCovPost = mixed_covs[mode];
+        const Mat& prediction = filters_[mode].predict();
+        for (int i = 0; i < n; i++) {
+            combined(i) += predicted_probabilities_[mode] *
+                prediction.at<float>(i);
+        }
+    }
+    return combined;
+}
+
+Matx22f InteractingMultipleModel::InnovationCov() const {
+    float x = 0, y = 0;
+    for (int mode = 0; mode < NUM_MODES; mode++) {
+        x += predicted_probabilities_[mode] *
+            filters_[mode].statePre.at<float>(0);
+        y += predicted_probabilities_[mode] *
+            filters_[mode].statePre.at<float>(1);
+    }
+    Matx22f combined = Matx22f::zeros();
+    for (int mode = 0; mode < NUM_MODES; mode++) {
+        Matx22f cov = FilterInnovationCov(filters_[mode]);
+        float dx = filters_[mode].statePre.at<float>(0) - x;
+        float dy = filters_[mode].statePre.at<float>(1) - y;
+        float weight = predicted_probabilities_[mode];
+        combined(0, 0) += weight * (cov(0, 0) + dx * dx);
+        combined(0, 1) += weight * (cov(0, 1) + dx * dy);
+        combined(1, 0) += weight * (cov(1, 0) + dx * dy);
+        combined(1, 1) += weight * (cov(1, 1) + dy * dy);
+    }
+    return combined;
+}
+
+MotionModelType InteractingMultipleModel::Type() const {
+    return MOTION_IMM;
+}
+
+void InteractingMultipleModel::SaveState(ostream& output) const {
+    for (int mode = 0; mode < NUM_MODES; mode++) {
+        SaveKalmanFilter(output, filters_[mode]);
+        WriteValue(output, probabilities_[mode]);
+        WriteValue(output, predicted_probabilities_[mode]);
+    }
+}
+
+bool InteractingMultipleModel::LoadState(istream& input) {
+    for (int mode = 0; mode < NUM_MODES; mode++) {
+        if (!LoadKalmanFilter(input, kAccelerationParams, filters_[mode]) ||
+                !ReadValue(input, probabilities_[mode]) ||
+                !ReadValue(input, predicted_probabilities_[mode]) ||
+                !(probabilities_[mode] > 0 && probabilities_[mode] <= 1) ||
+                !(predicted_probabilities_[mode] > 0 &&
+                    predicted_probabilities_[mode] <= 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+MotionModel* NewMotionModel(const MotionModelType& type) {
+    switch (type) {
+        case MOTION_GRAVITY:
+            return new GravityModel();
+        case MOTION_IMM:
+            return new InteractingMultipleModel();
+        default:
+            return new ConstantVelocityModel();
+    }
+}
+
+bool ParseMotionModelType(const string& name, MotionModelType& type) {
+    if (name == "cv") {
+        type = MOTION_CONSTANT_VELOCITY;
+    } else if (name == "gravity") {
+        type = MOTION_GRAVITY;
+    } else if (name == "imm") {
+        type = MOTION_IMM;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+}
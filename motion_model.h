@@ -0,0 +1,134 @@
+#ifndef MOTION_MODEL_H
+#define MOTION_MODEL_H
+
+#include <istream>
+#include <ostream>
+#include <string>
+
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/video/tracking.hpp>
+
+using namespace cv;
+using namespace std;
+
+namespace nba_vision {
+
+// How an object is expected to move from one frame to the next.
+enum MotionModelType {
+    // Straight at a constant speed, with the original tuning of
+    // MultipleKalmanFilter. Its noise is far smaller than a real centroid's,
+    // so its innovation covariance is too sure of itself to gate with.
+    MOTION_CONSTANT_VELOCITY = 0,
+    // Constant acceleration, starting from gravity in image space, for a
+    // ball in flight.
+    MOTION_GRAVITY = 1,
+    // An interacting multiple model mix of constant velocity, for a ball
+    // that is held, dribbled or passed, and gravity, for a shot.
+    MOTION_IMM = 2,
+};
+
+// The filter of one object under a motion model. Positions are in pixels
+// and time in frames. States start with position_x, position_y, followed by
+// the velocity and, for the models with gravity, the acceleration.
+class MotionModel {
+public:
+    virtual ~MotionModel() {}
+
+    // Starts at location and returns the predicted state for the next frame.
+    virtual Mat Init(const Point2f& location) = 0;
+
+    // Corrects the filter with the location measured in this frame and
+    // returns the predicted state for the next frame.
+    virtual Mat CorrectAndPredict(const Point2f& measurement) = 0;
+
+    // Moves on to the next frame without a measurement, so that the
+    // uncertainty of the prediction grows.
+    virtual Mat Predict() = 0;
+
+    // Covariance of the next measurement around the predicted position, in
+    // pixels squared.
+    virtual Matx22f InnovationCov() const = 0;
+
+    virtual MotionModelType Type() const = 0;
+
+    virtual void SaveState(ostream& output) const = 0;
+
+    // Returns false if the stream is malformed.
+    virtual bool LoadState(istream& input) = 0;
+};
+
+class ConstantVelocityModel : public MotionModel {
+public:
+    Mat Init(const Point2f& location);
+    Mat CorrectAndPredict(const Point2f& measurement);
+    Mat Predict();
+    Matx22f InnovationCov() const;
+    MotionModelType Type() const;
+    void SaveState(ostream& output) const;
+    bool LoadState(istream& input);
+
+private:
+    KalmanFilter kalman_filter_;
+};
+
+// Tracks the acceleration along with the velocity. It starts from gravity,
+// and then follows the arc, so that a change of zoom or frame rate doesn't
+// need retuning.
+class GravityModel : public MotionModel {
+public:
+    Mat Init(const Point2f& location);
+    Mat CorrectAndPredict(const Point2f& measurement);
+    Mat Predict();
+    Matx22f InnovationCov() const;
+    MotionModelType Type() const;
+    void SaveState(ostream& output) const;
+    bool LoadState(istream& input);
+
+private:
+    KalmanFilter kalman_filter_;
+};
+
+// Runs a constant velocity and a gravity filter side by side over the same
+// six states and weighs them by how well each predicted the recent
+// measurements. The ball switches between the two as it is held and shot,
+// so before each frame the filters are mixed by the chance of a switch.
+// See Bar-Shalom, Li and Kirubarajan, "Estimation with Applications to
+// Tracking and Navigation", 11.6.
+class InteractingMultipleModel : public MotionModel {
+public:
+    Mat Init(const Point2f& location);
+    Mat CorrectAndPredict(const Point2f& measurement);
+    Mat Predict();
+    // Includes the spread between the predictions of the modes.
+    Matx22f InnovationCov() const;
+    MotionModelType Type() const;
+    void SaveState(ostream& output) const;
+    bool LoadState(istream& input);
+
+private:
+    enum Mode {
+        HANDLED,
+        IN_FLIGHT,
+        NUM_MODES
+    };
+
+    // Mixes the corrected filters, predicts each of them and returns their
+    // combined prediction.
+    Mat MixAndPredict();
+
+    KalmanFilter filters_[NUM_MODES];
+    // Probability of each mode after the last measurement.
+    double probabilities_[NUM_MODES];
+    // Probability of each mode in the next frame, before its measurement.
+    double predicted_probabilities_[NUM_MODES];
+};
+
+// Returns a new model of type, owned by the caller.
+MotionModel* NewMotionModel(const MotionModelType& type);
+
+// Parses "cv", "gravity" or "imm". Returns false for anything else.
+bool ParseMotionModelType(const string& name, MotionModelType& type);
+
+}
+
+#endif  // MOTION_MODEL_H
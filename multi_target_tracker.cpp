@@ -0,0 +1,244 @@
+#include "multi_target_tracker.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace nba_vision {
+
+// A tentative track is confirmed after being matched this many times.
+const int kMinHitsToConfirm = 3;
+// A confirmed track is dropped after this many frames without a match. This
+// covers the ball being hidden behind a player for a moment.
+const int kMaxMisses = 10;
+
+MultiTargetTracker::MultiTargetTracker(const int& max_tracks,
+        const double& gate_distance) :
+        bank_(max_tracks),
+        gate_distance_(gate_distance),
+        gate_distance_squared_(gate_distance * gate_distance),
+        next_id_(0),
+        measurement_x_(max_tracks, 0),
+        measurement_y_(max_tracks, 0),
+        has_measurement_(max_tracks, 0),
+        detection_index_(gate_distance) {
+    tracks_.reserve(max_tracks);
+}
+
+int MultiTargetTracker::AddTrack(const float& x, const float& y) {
+    int track_idx = StartTrack(x, y, true);
+    if (track_idx == -1) {
+        return -1;
+    }
+    return tracks_[track_idx].id;
+}
+
+int MultiTargetTracker::StartTrack(const float& x, const float& y,
+        const bool& confirmed) {
+    int slot = bank_.AddObject(x, y);
+    if (slot == -1) {
+        return -1;
+    }
+    Track track;
+    track.id = next_id_++;
+    track.slot = slot;
+    track.hits = 1;
+    track.misses = 0;
+    track.confirmed = confirmed;
+    track.detection_idx = -1;
+    Matx21f prediction = bank_.GetPosition(slot);
+    track.prediction = Point2f(prediction(0), prediction(1));
+    tracks_.push_back(track);
+    return tracks_.size() - 1;
+}
+
+void MultiTargetTracker::Update(const vector<RegionMetrics*>& region_metrics_list) {
+    vector<Point2f> detections;
+    detections.reserve(region_metrics_list.size());
+    for (auto region_metrics : region_metrics_list) {
+        detections.push_back(Point2f(region_metrics->avg_x, region_metrics->avg_y));
+    }
+    Update(detections);
+}
+
+void MultiTargetTracker::Update(const vector<Point2f>& detections) {
+    const int num_tracks = tracks_.size();
+    const int num_detections = detections.size();
+    detection_matched_.assign(num_detections, 0);
+    for (auto& track : tracks_) {
+        track.detection_idx = -1;
+    }
+
+    // Only detections inside some track's gate take part in the assignment,
+    // which keeps the cost matrix small when a frame has thousands of blobs.
+    candidates_.clear();
+    if (num_tracks > 0 && num_detections > 0) {
+        detection_index_.Build(detections);
+        for (const auto& track : tracks_) {
+            gated_.clear();
+            detection_index_.FindWithinRadius(track.prediction.x,
+                    track.prediction.y, gate_distance_, gated_);
+            for (int d : gated_) {
+                if (!detection_matched_[d]) {
+                    // Temporarily marks the detection as a candidate.
+                    detection_matched_[d] = 1;
+                    candidates_.push_back(d);
+                }
+            }
+        }
+        for (int d : candidates_) {
+            detection_matched_[d] = 0;
+        }
+    }
+    const int num_candidates = candidates_.size();
+
+    if (num_candidates > 0) {
+        // The solver needs at least as many columns as rows, so put the
+        // smaller of the two sets on the rows.
+        bool transposed = num_tracks > num_candidates;
+        int num_rows = transposed ? num_candidates : num_tracks;
+        int num_cols = transposed ? num_tracks : num_candidates;
+        cost_.resize(num_rows * num_cols);
+        for (int t = 0; t < num_tracks; ++t) {
+            const Point2f& prediction = tracks_[t].prediction;
+            for (int k = 0; k < num_candidates; ++k) {
+                const Point2f& detection = detections[candidates_[k]];
+                // Anything outside the gate costs the same as not being
+                // matched at all.
+                double cost = min(ComputeSquaredDistance(
+                            detection.x, detection.y,
+                            prediction.x, prediction.y),
+                        gate_distance_squared_);
+                if (transposed) {
+                    cost_[k * num_cols + t] = cost;
+                } else {
+                    cost_[t * num_cols + k] = cost;
+                }
+            }
+        }
+        SolveAssignment(num_rows, num_cols);
+        for (int r = 0; r < num_rows; ++r) {
+            int c = row_assignment_[r];
+            if (cost_[r * num_cols + c] >= gate_distance_squared_) {
+                continue;
+            }
+            int t = transposed ? c : r;
+            int d = candidates_[transposed ? r : c];
+            tracks_[t].detection_idx = d;
+            detection_matched_[d] = 1;
+        }
+    }
+
+    // Update the filters of the matched tracks.
+    for (auto& track : tracks_) {
+        if (track.detection_idx != -1) {
+            measurement_x_[track.slot] = detections[track.detection_idx].x;
+            measurement_y_[track.slot] = detections[track.detection_idx].y;
+            has_measurement_[track.slot] = 1;
+            track.hits++;
+            track.misses = 0;
+            if (track.hits >= kMinHitsToConfirm) {
+                track.confirmed = true;
+            }
+        } else {
+            has_measurement_[track.slot] = 0;
+            track.misses++;
+        }
+    }
+    bank_.CorrectAll(measurement_x_.data(), measurement_y_.data(),
+            has_measurement_.data());
+
+    // Track death. Tentative tracks are dropped on their first miss, which
+    // keeps one-frame false detections from lingering.
+    for (int i = tracks_.size() - 1; i >= 0; i--) {
+        const Track& track = tracks_[i];
+        if ((!track.confirmed && track.misses > 0) || track.misses > kMaxMisses) {
+            bank_.RemoveObject(track.slot);
+            tracks_.erase(tracks_.begin() + i);
+        }
+    }
+    bank_.PredictAll();
+    for (auto& track : tracks_) {
+        Matx21f prediction = bank_.GetPosition(track.slot);
+        track.prediction = Point2f(prediction(0), prediction(1));
+    }
+
+    // Track birth. New filters already hold their first prediction.
+    for (int d = 0; d < num_detections; ++d) {
+        if (!detection_matched_[d]) {
+            StartTrack(detections[d].x, detections[d].y, false);
+        }
+    }
+}
+
+const vector<Track>& MultiTargetTracker::GetTracks() const {
+    return tracks_;
+}
+
+const Track* MultiTargetTracker::FindTrack(const int& id) const {
+    for (const auto& track : tracks_) {
+        if (track.id == id) {
+            return &track;
+        }
+    }
+    return NULL;
+}
+
+void MultiTargetTracker::SolveAssignment(const int& num_rows, const int& num_cols) {
+    // Hungarian algorithm with row and column potentials, O(rows^2 * cols).
+    // Indices are 1-based with 0 as a sentinel column.
+    const double kInfinity = numeric_limits<double>::max();
+    row_potential_.assign(num_rows + 1, 0);
+    col_potential_.assign(num_cols + 1, 0);
+    col_assignment_.assign(num_cols + 1, 0);
+    way_.assign(num_cols + 1, 0);
+    for (int i = 1; i <= num_rows; ++i) {
+        col_assignment_[0] = i;
+        int j0 = 0;
+        min_slack_.assign(num_cols + 1, kInfinity);
+        used_.assign(num_cols + 1, 0);
+        do {
+            used_[j0] = 1;
+            int i0 = col_assignment_[j0];
+            double delta = kInfinity;
+            int j1 = 0;
+            for (int j = 1; j <= num_cols; ++j) {
+                if (used_[j]) {
+                    continue;
+                }
+                double slack = cost_[(i0 - 1) * num_cols + (j - 1)] -
+                    row_potential_[i0] - col_potential_[j];
+                if (slack < min_slack_[j]) {
+                    min_slack_[j] = slack;
+                    way_[j] = j0;
+                }
+                if (min_slack_[j] < delta) {
+                    delta = min_slack_[j];
+                    j1 = j;
+                }
+            }
+            for (int j = 0; j <= num_cols; ++j) {
+                if (used_[j]) {
+                    row_potential_[col_assignment_[j]] += delta;
+                    col_potential_[j] -= delta;
+                } else {
+                    min_slack_[j] -= delta;
+                }
+            }
+            j0 = j1;
+        } while (col_assignment_[j0] != 0);
+        // Flip the augmenting path.
+        do {
+            int j1 = way_[j0];
+            col_assignment_[j0] = col_assignment_[j1];
+            j0 = j1;
+        } while (j0 != 0);
+    }
+    row_assignment_.assign(num_rows, 0);
+    for (int j = 1; j <= num_cols; ++j) {
+        if (col_assignment_[j] != 0) {
+            row_assignment_[col_assignment_[j] - 1] = j - 1;
+        }
+    }
+}
+
+}
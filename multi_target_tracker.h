@@ -0,0 +1,103 @@
+#ifndef MULTI_TARGET_TRACKER_H
+#define MULTI_TARGET_TRACKER_H
+
+#include <vector>
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include "kalman_filter_bank.h"
+#include "spatial_index.h"
+#include "util.h"
+
+using namespace cv;
+using namespace std;
+
+namespace nba_vision {
+
+// A single target followed by the MultiTargetTracker.
+struct Track {
+    // Unique for the lifetime of the tracker.
+    int id;
+    // Slot of the target in the KalmanFilterBank.
+    int slot;
+    // Number of frames the target has been matched to a detection.
+    int hits;
+    // Number of consecutive frames without a matching detection.
+    int misses;
+    // Tentative tracks become confirmed after enough hits.
+    bool confirmed;
+    // Index of the detection matched in the last Update, or -1.
+    int detection_idx;
+    // Predicted location for the next frame.
+    Point2f prediction;
+};
+
+// Tracks many objects at once (the ball and players) by matching each
+// frame's detections to existing tracks. Detections outside a track's gate
+// are never matched to it and are found with a SpatialIndex, so crowded
+// frames stay cheap. Among the rest, the Hungarian algorithm finds the
+// assignment with the lowest total squared distance. Unmatched detections
+// start tentative tracks and tracks that go unmatched for too long are
+// dropped.
+class MultiTargetTracker {
+public:
+    // max_tracks bounds the number of live tracks. gate_distance is the
+    // furthest a detection may be from a prediction to be matched.
+    MultiTargetTracker(const int& max_tracks, const double& gate_distance);
+
+    // Starts a confirmed track at a known location, e.g. the ball location
+    // clicked by the user. Returns the id of the track, or -1 if full.
+    int AddTrack(const float& x, const float& y);
+
+    // Matches the detections of the current frame to the tracks, updates
+    // their filters and handles track birth and death.
+    void Update(const vector<Point2f>& detections);
+
+    // Same as above, using the centroids of the regions.
+    void Update(const vector<RegionMetrics*>& region_metrics_list);
+
+    // All live tracks, including tentative ones.
+    const vector<Track>& GetTracks() const;
+
+    // Returns the track with the given id, or NULL if it has been dropped.
+    const Track* FindTrack(const int& id) const;
+
+private:
+    // Creates a track and its filter. Returns its index in tracks_ or -1.
+    int StartTrack(const float& x, const float& y, const bool& confirmed);
+
+    // Solves the assignment problem on cost_ (num_rows x num_cols, with
+    // num_rows <= num_cols). Fills row_assignment_ with the column assigned
+    // to each row.
+    void SolveAssignment(const int& num_rows, const int& num_cols);
+
+    KalmanFilterBank bank_;
+    double gate_distance_;
+    double gate_distance_squared_;
+    int next_id_;
+    vector<Track> tracks_;
+    // Per-slot measurement buffers passed to the bank.
+    vector<float> measurement_x_;
+    vector<float> measurement_y_;
+    vector<uchar> has_measurement_;
+    // Grid over the current detections, used to find the detections inside
+    // each gate.
+    SpatialIndex detection_index_;
+    vector<int> gated_;
+    // Detections inside at least one gate.
+    vector<int> candidates_;
+    // Scratch space for the assignment, reused between frames.
+    vector<double> cost_;
+    vector<double> row_potential_;
+    vector<double> col_potential_;
+    vector<int> col_assignment_;
+    vector<int> way_;
+    vector<double> min_slack_;
+    vector<uchar> used_;
+    vector<int> row_assignment_;
+    vector<uchar> detection_matched_;
+};
+
+}
+
+#endif  // MULTI_TARGET_TRACKER_H
@@ -1,50 +1,100 @@
 #include "multiple_kalman_filter.h"
 
-namespace nba_vision {
+#include "serialization.h"
+#include "stage_timer.h"
 
-const int kNumDynamicParams = 4;
-const int kNumMeasurementParams = 2;
+namespace nba_vision {
 
 MultipleKalmanFilter::MultipleKalmanFilter(const int& num_objects,
-        const vector< pair<int, int> >* object_locations) {
-	kalman_filters_ = map<int, KalmanFilter>();
+        const vector< pair<int, int> >* object_locations,
+        const MotionModelType& motion_model) : motion_model_(motion_model) {
+	objects_ = map<int, TrackedObject>();
 	for (int i = 0; i < num_objects; ++i) {
-		kalman_filters_[i] = KalmanFilter(kNumDynamicParams,
-                        kNumMeasurementParams);
-		KalmanFilter& kalman_filter = kalman_filters_[i];
-		InitKalmanFilter(kalman_filter, (*object_locations)[i].first,
+		TrackedObject& object = objects_[i];
+		Point2f location((*object_locations)[i].first,
                         (*object_locations)[i].second);
+		object.motion_model.reset(NewMotionModel(motion_model_));
+		object.motion_model->Init(location);
+		object.history.PushBack(location);
 	}
 }
 
 Mat MultipleKalmanFilter::CorrectAndPredictForObject(const int& object_idx,
         const Mat_<float>& measurement) {
-	if (kalman_filters_.find(object_idx) == kalman_filters_.end()) {
-		kalman_filters_[object_idx] = KalmanFilter(kNumDynamicParams,
-                        kNumMeasurementParams);
-		return InitKalmanFilter(kalman_filters_[object_idx],
-                        measurement(0), measurement(1));
-	}
-	KalmanFilter& kalman_filter = kalman_filters_[object_idx];
-	kalman_filter.correct(measurement);
-	return kalman_filter.predict();
-}
-
-Mat MultipleKalmanFilter::InitKalmanFilter(KalmanFilter& kalman_filter,
-        const float& init_x, const float& init_y) {
-	// Represents position_x, position_y, velocity_x, velocity_y and how they
-        // transition between states.
-	kalman_filter.transitionMatrix = (Mat_<float>(4, 4) << 1, 0, 1, 0, 0, 1, 0, 1,
-                0, 0, 1, 0, 0, 0, 0, 1);
-	kalman_filter.statePost.at<float>(0) = init_x;
-	kalman_filter.statePost.at<float>(1) = init_y;
-	kalman_filter.statePost.at<float>(2) = 0;
-	kalman_filter.statePost.at<float>(3) = 0;
-	setIdentity(kalman_filter.measurementMatrix);
-	setIdentity(kalman_filter.processNoiseCov, Scalar::all(1e-6));
-	setIdentity(kalman_filter.measurementNoiseCov, Scalar::all(1e-4));
-	setIdentity(kalman_filter.errorCovPost, Scalar::all(.01));
-	return kalman_filter.predict();
+	STAGE_TIMER("CorrectAndPredictForObject");
+	Point2f location(measurement(0), measurement(1));
+	map<int, TrackedObject>::iterator it = objects_.find(object_idx);
+	if (it == objects_.end()) {
+		TrackedObject& object = objects_[object_idx];
+		object.motion_model.reset(NewMotionModel(motion_model_));
+		object.history.PushBack(location);
+		return object.motion_model->Init(location);
+	}
+	TrackedObject& object = it->second;
+	object.history.PushBack(location);
+	return object.motion_model->CorrectAndPredict(location);
+}
+
+Mat MultipleKalmanFilter::PredictForObject(const int& object_idx) {
+	map<int, TrackedObject>::iterator it = objects_.find(object_idx);
+	if (it == objects_.end()) {
+		return Mat();
+	}
+	return it->second.motion_model->Predict();
+}
+
+bool MultipleKalmanFilter::GetInnovationCov(const int& object_idx, Matx22f& cov) const {
+	map<int, TrackedObject>::const_iterator it = objects_.find(object_idx);
+	if (it == objects_.end()) {
+		return false;
+	}
+	cov = it->second.motion_model->InnovationCov();
+	return true;
+}
+
+MotionModelType MultipleKalmanFilter::GetMotionModel() const {
+	return motion_model_;
+}
+
+const ObjectHistory* MultipleKalmanFilter::GetHistory(const int& object_idx) const {
+	map<int, TrackedObject>::const_iterator it = objects_.find(object_idx);
+	if (it == objects_.end()) {
+		return NULL;
+	}
+	return &it->second.history;
+}
+
+void MultipleKalmanFilter::SaveState(ostream& output) const {
+	WriteValue(output, (int32_t) objects_.size());
+	for (const auto& entry : objects_) {
+		WriteValue(output, (int32_t) entry.first);
+		WriteValue(output, (int32_t) entry.second.motion_model->Type());
+		entry.second.motion_model->SaveState(output);
+		WriteRingBuffer(output, entry.second.history);
+	}
+}
+
+bool MultipleKalmanFilter::LoadState(istream& input) {
+	int32_t num_objects;
+	if (!ReadValue(input, num_objects) || num_objects < 0) {
+		return false;
+	}
+	objects_.clear();
+	for (int i = 0; i < num_objects; ++i) {
+		int32_t object_idx, type;
+		if (!ReadValue(input, object_idx) || !ReadValue(input, type) ||
+				type < MOTION_CONSTANT_VELOCITY || type > MOTION_IMM) {
+			return false;
+		}
+		// Objects keep the model they were saved with.
+		TrackedObject& object = objects_[object_idx];
+		object.motion_model.reset(NewMotionModel((MotionModelType) type));
+		if (!object.motion_model->LoadState(input) ||
+				!ReadRingBuffer(input, object.history)) {
+			return false;
+		}
+	}
+	return true;
 }
 
 }
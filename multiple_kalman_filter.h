@@ -1,30 +1,71 @@
 #ifndef MULTIPLE_KALMAN_FILTER_H
 #define MULTIPLE_KALMAN_FILTER_H
 
+#include <istream>
 #include <map>
+#include <memory>
+#include <ostream>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/video/tracking.hpp>
 
+#include "motion_model.h"
+#include "ring_buffer.h"
+
 using namespace cv;
 using namespace std;
 
+// Number of measurements kept per object.
+#define OBJECT_HISTORY_SIZE 512
+
 namespace nba_vision {
 
-// An extension of the opencv KalmanFilter, to perform kalman filtering on multiple objects.
+// The last measurements of an object, oldest first.
+typedef RingBuffer<Point2f, OBJECT_HISTORY_SIZE> ObjectHistory;
+
+// An extension of the opencv KalmanFilter, to perform kalman filtering on multiple objects,
+// each with its own filter under a MotionModel.
+// For hundreds of objects per frame, use KalmanFilterBank instead.
 class MultipleKalmanFilter {
 
 public:
-	// Initialize with a number of objects and object locations.
-	MultipleKalmanFilter(const int& num_objects, const vector< pair<int, int> >* object_locations);
+	// Initialize with a number of objects and object locations. Objects
+	// follow motion_model, including those created later.
+	MultipleKalmanFilter(const int& num_objects, const vector< pair<int, int> >* object_locations,
+			const MotionModelType& motion_model = MOTION_CONSTANT_VELOCITY);
 
 	// Update existing objects or create a new object, with a new measurement.
+	// Returns the predicted state, position first.
 	Mat CorrectAndPredictForObject(const int& object_idx, const Mat_<float>& measurement);
 
+	// Moves an object on to the next frame when it wasn't measured in this
+	// one. Returns its predicted state, or an empty Mat for an unknown object.
+	Mat PredictForObject(const int& object_idx);
+
+	// Sets cov to the covariance of the next measurement of an object around
+	// its prediction. Returns false for an unknown object.
+	bool GetInnovationCov(const int& object_idx, Matx22f& cov) const;
+
+	MotionModelType GetMotionModel() const;
+
+	// Returns the measurement history of an object, or NULL for an unknown object.
+	const ObjectHistory* GetHistory(const int& object_idx) const;
+
+	// Writes the filters and histories of all objects for a checkpoint.
+	void SaveState(ostream& output) const;
+
+	// Replaces all objects with those of SaveState. Returns false if the
+	// stream is malformed.
+	bool LoadState(istream& input);
+
 private:
-	// Internal method for initializing the opencv KalmanFilter.
-	Mat InitKalmanFilter(KalmanFilter& kalman_filter, const float& init_x, const float& init_y);
+	// A filter and the measurements it has seen.
+	struct TrackedObject {
+		unique_ptr<MotionModel> motion_model;
+		ObjectHistory history;
+	};
 
-	map<int, KalmanFilter> kalman_filters_;
+	MotionModelType motion_model_;
+	map<int, TrackedObject> objects_;
 
 };
 
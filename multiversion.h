@@ -0,0 +1,25 @@
+#ifndef MULTIVERSION_H
+#define MULTIVERSION_H
+
+// Marks a hot per-pixel kernel for function multiversioning. Build with
+// -DNBA_VISION_MULTIVERSION to compile an AVX2 and an SSE4.2 clone of the
+// function next to the baseline one; the loader picks the best clone for the
+// CPU, so the binary stays portable. Otherwise it expands to nothing.
+//
+//   NBA_VISION_HOT_KERNEL
+//   void ColorSegmentation(...) {
+//       ...
+//   }
+#if defined(NBA_VISION_MULTIVERSION) && defined(__x86_64__) && \
+    defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define NBA_VISION_HOT_KERNEL \
+    __attribute__((target_clones("avx2", "sse4.2", "default")))
+#endif
+#endif
+
+#ifndef NBA_VISION_HOT_KERNEL
+#define NBA_VISION_HOT_KERNEL
+#endif
+
+#endif  // MULTIVERSION_H
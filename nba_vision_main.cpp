@@ -1,3 +1,5 @@
+#include <chrono>
+#include <fstream>
 #include <iostream>
 #include <mutex>
 
@@ -5,7 +7,17 @@
 
 #include "multiple_kalman_filter.h"
 #include "bball_tracker.h"
+#include "checkpoint.h"
+#include "chunked_processor.h"
+#include "frame_source.h"
+#include "highlight_extractor.h"
+#include "live_mode.h"
+#include "metrics_exporter.h"
+#include "motion_model.h"
+#include "offline_shot_analyzer.h"
 #include "optical_flow.h"
+#include "shot_statistics.h"
+#include "stage_timer.h"
 
 using namespace cv;
 using namespace std;
@@ -13,6 +25,18 @@ using namespace nba_vision;
 
 const bool kDebug = false;
 const char kWindowName[] = "Output";
+// Frames each chunk tracks before its start with --threads.
+const int kDefaultOverlapFrames = 60;
+// Frames between checkpoints with --checkpoint.
+const int kDefaultCheckpointInterval = 1000;
+// Frame rate and per-frame latency budget of --live.
+const double kDefaultLiveFps = 30;
+const double kDefaultDeadlineMillis = 100;
+// Frames between the lag reports of --live.
+const int kLiveReportInterval = 100;
+// How much of the play around each shot --highlights keeps.
+const double kHighlightPreRollSeconds = 4;
+const double kHighlightPostRollSeconds = 2;
 
 // Whether or not the user has clicked on the location of the ball in the
 // first frame.
@@ -23,55 +47,349 @@ int init_ball_x, init_ball_y;
 void MouseCallBack(int event, int x, int y, int flags, void* userdata);
 // For locking and unlocking global variables from the UI thread.
 mutex mtx;
+// Where the result of each frame is recorded. Any of them may be NULL.
+struct FrameRecorders {
+    OfflineShotAnalyzer* offline_analyzer;
+    HighlightExtractor* highlight_extractor;
+    ShotStatistics* shot_statistics;
+    WorkerMetrics* worker_metrics;
+};
+// Tracks the ball in the frame and records the result.
+void TrackFrame(BballTracker* bball_tracker, const FrameRecorders& recorders,
+        const int& frame_idx, const Mat& frame);
+// Prints the statistics of this game and merges them into those of the
+// earlier games in filename. Returns false if filename can't be used.
+bool UpdateSeasonStatistics(const ShotStatistics& game_statistics,
+        const char* filename);
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        cout << "usage: " << argv[0] << " <filename>" << "<outputfile>" << endl;
+    if (argc < 3) {
+        cout << "usage: " << argv[0] << " <filename>" << " <outputfile>" <<
+            " [--offline <historyfile>] [--color-model <samples.csv>]" <<
+            " [--width <w> --height <h>]" <<
+            " [--threads <n> [--overlap <frames>]]" <<
+            " [--checkpoint <prefix> [--checkpoint-interval <frames>]" <<
+            " [--resume]]" <<
+            " [--live [--fps <n>] [--deadline-ms <ms>] [--loop]]" <<
+            " [--motion-gating] [--label-threads <n>] [--adaptive-color]" <<
+            " [--asset-cache <file>] [--highlights <file>]" <<
+            " [--stats <file>] [--metrics <port>|unix:<path>]" <<
+            " [--motion-model cv|gravity|imm]" << endl;
+        cout << "<filename> is a video file, a .bgr file of raw frames of" <<
+            " the given size, shm:<name> for a shared memory ring, or" <<
+            " synthetic:<w>x<h>[@<fps>][:<distractors>[:<seed>]] for a" <<
+            " generated scene." << endl;
+        cout << "--threads splits a video file into chunks tracked in" <<
+            " parallel and only prints the shots. It can't be combined" <<
+            " with --checkpoint or --offline." << endl;
+        cout << "--checkpoint saves the tracking state to" <<
+            " <prefix>.<frame>.ckpt, and --resume continues from it." << endl;
+        cout << "--live plays the input back as a live feed at --fps," <<
+            " dropping frames and shedding work to keep up." << endl;
+        cout << "--motion-gating only looks for the ball among pixels that" <<
+            " moved relative to the camera." << endl;
+        cout << "--adaptive-color keeps fitting the ball color to the" <<
+            " arena's lighting as the ball is tracked." << endl;
+        cout << "--asset-cache keeps the precomputed net template and color" <<
+            " tables in <file> for a faster start." << endl;
+        cout << "--highlights copies the shots out of the video file into" <<
+            " <file> without re-encoding them. It needs a video file as" <<
+            " input and a build with -DNBA_VISION_HIGHLIGHTS=ON." << endl;
+        cout << "--stats adds the shots of this game to the statistics" <<
+            " kept in <file>." << endl;
+        cout << "--metrics serves throughput and health metrics for" <<
+            " Prometheus on 127.0.0.1:<port> or a Unix socket." << endl;
+        cout << "--motion-model predicts the ball at constant velocity (the" <<
+            " default), under gravity, or with a mix of both, which also" <<
+            " fits the search area to the prediction's uncertainty." << endl;
         return -1;
     }
-    // Open the specified video file.
-    VideoCapture video_capture(argv[1]);
+    // Records the whole game for a second, smoothed pass at the end.
+    unique_ptr<OfflineShotAnalyzer> offline_analyzer;
+    // R,G,B samples of the ball color, e.g. metadata/BballColor.csv.
+    const char* color_model_filename = NULL;
+    // Size of the frames in a raw frame file.
+    int width = 0, height = 0;
+    int num_threads = 0;
+    int overlap_frames = kDefaultOverlapFrames;
+    // Periodic snapshots of the tracking state.
+    const char* checkpoint_prefix = NULL;
+    int checkpoint_interval = kDefaultCheckpointInterval;
+    bool resume = false;
+    bool live = false;
+    double live_fps = kDefaultLiveFps;
+    double deadline_ms = kDefaultDeadlineMillis;
+    bool loop = false;
+    bool motion_gating = false;
+    int label_threads = 1;
+    bool adaptive_color = false;
+    // Where the shots of a video file are cut to.
+    const char* highlights_filename = NULL;
+    // Where the shot statistics of all games are kept.
+    const char* stats_filename = NULL;
+    // Where the metrics are served.
+    const char* metrics_address = NULL;
+    MotionModelType motion_model = MOTION_CONSTANT_VELOCITY;
+    for (int i = 3; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--offline" && i + 1 < argc) {
+            offline_analyzer.reset(new OfflineShotAnalyzer(argv[++i]));
+        } else if (arg == "--color-model" && i + 1 < argc) {
+            color_model_filename = argv[++i];
+        } else if (arg == "--width" && i + 1 < argc) {
+            width = atoi(argv[++i]);
+        } else if (arg == "--height" && i + 1 < argc) {
+            height = atoi(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            num_threads = atoi(argv[++i]);
+        } else if (arg == "--overlap" && i + 1 < argc) {
+            overlap_frames = atoi(argv[++i]);
+        } else if (arg == "--checkpoint" && i + 1 < argc) {
+            checkpoint_prefix = argv[++i];
+        } else if (arg == "--checkpoint-interval" && i + 1 < argc) {
+            checkpoint_interval = atoi(argv[++i]);
+        } else if (arg == "--resume") {
+            resume = true;
+        } else if (arg == "--live") {
+            live = true;
+        } else if (arg == "--fps" && i + 1 < argc) {
+            live_fps = atof(argv[++i]);
+        } else if (arg == "--deadline-ms" && i + 1 < argc) {
+            deadline_ms = atof(argv[++i]);
+        } else if (arg == "--loop") {
+            loop = true;
+        } else if (arg == "--motion-gating") {
+            motion_gating = true;
+        } else if (arg == "--label-threads" && i + 1 < argc) {
+            label_threads = atoi(argv[++i]);
+        } else if (arg == "--adaptive-color") {
+            adaptive_color = true;
+        } else if (arg == "--asset-cache" && i + 1 < argc) {
+            BballTracker::SetAssetCache(argv[++i]);
+        } else if (arg == "--highlights" && i + 1 < argc) {
+            highlights_filename = argv[++i];
+        } else if (arg == "--stats" && i + 1 < argc) {
+            stats_filename = argv[++i];
+        } else if (arg == "--metrics" && i + 1 < argc) {
+            metrics_address = argv[++i];
+        } else if (arg == "--motion-model" && i + 1 < argc) {
+            if (!ParseMotionModelType(argv[++i], motion_model)) {
+                cout << "Unknown motion model: " << argv[i] << endl;
+                return -1;
+            }
+        } else {
+            cout << "Unknown argument: " << arg << endl;
+            return -1;
+        }
+    }
+    unique_ptr<Checkpointer> checkpointer;
+    if (checkpoint_prefix != NULL) {
+        checkpointer.reset(new Checkpointer(checkpoint_prefix,
+                    max(1, checkpoint_interval)));
+    }
+    // The checkpoints only hold the tracking state, not what the offline
+    // pass or the statistics gathered before it.
+    if (resume && (checkpointer == nullptr || offline_analyzer != nullptr ||
+                stats_filename != NULL)) {
+        cout << "--resume needs --checkpoint, and the offline pass and the" <<
+            " shot statistics can't be resumed." << endl;
+        return -1;
+    }
+    if (live && (resume || num_threads > 0 || live_fps <= 0 ||
+                highlights_filename != NULL)) {
+        cout << "--live can't be combined with --resume, --threads or" <<
+            " --highlights, and needs a positive --fps." << endl;
+        return -1;
+    }
+    // Each chunk starts from its own tracker and none tracks the whole game
+    // in order, so there is no single state to snapshot or to smooth.
+    if (num_threads > 0 && (checkpointer != nullptr ||
+                offline_analyzer != nullptr)) {
+        cout << "--threads can't be combined with --checkpoint or" <<
+            " --offline." << endl;
+        return -1;
+    }
+    // The clips are copied out of the input file at the end, from shots
+    // that the checkpoints don't hold.
+    if (highlights_filename != NULL &&
+            (resume || !IsVideoFileSource(argv[1]))) {
+        cout << "--highlights needs a video file as input and can't be" <<
+            " combined with --resume." << endl;
+        return -1;
+    }
+    // Checked before the game is tracked rather than when the clips are cut.
+    if (highlights_filename != NULL && !HighlightExtractor::IsSupported()) {
+        cout << "--highlights needs a build with -DNBA_VISION_HIGHLIGHTS=ON" <<
+            " and FFmpeg's libavformat." << endl;
+        return -1;
+    }
+    unique_ptr<ShotStatistics> shot_statistics;
+    if (stats_filename != NULL) {
+        shot_statistics.reset(new ShotStatistics());
+    }
+    unique_ptr<HighlightExtractor> highlight_extractor;
+    if (highlights_filename != NULL) {
+        highlight_extractor.reset(new HighlightExtractor(
+                    kHighlightPreRollSeconds, kHighlightPostRollSeconds));
+    }
+    unique_ptr<MetricsExporter> metrics_exporter;
+    if (metrics_address != NULL) {
+        metrics_exporter.reset(new MetricsExporter());
+        if (!metrics_exporter->Start(metrics_address)) {
+            return -1;
+        }
+    }
+    if (num_threads > 0) {
+        STAGE_TIMING_INIT();
+        ChunkedProcessor processor(argv[1], num_threads, overlap_frames);
+        processor.SetMetrics(metrics_exporter.get());
+        processor.SetMotionModel(motion_model);
+        processor.SetColorModel(color_model_filename);
+        processor.SetMotionGating(motion_gating);
+        processor.SetLabelingThreads(label_threads);
+        processor.SetAdaptiveColor(adaptive_color);
+        vector<DetectedShot> shots;
+        if (!processor.Run(shots)) {
+            return -1;
+        }
+        cout << "Found " << shots.size() << " shots." << endl;
+        for (const auto& shot : shots) {
+            cout << "Frames " << shot.start_frame << "-" << shot.end_frame <<
+                ": " << (shot.end_frame == -1 ? "unfinished" :
+                        (shot.made ? "make" : "miss")) << endl;
+        }
+        // The statistics are kept even if the clips can't be cut.
+        bool highlights_written = true;
+        if (highlight_extractor != nullptr) {
+            highlight_extractor->AddShots(shots);
+            highlights_written = highlight_extractor->Extract(argv[1],
+                    highlights_filename);
+        }
+        if (shot_statistics != nullptr) {
+            for (const auto& shot : shots) {
+                if (shot.end_frame != -1) {
+                    shot_statistics->AddShot(shot.features);
+                }
+            }
+            if (!UpdateSeasonStatistics(*shot_statistics, stats_filename)) {
+                return -1;
+            }
+        }
+        return highlights_written ? 0 : -1;
+    }
+
+    // Open the specified video file or stream of decoded frames.
+    unique_ptr<FrameSource> frame_source(
+            OpenFrameSource(argv[1], width, height));
+    if (frame_source == nullptr) {
+        return -1;
+    }
+    // With --live, the source is paced and tracking sheds work to keep up.
+    PacedFrameSource* paced_source = NULL;
+    unique_ptr<LoadShedder> load_shedder;
+    if (live) {
+        paced_source = new PacedFrameSource(frame_source.release(), live_fps,
+                loop);
+        frame_source.reset(paced_source);
+        load_shedder.reset(new LoadShedder(deadline_ms));
+    }
+    FrameRecorders recorders;
+    recorders.offline_analyzer = offline_analyzer.get();
+    recorders.highlight_extractor = highlight_extractor.get();
+    recorders.shot_statistics = shot_statistics.get();
+    recorders.worker_metrics = metrics_exporter == nullptr ? NULL :
+        metrics_exporter->AddWorker("main");
 
     VideoWriter output_cap(argv[2], 
                CV_FOURCC('m', 'p', '4', 'v'),
                15,
-               Size(video_capture.get(CV_CAP_PROP_FRAME_WIDTH),
-               video_capture.get(CV_CAP_PROP_FRAME_HEIGHT)));
+               frame_source->FrameSize());
     if (!output_cap.isOpened())
     {
         std::cout << "!!! Output video could not be opened" << std::endl;
         return -1;
     }
 
-    if (!video_capture.isOpened()) {
-        cout << "Cannot open the video file." << endl;
-        return -1;
-    }
-
     namedWindow(kWindowName, CV_WINDOW_AUTOSIZE);
+    // Per-stage timings are printed at exit, or on SIGUSR1, when built with
+    // -DNBA_VISION_PROFILING.
+    STAGE_TIMING_INIT();
 
-    MultipleKalmanFilter mkf(0, NULL);
+    MultipleKalmanFilter mkf(0, NULL, motion_model);
     unique_ptr<BballTracker> bball_tracker;
     ball_init = false;
-    OpticalFlow opf(true);
+    OpticalFlow opf(kDebug);
+    // Index of the next frame read.
+    int frame_idx = 0;
+    if (resume) {
+        bball_tracker.reset(new BballTracker(&mkf, kDebug));
+        if (color_model_filename != NULL &&
+                !bball_tracker->LoadColorModel(color_model_filename)) {
+            return -1;
+        }
+        bball_tracker->SetMotionGating(motion_gating);
+        bball_tracker->SetLabelingThreads(label_threads);
+        bball_tracker->SetAdaptiveColor(adaptive_color);
+        // The checkpoint holds the learned colors, so it is restored once the
+        // tracker is set up as in the run that saved it.
+        int checkpoint_frame;
+        if (!checkpointer->Restore(checkpoint_frame, *bball_tracker, mkf, opf) ||
+                !frame_source->SkipTo(checkpoint_frame + 1)) {
+            return -1;
+        }
+        cout << "Resuming after frame " << checkpoint_frame << "." << endl;
+        frame_idx = checkpoint_frame + 1;
+        ball_init = true;
+    } else if (live) {
+        // There is no one to click on a live feed, so the tracker starts from
+        // the roundest ball colored region.
+        bball_tracker.reset(new BballTracker(&mkf, kDebug));
+        if (color_model_filename != NULL &&
+                !bball_tracker->LoadColorModel(color_model_filename)) {
+            return -1;
+        }
+        bball_tracker->SetMotionGating(motion_gating);
+        bball_tracker->SetLabelingThreads(label_threads);
+        bball_tracker->SetAdaptiveColor(adaptive_color);
+        ball_init = true;
+    }
 
     while (true) {
+        STAGE_TIMING_POLL();
         Mat frame;
-        bool success = video_capture.read(frame);
+        bool success;
+        {
+            STAGE_TIMER("ReadFrame");
+            success = frame_source->Read(frame);
+        }
         
         if (!success) {
             cout << "Cannot read current frame from the video file." << endl;
             break;
         }
+        // The frame may be read-only memory of the source, so the overlays
+        // are drawn on a copy for the output video and the window.
+        Mat output;
+        frame.copyTo(output);
 
+        if (bball_tracker != nullptr && load_shedder != nullptr) {
+            load_shedder->Apply(bball_tracker.get());
+        }
+        // The camera motion between the last frame and this one, for the
+        // motion gating of this frame.
+        if (load_shedder == nullptr || !load_shedder->ShouldSkipOpticalFlow()) {
+            opf.computeOpticalFlow(frame, &output);
+            if (bball_tracker != nullptr) {
+                bball_tracker->SetCameraMotion(opf.getCameraMotion());
+            }
+        }
         if (bball_tracker != nullptr) {
             // Track the basketball in each frame.
-            bball_tracker->TrackBall(frame);
-	    output_cap.write(frame);
+            TrackFrame(bball_tracker.get(), recorders, frame_idx, frame);
+            bball_tracker->DrawResult(output);
+	    output_cap.write(output);
         }
-
-        opf.computeOpticalFlow(frame);
-        imshow(kWindowName, frame);
+        imshow(kWindowName, output);
         mtx.lock();
         if (!ball_init) {
             cout << "Click on the basketball to set its initial location." << endl;
@@ -90,18 +408,117 @@ int main(int argc, char* argv[]) {
             bball_tracker.reset(new BballTracker(&mkf,
                         pair<int, int>(init_ball_x, init_ball_y),
                         kDebug));
-            bball_tracker->TrackBall(frame);
-	    output_cap.write(frame); 
+            if (color_model_filename != NULL &&
+                    !bball_tracker->LoadColorModel(color_model_filename)) {
+                return -1;
+            }
+            bball_tracker->SetMotionGating(motion_gating);
+            bball_tracker->SetLabelingThreads(label_threads);
+            bball_tracker->SetAdaptiveColor(adaptive_color);
+            bball_tracker->SetCameraMotion(opf.getCameraMotion());
+            TrackFrame(bball_tracker.get(), recorders, frame_idx, frame);
+            bball_tracker->DrawResult(output);
+	    output_cap.write(output); 
         }
         mtx.unlock();
+        if (checkpointer != nullptr) {
+            checkpointer->Update(frame_idx, *bball_tracker, mkf, opf);
+        }
+        WorkerMetrics* worker_metrics = recorders.worker_metrics;
+        if (worker_metrics != NULL) {
+            worker_metrics->queue_depth.store(frame_source->QueueDepth(),
+                    memory_order_relaxed);
+        }
+        if (load_shedder != nullptr) {
+            load_shedder->EndFrame(paced_source->FrameTime());
+            if (worker_metrics != NULL) {
+                worker_metrics->dropped_frames.store(
+                        paced_source->DroppedFrames(), memory_order_relaxed);
+                worker_metrics->lag_micros.store(
+                        load_shedder->LagMillis() * 1000, memory_order_relaxed);
+                worker_metrics->shed_level.store(load_shedder->Level(),
+                        memory_order_relaxed);
+            }
+            if (frame_idx % kLiveReportInterval == 0) {
+                cout << "Frame " << frame_idx << ": lag " <<
+                    load_shedder->LagMillis() << " ms, shed level " <<
+                    load_shedder->Level() << ", " <<
+                    load_shedder->MissedDeadlines() << " missed deadlines, " <<
+                    paced_source->DroppedFrames() << " dropped frames" << endl;
+            }
+        }
+        frame_idx++;
 
-        if (waitKey(20) == 27) {
+        // A live feed doesn't wait for the display.
+        if (waitKey(live ? 1 : 20) == 27) {
             cout << "Esc key pressed." << endl;
             break;
         }
     }
 
-    return 0;
+    if (offline_analyzer != nullptr) {
+        vector<ReconstructedShot> shots;
+        if (!offline_analyzer->Finish(shots)) {
+            return -1;
+        }
+        cout << "Offline pass over " << offline_analyzer->NumFrames() <<
+            " frames found " << shots.size() << " shots." << endl;
+        for (const auto& shot : shots) {
+            cout << "Frames " << shot.start_frame << "-" << shot.end_frame <<
+                ": " << (shot.made ? "make" : "miss") <<
+                (shot.from_arc ? " (arc fit)" : " (path)") << endl;
+        }
+    }
+
+    // The statistics are kept even if the clips can't be cut.
+    bool highlights_written = highlight_extractor == nullptr ||
+        highlight_extractor->Extract(argv[1], highlights_filename);
+    if (shot_statistics != nullptr &&
+            !UpdateSeasonStatistics(*shot_statistics, stats_filename)) {
+        return -1;
+    }
+
+    return highlights_written ? 0 : -1;
+}
+
+void TrackFrame(BballTracker* bball_tracker, const FrameRecorders& recorders,
+        const int& frame_idx, const Mat& frame) {
+    chrono::steady_clock::time_point track_start = chrono::steady_clock::now();
+    bball_tracker->TrackBall(frame);
+    const TrackResult& result = bball_tracker->GetLastResult();
+    if (recorders.worker_metrics != NULL) {
+        recorders.worker_metrics->RecordFrame(result,
+                chrono::duration_cast<chrono::nanoseconds>(
+                    chrono::steady_clock::now() - track_start).count());
+    }
+    if (recorders.offline_analyzer != NULL) {
+        recorders.offline_analyzer->AddFrame(result.found_ball,
+                result.ball_location, result.found_net, result.net_rect);
+    }
+    if (recorders.highlight_extractor != NULL) {
+        recorders.highlight_extractor->AddEvent(frame_idx, result.event);
+    }
+    if (recorders.shot_statistics != NULL &&
+            (result.event == SHOT_MADE || result.event == SHOT_MISSED)) {
+        recorders.shot_statistics->AddShot(result.shot_features);
+    }
+}
+
+bool UpdateSeasonStatistics(const ShotStatistics& game_statistics,
+        const char* filename) {
+    cout << "This game: ";
+    game_statistics.Print(cout);
+    ShotStatistics season_statistics;
+    // A file that exists but can't be read is kept rather than replaced.
+    if (ifstream(filename).good() &&
+            !season_statistics.LoadFromFile(filename)) {
+        cout << "Cannot read the shot statistics in " << filename << endl;
+        return false;
+    }
+    season_statistics.Merge(game_statistics);
+    cout << "All games: ";
+    season_statistics.Print(cout);
+    return season_statistics.SaveToFile(filename);
 }
 
 void MouseCallBack(int event, int x, int y, int flags, void* userdata) {
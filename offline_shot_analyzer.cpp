@@ -0,0 +1,359 @@
+#include "offline_shot_analyzer.h"
+
+#include <cmath>
+#include <iostream>
+
+namespace nba_vision {
+
+// Number of records held in memory during each pass.
+const int kRecordsPerBlock = 4096;
+// Shots longer than this are not real shots (e.g. the ball was lost above
+// the net) and are dropped.
+const int kMaxShotFrames = 300;
+// An arc needs at least this many points to be fit.
+const int kMinArcSamples = 5;
+// Arcs that fit the smoothed points worse than this, in pixels, are not
+// trusted to decide the outcome.
+const double kMaxArcFitError = 15;
+
+OfflineShotAnalyzer::OfflineShotAnalyzer(const string& history_filename) :
+        history_filename_(history_filename),
+        smoothed_filename_(history_filename + ".smoothed"),
+        filter_(1), num_frames_(0), write_failed_(false) {
+    history_file_ = fopen(history_filename_.c_str(), "wb");
+    if (history_file_ == NULL) {
+        cout << "Could not open history file: " << history_filename_ << endl;
+        write_failed_ = true;
+    }
+    block_.reserve(kRecordsPerBlock);
+    shot_samples_.reserve(kMaxShotFrames);
+}
+
+OfflineShotAnalyzer::~OfflineShotAnalyzer() {
+    if (history_file_ != NULL) {
+        fclose(history_file_);
+    }
+}
+
+void OfflineShotAnalyzer::AddFrame(const bool& found_ball,
+        const Point2f& ball_location, const bool& found_net,
+        const Rect& net_rect) {
+    if (num_frames_ == 0) {
+        // The first location is either a detection or the initial location
+        // given by the user.
+        filter_.AddObject(ball_location.x, ball_location.y);
+    }
+    ForwardRecord record;
+    Matx41f state = filter_.GetState(0);
+    Matx44f error_cov = filter_.GetErrorCov(0);
+    for (int i = 0; i < 4; ++i) {
+        record.state_pre[i] = state(i);
+    }
+    record.cov_pre[0] = error_cov(0, 0);
+    record.cov_pre[1] = error_cov(0, 2);
+    record.cov_pre[2] = error_cov(2, 2);
+
+    if (found_ball) {
+        float measurement_x = ball_location.x;
+        float measurement_y = ball_location.y;
+        uchar has_measurement = 1;
+        filter_.CorrectAll(&measurement_x, &measurement_y, &has_measurement);
+    }
+    state = filter_.GetState(0);
+    error_cov = filter_.GetErrorCov(0);
+    for (int i = 0; i < 4; ++i) {
+        record.state_post[i] = state(i);
+    }
+    record.cov_post[0] = error_cov(0, 0);
+    record.cov_post[1] = error_cov(0, 2);
+    record.cov_post[2] = error_cov(2, 2);
+
+    record.has_net = found_net;
+    record.net[0] = net_rect.x;
+    record.net[1] = net_rect.y;
+    record.net[2] = net_rect.width;
+    record.net[3] = net_rect.height;
+
+    block_.push_back(record);
+    if (block_.size() == kRecordsPerBlock) {
+        FlushForwardBlock();
+    }
+    filter_.PredictAll();
+    num_frames_++;
+}
+
+void OfflineShotAnalyzer::FlushForwardBlock() {
+    if (history_file_ != NULL && !block_.empty() &&
+            fwrite(block_.data(), sizeof(ForwardRecord), block_.size(),
+                history_file_) != block_.size()) {
+        write_failed_ = true;
+    }
+    block_.clear();
+}
+
+bool OfflineShotAnalyzer::Finish(vector<ReconstructedShot>& shots) {
+    FlushForwardBlock();
+    if (history_file_ != NULL) {
+        fclose(history_file_);
+        history_file_ = NULL;
+    }
+    if (write_failed_) {
+        cout << "Could not write history file: " << history_filename_ << endl;
+        return false;
+    }
+    if (!SmoothBackward()) {
+        return false;
+    }
+    return ReconstructShots(shots);
+}
+
+int OfflineShotAnalyzer::NumFrames() const {
+    return num_frames_;
+}
+
+bool OfflineShotAnalyzer::SmoothBackward() {
+    FILE* history_file = fopen(history_filename_.c_str(), "rb");
+    FILE* smoothed_file = fopen(smoothed_filename_.c_str(), "wb");
+    if (history_file == NULL || smoothed_file == NULL) {
+        cout << "Could not open history files for smoothing." << endl;
+        if (history_file != NULL) fclose(history_file);
+        if (smoothed_file != NULL) fclose(smoothed_file);
+        return false;
+    }
+    vector<SmoothedRecord> smoothed_block(kRecordsPerBlock);
+    // Smoothed state and covariance of frame t + 1 and its prediction from
+    // the forward pass.
+    float next_smoothed[4] = {0, 0, 0, 0};
+    float next_smoothed_cov[3] = {0, 0, 0};
+    float next_pre[4] = {0, 0, 0, 0};
+    float next_pre_cov[3] = {0, 0, 0};
+    bool ok = true;
+    int num_blocks = (num_frames_ + kRecordsPerBlock - 1) / kRecordsPerBlock;
+    for (int b = num_blocks - 1; b >= 0 && ok; b--) {
+        int start = b * kRecordsPerBlock;
+        int count = min(kRecordsPerBlock, num_frames_ - start);
+        block_.resize(count);
+        fseek(history_file, (long) start * sizeof(ForwardRecord), SEEK_SET);
+        if (fread(block_.data(), sizeof(ForwardRecord), count, history_file) !=
+                (size_t) count) {
+            ok = false;
+            break;
+        }
+        for (int i = count - 1; i >= 0; i--) {
+            const ForwardRecord& record = block_[i];
+            float smoothed[4];
+            float smoothed_cov[3];
+            if (start + i == num_frames_ - 1) {
+                // The last filtered state is already smoothed.
+                for (int k = 0; k < 4; ++k) smoothed[k] = record.state_post[k];
+                for (int k = 0; k < 3; ++k) smoothed_cov[k] = record.cov_post[k];
+            } else {
+                // Per axis, with P = [a b; b c] and F = [1 1; 0 1]:
+                //   C = P F^T (P_pre(t+1))^-1
+                //   x_s = x + C (x_s(t+1) - x_pre(t+1))
+                //   P_s = P + C (P_s(t+1) - P_pre(t+1)) C^T
+                float a = record.cov_post[0];
+                float b2 = record.cov_post[1];
+                float c = record.cov_post[2];
+                float p = next_pre_cov[0];
+                float q = next_pre_cov[1];
+                float r = next_pre_cov[2];
+                float inv_det = 1.0f / (p * r - q * q);
+                float c00 = ((a + b2) * r - b2 * q) * inv_det;
+                float c01 = (b2 * p - (a + b2) * q) * inv_det;
+                float c10 = ((b2 + c) * r - c * q) * inv_det;
+                float c11 = (c * p - (b2 + c) * q) * inv_det;
+                for (int axis = 0; axis < 2; ++axis) {
+                    float d_pos = next_smoothed[axis] - next_pre[axis];
+                    float d_vel = next_smoothed[axis + 2] - next_pre[axis + 2];
+                    smoothed[axis] = record.state_post[axis] +
+                        c00 * d_pos + c01 * d_vel;
+                    smoothed[axis + 2] = record.state_post[axis + 2] +
+                        c10 * d_pos + c11 * d_vel;
+                }
+                float d00 = next_smoothed_cov[0] - p;
+                float d01 = next_smoothed_cov[1] - q;
+                float d11 = next_smoothed_cov[2] - r;
+                // C D C^T for symmetric D.
+                float e00 = c00 * d00 + c01 * d01;
+                float e01 = c00 * d01 + c01 * d11;
+                float e10 = c10 * d00 + c11 * d01;
+                float e11 = c10 * d01 + c11 * d11;
+                smoothed_cov[0] = a + e00 * c00 + e01 * c01;
+                smoothed_cov[1] = b2 + e00 * c10 + e01 * c11;
+                smoothed_cov[2] = c + e10 * c10 + e11 * c11;
+            }
+            smoothed_block[i].x = smoothed[0];
+            smoothed_block[i].y = smoothed[1];
+            for (int k = 0; k < 4; ++k) {
+                next_smoothed[k] = smoothed[k];
+                next_pre[k] = record.state_pre[k];
+            }
+            for (int k = 0; k < 3; ++k) {
+                next_smoothed_cov[k] = smoothed_cov[k];
+                next_pre_cov[k] = record.cov_pre[k];
+            }
+        }
+        // Blocks are written back to front, each at its own offset.
+        fseek(smoothed_file, (long) start * sizeof(SmoothedRecord), SEEK_SET);
+        if (fwrite(smoothed_block.data(), sizeof(SmoothedRecord), count,
+                    smoothed_file) != (size_t) count) {
+            ok = false;
+        }
+    }
+    fclose(history_file);
+    if (fclose(smoothed_file) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        cout << "Could not smooth history file: " << history_filename_ << endl;
+    }
+    return ok;
+}
+
+bool OfflineShotAnalyzer::ReconstructShots(vector<ReconstructedShot>& shots) {
+    FILE* history_file = fopen(history_filename_.c_str(), "rb");
+    FILE* smoothed_file = fopen(smoothed_filename_.c_str(), "rb");
+    if (history_file == NULL || smoothed_file == NULL) {
+        cout << "Could not open history files for shot reconstruction." << endl;
+        if (history_file != NULL) fclose(history_file);
+        if (smoothed_file != NULL) fclose(smoothed_file);
+        return false;
+    }
+    vector<SmoothedRecord> smoothed_block(kRecordsPerBlock);
+    bool have_net = false;
+    Rect net_rect;
+    bool in_shot = false;
+    ReconstructedShot shot;
+    bool ok = true;
+    for (int start = 0; start < num_frames_ && ok; start += kRecordsPerBlock) {
+        int count = min(kRecordsPerBlock, num_frames_ - start);
+        block_.resize(count);
+        if (fread(block_.data(), sizeof(ForwardRecord), count, history_file) !=
+                (size_t) count ||
+                fread(smoothed_block.data(), sizeof(SmoothedRecord), count,
+                    smoothed_file) != (size_t) count) {
+            ok = false;
+            break;
+        }
+        for (int i = 0; i < count; ++i) {
+            if (block_[i].has_net) {
+                have_net = true;
+                net_rect = Rect(block_[i].net[0], block_[i].net[1],
+                        block_[i].net[2], block_[i].net[3]);
+            }
+            if (!have_net) {
+                continue;
+            }
+            const SmoothedRecord& location = smoothed_block[i];
+            if (!in_shot) {
+                // Same rule as UpdateBallState, on the smoothed path.
+                if (location.y < net_rect.y) {
+                    in_shot = true;
+                    shot.start_frame = start + i;
+                    shot_samples_.clear();
+                    shot_samples_.push_back(location);
+                }
+                continue;
+            }
+            shot_samples_.push_back(location);
+            if (shot_samples_.size() > kMaxShotFrames) {
+                in_shot = false;
+                continue;
+            }
+            if (location.y > net_rect.y + net_rect.height) {
+                shot.end_frame = start + i;
+                FitShot(net_rect, shot);
+                shots.push_back(shot);
+                in_shot = false;
+            }
+        }
+    }
+    fclose(history_file);
+    fclose(smoothed_file);
+    block_.clear();
+    if (!ok) {
+        cout << "Could not read history file: " << history_filename_ << endl;
+    }
+    return ok;
+}
+
+void OfflineShotAnalyzer::FitShot(const Rect& net_rect, ReconstructedShot& shot) {
+    const int n = shot_samples_.size();
+    shot.from_arc = false;
+    shot.arc_x[0] = shot.arc_x[1] = 0;
+    shot.arc_y[0] = shot.arc_y[1] = shot.arc_y[2] = 0;
+    shot.fit_error = -1;
+    if (n >= kMinArcSamples) {
+        // Least squares fit of x(t) = a0 + a1 t and y(t) = b0 + b1 t + b2 t^2.
+        double s[5] = {0, 0, 0, 0, 0};
+        double sx[2] = {0, 0};
+        double sy[3] = {0, 0, 0};
+        for (int t = 0; t < n; ++t) {
+            double power = 1;
+            for (int k = 0; k < 5; ++k) {
+                s[k] += power;
+                if (k < 2) sx[k] += power * shot_samples_[t].x;
+                if (k < 3) sy[k] += power * shot_samples_[t].y;
+                power *= t;
+            }
+        }
+        double det_x = s[0] * s[2] - s[1] * s[1];
+        shot.arc_x[0] = (sx[0] * s[2] - s[1] * sx[1]) / det_x;
+        shot.arc_x[1] = (s[0] * sx[1] - s[1] * sx[0]) / det_x;
+        // Cramer's rule on the 3x3 normal equations, which are symmetric
+        // with entries s[i + j].
+        double det_y = s[0] * (s[2] * s[4] - s[3] * s[3]) -
+            s[1] * (s[1] * s[4] - s[3] * s[2]) +
+            s[2] * (s[1] * s[3] - s[2] * s[2]);
+        shot.arc_y[0] = (sy[0] * (s[2] * s[4] - s[3] * s[3]) -
+            s[1] * (sy[1] * s[4] - s[3] * sy[2]) +
+            s[2] * (sy[1] * s[3] - s[2] * sy[2])) / det_y;
+        shot.arc_y[1] = (s[0] * (sy[1] * s[4] - s[3] * sy[2]) -
+            sy[0] * (s[1] * s[4] - s[3] * s[2]) +
+            s[2] * (s[1] * sy[2] - sy[1] * s[2])) / det_y;
+        shot.arc_y[2] = (s[0] * (s[2] * sy[2] - sy[1] * s[3]) -
+            s[1] * (s[1] * sy[2] - sy[1] * s[2]) +
+            sy[0] * (s[1] * s[3] - s[2] * s[2])) / det_y;
+        double squared_error = 0;
+        for (int t = 0; t < n; ++t) {
+            double x_diff = shot.arc_x[0] + shot.arc_x[1] * t - shot_samples_[t].x;
+            double y_diff = shot.arc_y[0] + shot.arc_y[1] * t +
+                shot.arc_y[2] * t * t - shot_samples_[t].y;
+            squared_error += x_diff * x_diff + y_diff * y_diff;
+        }
+        shot.fit_error = sqrt(squared_error / n);
+    }
+
+    // y grows downwards in the image, so a ball under gravity has a
+    // positive quadratic term.
+    if (shot.fit_error >= 0 && shot.fit_error < kMaxArcFitError &&
+            shot.arc_y[2] > 0) {
+        // Find where the descending part of the arc crosses the middle of
+        // the net and check whether it is between the sides of the net.
+        double net_middle = net_rect.y + net_rect.height / 2.0;
+        double a = shot.arc_y[2];
+        double b = shot.arc_y[1];
+        double c = shot.arc_y[0] - net_middle;
+        double discriminant = b * b - 4 * a * c;
+        if (discriminant >= 0) {
+            double t = (-b + sqrt(discriminant)) / (2 * a);
+            double x = shot.arc_x[0] + shot.arc_x[1] * t;
+            shot.made = x >= net_rect.x && x <= net_rect.x + net_rect.width;
+            shot.from_arc = true;
+            return;
+        }
+    }
+    // Fall back to checking whether the smoothed path went through the net.
+    shot.made = false;
+    for (const auto& location : shot_samples_) {
+        if (location.x > net_rect.x && location.x < net_rect.x + net_rect.width &&
+                location.y > net_rect.y &&
+                location.y < net_rect.y + net_rect.height) {
+            shot.made = true;
+            break;
+        }
+    }
+}
+
+}
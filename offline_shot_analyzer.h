@@ -0,0 +1,101 @@
+#ifndef OFFLINE_SHOT_ANALYZER_H
+#define OFFLINE_SHOT_ANALYZER_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include "kalman_filter_bank.h"
+
+using namespace cv;
+using namespace std;
+
+namespace nba_vision {
+
+// A shot found by the offline pass.
+struct ReconstructedShot {
+    int start_frame;
+    int end_frame;
+    bool made;
+    // Whether the outcome came from the fitted arc. When the arc fit is
+    // unusable, the outcome falls back to the smoothed path crossing the net.
+    bool from_arc;
+    // Fitted arc, with t in frames since start_frame:
+    //   x(t) = arc_x[0] + arc_x[1] * t
+    //   y(t) = arc_y[0] + arc_y[1] * t + arc_y[2] * t^2
+    double arc_x[2];
+    double arc_y[3];
+    // Root mean square distance of the smoothed points from the arc.
+    double fit_error;
+};
+
+// Offline two-pass analysis of archived footage. The forward pass runs the
+// ball's Kalman filter over the per-frame tracker output and streams every
+// state to a history file on disk. Finish() then runs a
+// Rauch-Tung-Striebel smoother backwards over the history, fits a parabola
+// to each shot in the smoothed trajectory and re-decides whether it went in.
+// Only one block of records is held in memory at a time, so a full game
+// needs the same memory as a short clip.
+class OfflineShotAnalyzer {
+public:
+    // history_filename is the scratch file for the forward pass. The smoothed
+    // trajectory is written next to it with a ".smoothed" suffix.
+    explicit OfflineShotAnalyzer(const string& history_filename);
+
+    ~OfflineShotAnalyzer();
+
+    // Forward pass, called once per frame with the output of TrackBall.
+    // ball_location is ignored when found_ball is false.
+    void AddFrame(const bool& found_ball, const Point2f& ball_location,
+            const bool& found_net, const Rect& net_rect);
+
+    // Runs the backward pass and the shot reconstruction. Returns false if
+    // the history files could not be written or read.
+    bool Finish(vector<ReconstructedShot>& shots);
+
+    int NumFrames() const;
+
+private:
+    // One frame of the forward pass. Both axes share one covariance, see
+    // KalmanFilterBank.
+    struct ForwardRecord {
+        // Predicted state and covariance before the measurement.
+        float state_pre[4];
+        float cov_pre[3];
+        // State and covariance after the measurement.
+        float state_post[4];
+        float cov_post[3];
+        float net[4];
+        unsigned char has_net;
+    };
+
+    struct SmoothedRecord {
+        float x;
+        float y;
+    };
+
+    void FlushForwardBlock();
+
+    bool SmoothBackward();
+
+    bool ReconstructShots(vector<ReconstructedShot>& shots);
+
+    // Fits the arc to the samples of one shot and decides its outcome.
+    void FitShot(const Rect& net_rect, ReconstructedShot& shot);
+
+    string history_filename_;
+    string smoothed_filename_;
+    FILE* history_file_;
+    KalmanFilterBank filter_;
+    int num_frames_;
+    bool write_failed_;
+    vector<ForwardRecord> block_;
+    // Samples of the shot being reconstructed.
+    vector<SmoothedRecord> shot_samples_;
+};
+
+}
+
+#endif  // OFFLINE_SHOT_ANALYZER_H
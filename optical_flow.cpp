@@ -1,5 +1,10 @@
 #include "optical_flow.h"
 
+#include <algorithm>
+
+#include "serialization.h"
+#include "stage_timer.h"
+
 using namespace cv;
 using namespace std;
 
@@ -44,12 +49,14 @@ void Bucket::incrementCount(){
 
 OpticalFlow::OpticalFlow(bool debug){
 	debug_ = debug;
+	camera_motion = Point2f(0, 0);
 	if (debug_){
 		namedWindow(windowName, CV_WINDOW_AUTOSIZE);
 	}
 }
 
-void OpticalFlow::computeOpticalFlow(Mat& cf){
+void OpticalFlow::computeOpticalFlow(const Mat& cf, Mat* output){
+	STAGE_TIMER("computeOpticalFlow");
 	Mat current_frame;
 	cvtColor(cf, current_frame, COLOR_BGR2GRAY);
 	if( points[0].empty() ){
@@ -57,31 +64,48 @@ void OpticalFlow::computeOpticalFlow(Mat& cf){
 	}
 	if (buckets.empty()){
 		buildBuckets(6, 30.0, 10);
-		cout <<"first bucket angle :" << buckets[0].angle_max << endl;
+		if (debug_){
+			cout <<"first bucket angle :" << buckets[0].angle_max << endl;
+		}
 	}
 	if( !previous_frame.empty() ){
 		vector<double> distance(points[0].size()), angle(points[0].size());
 		vector<uchar> status;
 		vector<float> err;
+		vector<float> motion_x, motion_y;
 
 		calcOpticalFlowPyrLK(previous_frame, current_frame, points[0],
 					points[1], status, err, winSize, 3, termcrit, 0, 0.01);	
 		for( int i = 0; i < points[1].size(); i++ ){
                 	if( !status[i] )
                     		continue;
+			motion_x.push_back(points[1][i].x - points[0][i].x);
+			motion_y.push_back(points[1][i].y - points[0][i].y);
 			distance[i] = computeDistance(points[0][i], points[1][i]);
 			angle[i] = computeAngle(points[0][i], points[1][i]);
 			status[i] = assignBucket(distance[i], angle[i]);
 	    	}
+		// Most of the grid is on the background, so the median is the
+		// camera motion even with players and the ball moving.
+		if (!motion_x.empty()){
+			size_t middle = motion_x.size() / 2;
+			nth_element(motion_x.begin(), motion_x.begin() + middle, motion_x.end());
+			nth_element(motion_y.begin(), motion_y.begin() + middle, motion_y.end());
+			camera_motion = Point2f(motion_x[middle], motion_y[middle]);
+		}
 		Bucket max_bucket = maxBucket();
-		cout << max_bucket.getCount() << endl;
-		for( int i = 0; i < points[1].size(); i++ ){
-                	if( !status[i])
-                    		continue;
-			if(!max_bucket.inBucket(distance[i], angle[i])){
-				drawFlow(points[0][i], points[1][i], false, cf);
+		if (debug_){
+			cout << max_bucket.getCount() << endl;
+		}
+		if (output != NULL){
+			for( int i = 0; i < points[1].size(); i++ ){
+				if( !status[i])
+					continue;
+				if(!max_bucket.inBucket(distance[i], angle[i])){
+					drawFlow(points[0][i], points[1][i], false, *output);
+				}
 			}
-	    	}
+		}
 		//debug	
 		if ( debug_ ){
 			imshow(windowName, previous_frame);
@@ -91,6 +115,22 @@ void OpticalFlow::computeOpticalFlow(Mat& cf){
 	previous_frame = current_frame; // current frame becomes previous frame.
 }
 
+Point2f OpticalFlow::getCameraMotion() const{
+	return camera_motion;
+}
+
+void OpticalFlow::saveState(ostream& output) const{
+	WriteMat(output, previous_frame);
+	WriteVector(output, points[0]);
+	WriteVector(output, points[1]);
+}
+
+bool OpticalFlow::loadState(istream& input){
+	// The buckets only hold counts within a frame, so they are rebuilt.
+	return ReadMat(input, previous_frame) && ReadVector(input, points[0]) &&
+		ReadVector(input, points[1]);
+}
+
 void OpticalFlow::drawFlow(Point2f point_a, Point2f point_b, bool camera_motion, Mat& cf){
 	Point p0( ceil( point_a.x ), ceil( point_a.y ) );
 	Point p1( ceil( point_b.x ), ceil( point_b.y ) );
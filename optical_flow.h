@@ -39,7 +39,17 @@ public:
 	OpticalFlow(bool debug=false);
 	// Compute Optical flow with given points.
 	// Compute Optical flow without points given (we calculate our own points).	
-	void computeOpticalFlow(Mat& cf);
+	// cf is only read; the flow of the moving points is drawn on output
+	// unless it is NULL.
+	void computeOpticalFlow(const Mat& cf, Mat* output=NULL);
+	// How far the background moved between the last two frames, taken as
+	// the median motion of the point grid. Zero until two frames were seen.
+	Point2f getCameraMotion() const;
+	// Writes the previous frame and tracked points for a checkpoint.
+	void saveState(ostream& output) const;
+	// Restores the state written by saveState. Returns false if the stream
+	// is malformed.
+	bool loadState(istream& input);
 private:
 	bool debug_;
 	void drawFlow(Point2f point_a, Point2f point_b, bool camera_motion, Mat& cf);
@@ -59,6 +69,7 @@ private:
 	double average_optical_flow;
 	double std_optical_flow;
 	vector<Bucket> buckets;
+	Point2f camera_motion;
 };
 
 
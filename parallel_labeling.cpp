@@ -0,0 +1,233 @@
+#include "parallel_labeling.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "stage_timer.h"
+
+namespace nba_vision {
+
+// A band of rows labeled on its own. Labels are numbered from 0 within the
+// band, in the order they are created.
+struct LabeledBand {
+    int row_begin;
+    int row_end;
+    // Union-find over the labels of the band. A label's parent is never
+    // greater than the label, so each root is the first label of its
+    // component in raster order.
+    vector<int> parent;
+    // Number of pixels given each label.
+    vector<int> num_pixels;
+    // Index of the band's first label among the labels of all bands.
+    int offset;
+};
+
+int FindRoot(vector<int>& parent, int label) {
+    while (parent[label] != label) {
+        parent[label] = parent[parent[label]];
+        label = parent[label];
+    }
+    return label;
+}
+
+void UnionLabels(vector<int>& parent, const int& label_a, const int& label_b) {
+    int root_a = FindRoot(parent, label_a);
+    int root_b = FindRoot(parent, label_b);
+    if (root_a < root_b) {
+        parent[root_b] = root_a;
+    } else if (root_b < root_a) {
+        parent[root_a] = root_b;
+    }
+}
+
+// Labels the 8-connected components of the rows of the band, ignoring the
+// rows around it. labels is -1 for the background.
+void LabelBand(const Mat& binary_image, vector<int>& labels,
+        LabeledBand& band) {
+    const int cols = binary_image.cols;
+    for (int r = band.row_begin; r < band.row_end; r++) {
+        const uchar* row = binary_image.ptr<uchar>(r);
+        int* label_row = &labels[(size_t) r * cols];
+        const int* above = r > band.row_begin ? label_row - cols : NULL;
+        for (int c = 0; c < cols; c++) {
+            if (row[c] == 0) {
+                label_row[c] = -1;
+                continue;
+            }
+            int label = c > 0 ? label_row[c - 1] : -1;
+            if (above != NULL) {
+                for (int neighbor = max(0, c - 1);
+                        neighbor <= min(cols - 1, c + 1); neighbor++) {
+                    if (above[neighbor] < 0) {
+                        continue;
+                    }
+                    if (label < 0) {
+                        label = above[neighbor];
+                    } else if (above[neighbor] != label) {
+                        UnionLabels(band.parent, label, above[neighbor]);
+                    }
+                }
+            }
+            if (label < 0) {
+                label = band.parent.size();
+                band.parent.push_back(label);
+                band.num_pixels.push_back(0);
+            }
+            label_row[c] = label;
+            band.num_pixels[label]++;
+        }
+    }
+}
+
+// Splits rows into num_bands bands of nearly equal height.
+vector<LabeledBand> SplitIntoBands(const int& rows, const int& num_threads) {
+    int num_bands = max(1, min(num_threads, rows));
+    vector<LabeledBand> bands(num_bands);
+    for (int b = 0; b < num_bands; b++) {
+        bands[b].row_begin = (long) rows * b / num_bands;
+        bands[b].row_end = (long) rows * (b + 1) / num_bands;
+        bands[b].offset = 0;
+    }
+    return bands;
+}
+
+int ComputeConnectedComponentsParallel(const Mat& binary_image,
+        Mat& output_image, const int& num_threads) {
+    STAGE_TIMER("ComputeConnectedComponents");
+    const int cols = binary_image.cols;
+    vector<LabeledBand> bands = SplitIntoBands(binary_image.rows, num_threads);
+    vector<int> labels((size_t) binary_image.rows * cols);
+    vector<thread> threads;
+    for (auto& band : bands) {
+        threads.push_back(thread(LabelBand, cref(binary_image), ref(labels),
+                    ref(band)));
+    }
+    for (auto& worker : threads) {
+        worker.join();
+    }
+
+    // Gather the labels of all bands into one union-find, and merge the
+    // components that touch across each seam.
+    int num_labels = 0;
+    for (auto& band : bands) {
+        band.offset = num_labels;
+        num_labels += band.parent.size();
+    }
+    vector<int> parent(num_labels);
+    vector<int> num_pixels(num_labels);
+    for (const auto& band : bands) {
+        for (size_t label = 0; label < band.parent.size(); label++) {
+            parent[band.offset + label] = band.offset + band.parent[label];
+            num_pixels[band.offset + label] = band.num_pixels[label];
+        }
+    }
+    for (size_t b = 1; b < bands.size(); b++) {
+        const int* seam_row = &labels[(size_t) bands[b].row_begin * cols];
+        const int* above = seam_row - cols;
+        for (int c = 0; c < cols; c++) {
+            if (seam_row[c] < 0) {
+                continue;
+            }
+            for (int neighbor = max(0, c - 1);
+                    neighbor <= min(cols - 1, c + 1); neighbor++) {
+                if (above[neighbor] >= 0) {
+                    UnionLabels(parent, bands[b].offset + seam_row[c],
+                            bands[b - 1].offset + above[neighbor]);
+                }
+            }
+        }
+    }
+
+    // Labels are numbered in raster order across the bands, and each root is
+    // the first label of its component, so visiting the roots in order
+    // numbers the components the way the serial search finds them.
+    vector<int> component_pixels(num_labels, 0);
+    for (int label = 0; label < num_labels; label++) {
+        component_pixels[FindRoot(parent, label)] += num_pixels[label];
+    }
+    vector<uchar> component_labels(num_labels);
+    int current_component_label = 2;
+    for (int label = 0; label < num_labels; label++) {
+        int root = FindRoot(parent, label);
+        if (root != label) {
+            component_labels[label] = component_labels[root];
+        } else if (component_pixels[label] >= MIN_COMPONENT_AREA &&
+                current_component_label <= MAX_COMPONENT_LABEL) {
+            component_labels[label] = current_component_label++;
+        } else {
+            component_labels[label] = 1;
+        }
+    }
+
+    output_image.create(binary_image.rows, cols, CV_8UC1);
+    threads.clear();
+    for (const auto& band : bands) {
+        threads.push_back(thread([&labels, &component_labels, &output_image,
+                    &band, cols]() {
+            for (int r = band.row_begin; r < band.row_end; r++) {
+                const int* label_row = &labels[(size_t) r * cols];
+                uchar* output_row = output_image.ptr<uchar>(r);
+                for (int c = 0; c < cols; c++) {
+                    output_row[c] = label_row[c] < 0 ? 1 :
+                        component_labels[band.offset + label_row[c]];
+                }
+            }
+        }));
+    }
+    for (auto& worker : threads) {
+        worker.join();
+    }
+    return current_component_label - 1;
+}
+
+vector<RegionMetrics*> ComputeRegionMetricsParallel(
+        const Mat& components_image, const int& num_components,
+        const int& num_threads) {
+    STAGE_TIMER("ComputeRegionMetrics");
+    vector<LabeledBand> bands =
+        SplitIntoBands(components_image.rows, num_threads);
+    vector<vector<RegionMoments> > band_moments(bands.size(),
+            vector<RegionMoments>(num_components));
+    vector<thread> threads;
+    for (size_t b = 0; b < bands.size(); b++) {
+        threads.push_back(thread(AccumulateRegionMoments,
+                    cref(components_image), bands[b].row_begin,
+                    bands[b].row_end, ref(band_moments[b])));
+    }
+    for (auto& worker : threads) {
+        worker.join();
+    }
+    for (size_t b = 1; b < bands.size(); b++) {
+        for (int i = 0; i < num_components; i++) {
+            band_moments[0][i].Add(band_moments[b][i]);
+        }
+    }
+    return ComputeRegionMetricsFromMoments(band_moments[0]);
+}
+
+vector<ComponentStats> ComputeComponentStatsParallel(
+        const Mat& components_image, const int& num_components,
+        const int& num_threads) {
+    STAGE_TIMER("ComputeComponentStats");
+    vector<LabeledBand> bands =
+        SplitIntoBands(components_image.rows, num_threads);
+    vector<vector<ComponentStats> > band_stats(bands.size(),
+            vector<ComponentStats>(num_components));
+    vector<thread> threads;
+    for (size_t b = 0; b < bands.size(); b++) {
+        threads.push_back(thread(AccumulateComponentStats,
+                    cref(components_image), bands[b].row_begin,
+                    bands[b].row_end, ref(band_stats[b])));
+    }
+    for (auto& worker : threads) {
+        worker.join();
+    }
+    for (size_t b = 1; b < bands.size(); b++) {
+        for (int i = 0; i < num_components; i++) {
+            band_stats[0][i].Add(band_stats[b][i]);
+        }
+    }
+    return band_stats[0];
+}
+
+}
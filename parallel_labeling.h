@@ -0,0 +1,36 @@
+#ifndef PARALLEL_LABELING_H
+#define PARALLEL_LABELING_H
+
+#include <vector>
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include "util.h"
+
+using namespace cv;
+using namespace std;
+
+namespace nba_vision {
+
+// Same result as ComputeConnectedComponents, computed on num_threads
+// horizontal bands of the image. Each band is labeled on its own thread,
+// then the components that cross the seams between bands are merged with a
+// union-find over the boundary rows.
+int ComputeConnectedComponentsParallel(const Mat& binary_image,
+        Mat& output_image, const int& num_threads);
+
+// Same result as ComputeRegionMetrics. The moments of each band are summed
+// on its own thread and combined at the end.
+vector<RegionMetrics*> ComputeRegionMetricsParallel(
+        const Mat& components_image, const int& num_components,
+        const int& num_threads);
+
+// Same result as ComputeComponentStats, combined from the stats of each
+// band.
+vector<ComponentStats> ComputeComponentStatsParallel(
+        const Mat& components_image, const int& num_components,
+        const int& num_threads);
+
+}
+
+#endif  // PARALLEL_LABELING_H
@@ -0,0 +1,409 @@
+// Python bindings for the tracking pipeline, built as the nba_vision module
+// with -DNBA_VISION_PYTHON=ON. Frames are uint8 NumPy arrays of shape
+// (rows, cols, 3) in BGR order, as cv2 and most decoders return them, and
+// are wrapped as Mats over the same memory rather than copied. The tracker
+// draws on the frames it is given, so they must be writeable. Results come
+// back as NumPy structured arrays. The GIL is released while frames are
+// processed, so several trackers can run on Python threads; one tracker must
+// not be used from two threads at once.
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include "bball_tracker.h"
+#include "multiple_kalman_filter.h"
+#include "optical_flow.h"
+#include "parallel_labeling.h"
+#include "util.h"
+
+namespace py = pybind11;
+
+namespace nba_vision {
+
+// TrackResult in plain fields, so that it can be a NumPy record.
+struct TrackRecord {
+    bool found_ball;
+    float ball_x;
+    float ball_y;
+    float prediction_x;
+    float prediction_y;
+    bool found_net;
+    int32_t net_x;
+    int32_t net_y;
+    int32_t net_width;
+    int32_t net_height;
+    int32_t state;
+    int32_t event;
+};
+
+static TrackRecord ToRecord(const TrackResult& result) {
+    TrackRecord record;
+    record.found_ball = result.found_ball;
+    record.ball_x = result.ball_location.x;
+    record.ball_y = result.ball_location.y;
+    record.prediction_x = result.prediction.x;
+    record.prediction_y = result.prediction.y;
+    record.found_net = result.found_net;
+    record.net_x = result.net_rect.x;
+    record.net_y = result.net_rect.y;
+    record.net_width = result.net_rect.width;
+    record.net_height = result.net_rect.height;
+    record.state = result.state;
+    record.event = result.event;
+    return record;
+}
+
+// Wraps image number index of array as a Mat over the same memory. The image
+// is the last two dimensions of array when channels is 1, and the last three
+// otherwise; the dimensions before them, if any, number the images. Rows may
+// be padded, e.g. for a crop of a larger array, but the pixels of a row must
+// be contiguous.
+static Mat ImageView(const py::array& array, const int& channels,
+        const bool& writeable, const py::ssize_t& index = 0) {
+    const int image_dims = channels == 1 ? 2 : 3;
+    const int batch_dims = array.ndim() - image_dims;
+    if (array.dtype().kind() != 'u' || array.itemsize() != 1) {
+        throw py::type_error("expected a uint8 array");
+    }
+    if (batch_dims < 0 || batch_dims > 1 ||
+            (channels > 1 && array.shape(array.ndim() - 1) != channels)) {
+        throw py::value_error(channels == 1 ?
+                "expected an array of shape (rows, cols)" :
+                "expected an array of shape (rows, cols, 3)");
+    }
+    const int row_axis = batch_dims;
+    const py::ssize_t rows = array.shape(row_axis);
+    const py::ssize_t cols = array.shape(row_axis + 1);
+    if ((channels > 1 && array.strides(row_axis + 2) != 1) ||
+            array.strides(row_axis + 1) != channels ||
+            array.strides(row_axis) < cols * channels) {
+        throw py::value_error("the pixels of each row must be contiguous");
+    }
+    if (writeable && !array.writeable()) {
+        throw py::value_error("the array must be writeable");
+    }
+    uchar* data = (uchar*) array.data();
+    if (batch_dims > 0) {
+        data += index * array.strides(0);
+    }
+    return Mat(rows, cols, CV_8UC(channels), data, array.strides(row_axis));
+}
+
+// A new (rows, cols) uint8 array and a Mat over it. The functions below
+// write their output images straight into the array.
+static py::array_t<uint8_t> NewImage(const int& rows, const int& cols,
+        Mat& view) {
+    py::array_t<uint8_t> array({rows, cols});
+    view = Mat(rows, cols, CV_8UC1, array.mutable_data());
+    return array;
+}
+
+// Copies output into array if the callee had to reallocate it.
+static void CopyIfMoved(const Mat& output, const Mat& view) {
+    if (output.data != view.data) {
+        output.copyTo(view);
+    }
+}
+
+template <typename T>
+static py::array_t<T> ToRecords(const vector<T*>& items) {
+    py::array_t<T> records(items.size());
+    T* output = records.mutable_data();
+    for (size_t i = 0; i < items.size(); i++) {
+        output[i] = *items[i];
+        delete items[i];
+    }
+    return records;
+}
+
+// Labels the components of a binary image, see ComputeConnectedComponents.
+// Returns the number of components and the labels.
+static py::tuple ConnectedComponents(const py::array& binary_image,
+        const int& num_threads) {
+    Mat binary = ImageView(binary_image, 1, false);
+    Mat view;
+    py::array_t<uint8_t> labels = NewImage(binary.rows, binary.cols, view);
+    Mat output = view;
+    int num_components;
+    {
+        py::gil_scoped_release release;
+        num_components = num_threads > 1 ?
+            ComputeConnectedComponentsParallel(binary, output, num_threads) :
+            ComputeConnectedComponents(binary, output);
+    }
+    CopyIfMoved(output, view);
+    return py::make_tuple(num_components, labels);
+}
+
+// Labels start at 2, and the functions below index their output by label - 2,
+// so a count that doesn't cover every label would write past it.
+static void CheckNumComponents(const Mat& components,
+        const int& num_components) {
+    double max_label;
+    minMaxLoc(components, NULL, &max_label);
+    if (num_components < 0 || max_label - 1 > num_components) {
+        throw py::value_error(
+                "num_components must be at least the largest label minus 1");
+    }
+}
+
+static py::array_t<RegionMetrics> RegionMetricsOf(
+        const py::array& components_image, const int& num_components,
+        const int& num_threads) {
+    Mat components = ImageView(components_image, 1, false);
+    CheckNumComponents(components, num_components);
+    vector<RegionMetrics*> metrics;
+    {
+        py::gil_scoped_release release;
+        metrics = num_threads > 1 ?
+            ComputeRegionMetricsParallel(components, num_components,
+                    num_threads) :
+            ComputeRegionMetrics(components, num_components);
+    }
+    return ToRecords(metrics);
+}
+
+static py::array_t<ComponentStats> ComponentStatsOf(
+        const py::array& components_image, const int& num_components,
+        const int& num_threads) {
+    Mat components = ImageView(components_image, 1, false);
+    CheckNumComponents(components, num_components);
+    vector<ComponentStats> stats;
+    {
+        py::gil_scoped_release release;
+        stats = num_threads > 1 ?
+            ComputeComponentStatsParallel(components, num_components,
+                    num_threads) :
+            ComputeComponentStats(components, num_components);
+    }
+    py::array_t<ComponentStats> records(stats.size());
+    copy(stats.begin(), stats.end(), records.mutable_data());
+    return records;
+}
+
+static py::array_t<uint8_t> ComponentsToBinary(
+        const py::array& components_image) {
+    Mat components = ImageView(components_image, 1, false);
+    Mat view;
+    py::array_t<uint8_t> binary = NewImage(components.rows, components.cols,
+            view);
+    Mat output = view;
+    {
+        py::gil_scoped_release release;
+        ConvertComponentsImageToBinary(components, output);
+    }
+    CopyIfMoved(output, view);
+    return binary;
+}
+
+// Tracks one frame and returns its record.
+static py::object TrackFrame(BballTracker& tracker, const py::array& frame) {
+    Mat image = ImageView(frame, 3, true);
+    {
+        py::gil_scoped_release release;
+        tracker.TrackBall(image);
+        tracker.DrawResult(image);
+    }
+    py::array_t<TrackRecord> records(1);
+    records.mutable_data()[0] = ToRecord(tracker.GetLastResult());
+    return records[py::int_(0)];
+}
+
+// Tracks a (frames, rows, cols, 3) batch in order without taking the GIL
+// between frames, and returns a record per frame.
+static py::array_t<TrackRecord> TrackFrames(BballTracker& tracker,
+        const py::array& frames) {
+    if (frames.ndim() != 4) {
+        throw py::value_error(
+                "expected an array of shape (frames, rows, cols, 3)");
+    }
+    const py::ssize_t num_frames = frames.shape(0);
+    vector<Mat> images;
+    for (py::ssize_t i = 0; i < num_frames; i++) {
+        images.push_back(ImageView(frames, 3, true, i));
+    }
+    py::array_t<TrackRecord> records(num_frames);
+    TrackRecord* output = records.mutable_data();
+    {
+        py::gil_scoped_release release;
+        for (py::ssize_t i = 0; i < num_frames; i++) {
+            tracker.TrackBall(images[i]);
+            tracker.DrawResult(images[i]);
+            output[i] = ToRecord(tracker.GetLastResult());
+        }
+    }
+    return records;
+}
+
+static MultipleKalmanFilter* NewMultipleKalmanFilter(
+        const vector<pair<int, int> >& object_locations,
+        const string& motion_model) {
+    MotionModelType type;
+    if (!ParseMotionModelType(motion_model, type)) {
+        throw py::value_error("motion_model must be cv, gravity or imm");
+    }
+    return new MultipleKalmanFilter(object_locations.size(),
+            &object_locations, type);
+}
+
+// Returns the prediction for the next frame as (x, y).
+static pair<float, float> CorrectAndPredict(MultipleKalmanFilter& mkf,
+        const int& object_idx, const float& x, const float& y) {
+    Mat prediction = mkf.CorrectAndPredictForObject(object_idx,
+            (Mat_<float>(2, 1) << x, y));
+    return make_pair(prediction.at<float>(0), prediction.at<float>(1));
+}
+
+// The covariance of the next measurement of an object as a (2, 2) float32
+// array, or None for an unknown object.
+static py::object InnovationCov(const MultipleKalmanFilter& mkf,
+        const int& object_idx) {
+    Matx22f cov;
+    if (!mkf.GetInnovationCov(object_idx, cov)) {
+        return py::none();
+    }
+    py::array_t<float> output({2, 2});
+    copy(cov.val, cov.val + 4, output.mutable_data());
+    return output;
+}
+
+// The measurements of an object as a (n, 2) float32 array, oldest first, or
+// None for an unknown object.
+static py::object History(const MultipleKalmanFilter& mkf,
+        const int& object_idx) {
+    const ObjectHistory* history = mkf.GetHistory(object_idx);
+    if (history == NULL) {
+        return py::none();
+    }
+    py::array_t<float> points({history->Size(), 2});
+    float* output = points.mutable_data();
+    for (int i = 0; i < history->Size(); i++) {
+        output[2 * i] = (*history)[i].x;
+        output[2 * i + 1] = (*history)[i].y;
+    }
+    return points;
+}
+
+static void ComputeOpticalFlow(OpticalFlow& opf, const py::array& frame) {
+    Mat image = ImageView(frame, 3, true);
+    py::gil_scoped_release release;
+    opf.computeOpticalFlow(image, &image);
+}
+
+static pair<float, float> CameraMotion(const OpticalFlow& opf) {
+    Point2f motion = opf.getCameraMotion();
+    return make_pair(motion.x, motion.y);
+}
+
+static void SetCameraMotion(BballTracker& tracker, const float& x,
+        const float& y) {
+    tracker.SetCameraMotion(Point2f(x, y));
+}
+
+static py::array_t<uint8_t> ColorSegmentation(const BballTracker& tracker,
+        const py::array& frame) {
+    Mat image = ImageView(frame, 3, false);
+    Mat view;
+    py::array_t<uint8_t> binary = NewImage(image.rows, image.cols, view);
+    Mat output = view;
+    {
+        py::gil_scoped_release release;
+        tracker.ColorSegmentation(image, output);
+    }
+    CopyIfMoved(output, view);
+    return binary;
+}
+
+}
+
+using namespace nba_vision;
+
+PYBIND11_MODULE(nba_vision, m) {
+    m.doc() = "Basketball tracking on broadcast footage.";
+
+    PYBIND11_NUMPY_DTYPE(TrackRecord, found_ball, ball_x, ball_y,
+            prediction_x, prediction_y, found_net, net_x, net_y, net_width,
+            net_height, state, event);
+    PYBIND11_NUMPY_DTYPE(RegionMetrics, component_index, area,
+            num_boundary_pixels, area_perimeter_ratio, avg_x, avg_y,
+            x_second_moment, y_second_moment, cross_second_moment,
+            orientation, circularity, compactness);
+    PYBIND11_NUMPY_DTYPE(ComponentStats, component_index, area, sum_x, sum_y,
+            min_x, min_y, max_x, max_y);
+
+    m.attr("DEFAULT") = DEFAULT;
+    m.attr("SHOT") = SHOT;
+    m.attr("NO_EVENT") = NO_EVENT;
+    m.attr("SHOT_TAKEN") = SHOT_TAKEN;
+    m.attr("SHOT_MADE") = SHOT_MADE;
+    m.attr("SHOT_MISSED") = SHOT_MISSED;
+    m.attr("track_record_dtype") = py::dtype::of<TrackRecord>();
+
+    py::class_<MultipleKalmanFilter>(m, "MultipleKalmanFilter")
+        .def(py::init(&NewMultipleKalmanFilter),
+                py::arg("object_locations") = vector<pair<int, int> >(),
+                py::arg("motion_model") = "cv")
+        .def("correct_and_predict", &CorrectAndPredict,
+                py::arg("object_idx"), py::arg("x"), py::arg("y"))
+        .def("innovation_cov", &InnovationCov, py::arg("object_idx"))
+        .def("history", &History, py::arg("object_idx"));
+
+    // The tracker keeps a pointer to its MultipleKalmanFilter, which is kept
+    // alive as long as the tracker.
+    py::class_<BballTracker>(m, "BballTracker")
+        .def(py::init<MultipleKalmanFilter*, bool>(), py::arg("mkf"),
+                py::arg("debug") = false, py::keep_alive<1, 2>())
+        .def(py::init<MultipleKalmanFilter*, const pair<int, int>&, bool>(),
+                py::arg("mkf"), py::arg("init_loc"), py::arg("debug") = false,
+                py::keep_alive<1, 2>())
+        .def("track_ball", &TrackFrame, py::arg("frame"))
+        .def("track_frames", &TrackFrames, py::arg("frames"))
+        .def("last_result", [](const BballTracker& tracker) {
+                    py::array_t<TrackRecord> records(1);
+                    records.mutable_data()[0] =
+                        ToRecord(tracker.GetLastResult());
+                    return py::object(records[py::int_(0)]);
+                })
+        .def("color_segmentation", &ColorSegmentation, py::arg("frame"))
+        .def("load_color_model", &BballTracker::LoadColorModel,
+                py::arg("filename"))
+        .def("set_adaptive_color", &BballTracker::SetAdaptiveColor,
+                py::arg("adaptive_color"))
+        .def("set_local_net_search", &BballTracker::SetLocalNetSearch,
+                py::arg("local_net_search"))
+        .def("set_ball_search_radius", &BballTracker::SetBallSearchRadius,
+                py::arg("ball_search_radius"))
+        .def("set_motion_gating", &BballTracker::SetMotionGating,
+                py::arg("motion_gating"))
+        .def("set_camera_motion", &SetCameraMotion, py::arg("x"),
+                py::arg("y"))
+        .def("set_labeling_threads", &BballTracker::SetLabelingThreads,
+                py::arg("labeling_threads"))
+        .def_static("set_asset_cache", &BballTracker::SetAssetCache,
+                py::arg("filename"));
+
+    py::class_<OpticalFlow>(m, "OpticalFlow")
+        .def(py::init<bool>(), py::arg("debug") = false)
+        .def("compute", &ComputeOpticalFlow, py::arg("frame"))
+        .def("camera_motion", &CameraMotion);
+
+    m.def("connected_components", &ConnectedComponents,
+            py::arg("binary_image"), py::arg("num_threads") = 1,
+            "Returns (num_components, labels) for a binary image.");
+    m.def("region_metrics", &RegionMetricsOf, py::arg("components_image"),
+            py::arg("num_components"), py::arg("num_threads") = 1);
+    m.def("component_stats", &ComponentStatsOf,
+            py::arg("components_image"), py::arg("num_components"),
+            py::arg("num_threads") = 1);
+    m.def("components_to_binary", &ComponentsToBinary,
+            py::arg("components_image"));
+}
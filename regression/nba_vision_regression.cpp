@@ -0,0 +1,557 @@
+// Records the per-frame output of BballTracker on a clip as a golden CSV file,
+// and checks later builds against it, so that rewrites of the segmentation,
+// labeling or net matching stages can't change the results unnoticed.
+//
+// usage: nba_vision_regression locate <clip>
+//        nba_vision_regression record <clip> <init_x> <init_y> <golden.csv>
+//        nba_vision_regression check <clip> <golden.csv>
+//            [--ball-tolerance <px>] [--net-tolerance <px>]
+//            [--event-slack <frames>] [--max-ball-mismatches <n>]
+//        nba_vision_regression labeling <clip> <num_threads>
+//        nba_vision_regression crossing
+//
+// locate prints the initial ball location the tracker finds on its own in the
+// first frame of the clip, so that goldens can be recorded without a click
+// (see record_goldens.sh). check exits with a nonzero status if the outputs
+// differ by more than the tolerances. labeling needs no golden file: it
+// labels every frame of the clip with one and with num_threads threads and
+// exits with a nonzero status if the labels, metrics or stats differ at all.
+// crossing checks that MultiTargetTracker keeps two targets apart when their
+// paths cross.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "opencv2/highgui/highgui.hpp"
+
+#include "bball_tracker.h"
+#include "multi_target_tracker.h"
+#include "multiple_kalman_filter.h"
+#include "parallel_labeling.h"
+#include "util.h"
+
+using namespace cv;
+using namespace std;
+using namespace nba_vision;
+
+const char kHeader[] = "frame,found_ball,ball_x,ball_y,found_net,"
+    "net_x,net_y,net_width,net_height,state,event";
+const double kDefaultBallTolerance = 2.0;
+const int kDefaultNetTolerance = 2;
+const int kDefaultEventSlack = 1;
+const int kDefaultMaxBallMismatches = 0;
+// The crossing targets move this far per frame, towards each other along x,
+// and meet halfway through the frames.
+const float kCrossingSpeedX = 4;
+const float kCrossingSpeedY = 3;
+const int kCrossingFrames = 50;
+const double kCrossingGateDistance = 40;
+// Closer than this, the two detections are within the noise of each other
+// and either assignment is right.
+const double kCrossingAmbiguousDistance = 4;
+
+// The output of the tracker for one frame.
+struct FrameRecord {
+    int frame;
+    TrackResult result;
+};
+
+struct Tolerances {
+    // Distance in pixels between the ball locations.
+    double ball;
+    // Difference in pixels of each coordinate of the net rect.
+    int net;
+    // Number of frames an event may move by.
+    int event_slack;
+    // Number of frames whose ball may be off by more than the tolerance.
+    int max_ball_mismatches;
+};
+
+// Runs the tracker over every frame of the clip.
+bool RunTracker(const string& clip, const int& init_x, const int& init_y,
+        vector<FrameRecord>& records) {
+    VideoCapture video_capture(clip);
+    if (!video_capture.isOpened()) {
+        cout << "Cannot open the video file: " << clip << endl;
+        return false;
+    }
+    MultipleKalmanFilter mkf(0, NULL);
+    BballTracker tracker(&mkf, pair<int, int>(init_x, init_y));
+    Mat frame;
+    for (int i = 0; video_capture.read(frame); i++) {
+        tracker.TrackBall(frame);
+        FrameRecord record;
+        record.frame = i;
+        record.result = tracker.GetLastResult();
+        records.push_back(record);
+    }
+    return !records.empty();
+}
+
+bool WriteGolden(const string& filename, const string& clip,
+        const int& init_x, const int& init_y,
+        const vector<FrameRecord>& records) {
+    ofstream output(filename.c_str());
+    if (!output.is_open()) {
+        cout << "Cannot open " << filename << " for writing." << endl;
+        return false;
+    }
+    // The first line records how the golden output was produced.
+    output << "# " << clip << "," << init_x << "," << init_y << endl;
+    output << kHeader << endl;
+    char line[256];
+    for (const auto& record : records) {
+        const TrackResult& result = record.result;
+        snprintf(line, sizeof(line), "%d,%d,%.3f,%.3f,%d,%d,%d,%d,%d,%d,%d",
+                record.frame, result.found_ball,
+                result.ball_location.x, result.ball_location.y,
+                result.found_net, result.net_rect.x, result.net_rect.y,
+                result.net_rect.width, result.net_rect.height,
+                result.state, result.event);
+        output << line << endl;
+    }
+    return true;
+}
+
+bool ReadGolden(const string& filename, int& init_x, int& init_y,
+        vector<FrameRecord>& records) {
+    ifstream input(filename.c_str());
+    if (!input.is_open()) {
+        cout << "Cannot open golden file: " << filename <<
+            " (record it with regression/record_goldens.sh)" << endl;
+        return false;
+    }
+    string line;
+    getline(input, line);
+    size_t comma = line.find(',');
+    if (line.compare(0, 2, "# ") != 0 || comma == string::npos ||
+            sscanf(line.c_str() + comma + 1, "%d,%d", &init_x, &init_y) != 2) {
+        cout << "Missing initial location in " << filename << endl;
+        return false;
+    }
+    getline(input, line);
+    if (line != kHeader) {
+        cout << "Unexpected columns in " << filename << ": " << line << endl;
+        return false;
+    }
+    while (getline(input, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        FrameRecord record;
+        TrackResult& result = record.result;
+        int found_ball, found_net;
+        if (sscanf(line.c_str(), "%d,%d,%f,%f,%d,%d,%d,%d,%d,%d,%d",
+                    &record.frame, &found_ball,
+                    &result.ball_location.x, &result.ball_location.y,
+                    &found_net, &result.net_rect.x, &result.net_rect.y,
+                    &result.net_rect.width, &result.net_rect.height,
+                    &result.state, &result.event) != 11) {
+            cout << "Malformed line in " << filename << ": " << line << endl;
+            return false;
+        }
+        result.found_ball = found_ball != 0;
+        result.found_net = found_net != 0;
+        records.push_back(record);
+    }
+    return true;
+}
+
+// Returns true if an event of the same type happens in records within slack
+// frames of frame.
+bool HasEventNear(const vector<FrameRecord>& records, const int& frame,
+        const int& event, const int& slack) {
+    for (int i = max(0, frame - slack);
+            i <= frame + slack && i < (int) records.size(); i++) {
+        if (records[i].result.event == event) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns true if records has any event within slack frames of frame.
+bool IsNearEvent(const vector<FrameRecord>& records, const int& frame,
+        const int& slack) {
+    for (int i = max(0, frame - slack);
+            i <= frame + slack && i < (int) records.size(); i++) {
+        if (records[i].result.event != NO_EVENT) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Compares the outputs frame by frame and prints every difference beyond the
+// tolerances. Returns the number of failures.
+int CompareRecords(const vector<FrameRecord>& golden,
+        const vector<FrameRecord>& actual, const Tolerances& tolerances) {
+    int failures = 0;
+    if (golden.size() != actual.size()) {
+        cout << "Frame count differs: expected " << golden.size() <<
+            ", got " << actual.size() << endl;
+        failures++;
+    }
+    int num_frames = min(golden.size(), actual.size());
+    int ball_mismatches = 0;
+    for (int i = 0; i < num_frames; i++) {
+        const TrackResult& expected = golden[i].result;
+        const TrackResult& result = actual[i].result;
+        double ball_distance = ComputeDistance(
+                expected.ball_location.x, expected.ball_location.y,
+                result.ball_location.x, result.ball_location.y);
+        if (expected.found_ball != result.found_ball ||
+                ball_distance > tolerances.ball) {
+            ball_mismatches++;
+            cout << "Frame " << i << ": ball expected at " <<
+                expected.ball_location << (expected.found_ball ? "" : " (lost)") <<
+                ", got " << result.ball_location <<
+                (result.found_ball ? "" : " (lost)") << endl;
+        }
+        if (expected.found_net != result.found_net ||
+                abs(expected.net_rect.x - result.net_rect.x) > tolerances.net ||
+                abs(expected.net_rect.y - result.net_rect.y) > tolerances.net ||
+                abs(expected.net_rect.width - result.net_rect.width) >
+                    tolerances.net ||
+                abs(expected.net_rect.height - result.net_rect.height) >
+                    tolerances.net) {
+            failures++;
+            cout << "Frame " << i << ": net expected at " << expected.net_rect <<
+                ", got " << result.net_rect << endl;
+        }
+        // The state follows the events, so it may only differ while an event
+        // is allowed to be early or late.
+        if (expected.state != result.state &&
+                !IsNearEvent(golden, i, tolerances.event_slack) &&
+                !IsNearEvent(actual, i, tolerances.event_slack)) {
+            failures++;
+            cout << "Frame " << i << ": state expected " << expected.state <<
+                ", got " << result.state << endl;
+        }
+        if (expected.event != NO_EVENT &&
+                !HasEventNear(actual, i, expected.event,
+                    tolerances.event_slack)) {
+            failures++;
+            cout << "Frame " << i << ": missing event " << expected.event << endl;
+        }
+        if (result.event != NO_EVENT &&
+                !HasEventNear(golden, i, result.event,
+                    tolerances.event_slack)) {
+            failures++;
+            cout << "Frame " << i << ": unexpected event " << result.event << endl;
+        }
+    }
+    if (ball_mismatches > tolerances.max_ball_mismatches) {
+        cout << ball_mismatches << " frames with the ball off, at most " <<
+            tolerances.max_ball_mismatches << " allowed." << endl;
+        failures++;
+    }
+    return failures;
+}
+
+// Returns true if the metrics are exactly the same. Both come from the same
+// integer moments, so there is no rounding to allow for.
+bool SameRegionMetrics(const RegionMetrics& a, const RegionMetrics& b) {
+    return a.component_index == b.component_index && a.area == b.area &&
+        a.num_boundary_pixels == b.num_boundary_pixels &&
+        a.area_perimeter_ratio == b.area_perimeter_ratio &&
+        a.avg_x == b.avg_x && a.avg_y == b.avg_y &&
+        a.x_second_moment == b.x_second_moment &&
+        a.y_second_moment == b.y_second_moment &&
+        a.cross_second_moment == b.cross_second_moment &&
+        a.orientation == b.orientation && a.circularity == b.circularity &&
+        a.compactness == b.compactness;
+}
+
+void FreeRegionMetrics(vector<RegionMetrics*>& region_metrics_list) {
+    for (auto region_metrics : region_metrics_list) {
+        delete region_metrics;
+    }
+    region_metrics_list.clear();
+}
+
+// Compares the labeling of one frame on one and on num_threads threads and
+// prints every difference. Returns the number of failures.
+int CompareLabeling(const Mat& binary_image, const int& num_threads,
+        const int& frame_idx) {
+    Mat serial_components, parallel_components;
+    int serial_num = ComputeConnectedComponents(binary_image,
+            serial_components);
+    int parallel_num = ComputeConnectedComponentsParallel(binary_image,
+            parallel_components, num_threads);
+    if (serial_num != parallel_num) {
+        cout << "Frame " << frame_idx << ": " << serial_num <<
+            " components on one thread, " << parallel_num << " on " <<
+            num_threads << endl;
+        return 1;
+    }
+    int num_different = 0;
+    for (int r = 0; r < serial_components.rows; r++) {
+        const uchar* serial_label = serial_components.ptr<uchar>(r);
+        const uchar* parallel_label = parallel_components.ptr<uchar>(r);
+        for (int c = 0; c < serial_components.cols; c++) {
+            num_different += serial_label[c] != parallel_label[c];
+        }
+    }
+    if (num_different > 0) {
+        cout << "Frame " << frame_idx << ": " << num_different <<
+            " pixels labeled differently" << endl;
+        return 1;
+    }
+    int failures = 0;
+    vector<RegionMetrics*> serial_metrics =
+        ComputeRegionMetrics(serial_components, serial_num);
+    vector<RegionMetrics*> parallel_metrics =
+        ComputeRegionMetricsParallel(serial_components, serial_num,
+                num_threads);
+    if (serial_metrics.size() != parallel_metrics.size()) {
+        cout << "Frame " << frame_idx << ": " << serial_metrics.size() <<
+            " region metrics on one thread, " << parallel_metrics.size() <<
+            " on " << num_threads << endl;
+        failures++;
+    } else {
+        for (size_t i = 0; i < serial_metrics.size(); i++) {
+            if (!SameRegionMetrics(*serial_metrics[i], *parallel_metrics[i])) {
+                cout << "Frame " << frame_idx << ": metrics of component " <<
+                    serial_metrics[i]->component_index << " differ" << endl;
+                failures++;
+            }
+        }
+    }
+    FreeRegionMetrics(serial_metrics);
+    FreeRegionMetrics(parallel_metrics);
+    vector<ComponentStats> serial_stats =
+        ComputeComponentStats(serial_components, serial_num);
+    vector<ComponentStats> parallel_stats =
+        ComputeComponentStatsParallel(serial_components, serial_num,
+                num_threads);
+    for (size_t i = 0; i < serial_stats.size() && i < parallel_stats.size();
+            i++) {
+        const ComponentStats& a = serial_stats[i];
+        const ComponentStats& b = parallel_stats[i];
+        if (a.component_index != b.component_index || a.area != b.area ||
+                a.sum_x != b.sum_x || a.sum_y != b.sum_y ||
+                a.min_x != b.min_x || a.min_y != b.min_y ||
+                a.max_x != b.max_x || a.max_y != b.max_y) {
+            cout << "Frame " << frame_idx << ": stats of component " <<
+                a.component_index << " differ" << endl;
+            failures++;
+        }
+    }
+    if (serial_stats.size() != parallel_stats.size()) {
+        cout << "Frame " << frame_idx << ": " << serial_stats.size() <<
+            " component stats on one thread, " << parallel_stats.size() <<
+            " on " << num_threads << endl;
+        failures++;
+    }
+    return failures;
+}
+
+int Labeling(int argc, char* argv[]) {
+    if (argc != 4 || atoi(argv[3]) < 2) {
+        cout << "usage: " << argv[0] << " labeling <clip> <num_threads>" <<
+            " (at least 2 threads)" << endl;
+        return -1;
+    }
+    int num_threads = atoi(argv[3]);
+    VideoCapture video_capture(argv[2]);
+    if (!video_capture.isOpened()) {
+        cout << "Cannot open the video file: " << argv[2] << endl;
+        return -1;
+    }
+    // Only the color segmentation of the tracker is used.
+    MultipleKalmanFilter mkf(0, NULL);
+    BballTracker tracker(&mkf);
+    Mat frame, binary_image;
+    int num_frames = 0;
+    int failures = 0;
+    for (; video_capture.read(frame); num_frames++) {
+        tracker.ColorSegmentation(frame, binary_image);
+        failures += CompareLabeling(binary_image, num_threads, num_frames);
+    }
+    if (num_frames == 0) {
+        cout << "No frames in " << argv[2] << endl;
+        return -1;
+    }
+    if (failures > 0) {
+        cout << "FAILED: " << failures << " differences between 1 and " <<
+            num_threads << " threads" << endl;
+        return 1;
+    }
+    cout << "PASSED: " << num_frames << " frames labeled the same on 1 and " <<
+        num_threads << " threads" << endl;
+    return 0;
+}
+
+// Two targets cross in an X, each detected in every frame with a little
+// noise. Every track has to stay matched to the detections of its own
+// target, except in the frames where the detections can't be told apart.
+int Crossing(int argc, char* argv[]) {
+    if (argc != 2) {
+        cout << "usage: " << argv[0] << " crossing" << endl;
+        return -1;
+    }
+    const Point2f start[2] = {Point2f(100, 100),
+        Point2f(100 + kCrossingSpeedX * kCrossingFrames, 100)};
+    const Point2f velocity[2] = {Point2f(kCrossingSpeedX, kCrossingSpeedY),
+        Point2f(-kCrossingSpeedX, kCrossingSpeedY)};
+    MultiTargetTracker tracker(8, kCrossingGateDistance);
+    int ids[2];
+    for (int i = 0; i < 2; i++) {
+        ids[i] = tracker.AddTrack(start[i].x, start[i].y);
+    }
+    int failures = 0;
+    for (int frame = 0; frame < kCrossingFrames; frame++) {
+        // Deterministic noise of up to half a pixel.
+        float noise = ((frame * 7) % 5 - 2) * 0.25f;
+        vector<Point2f> detections;
+        for (int i = 0; i < 2; i++) {
+            detections.push_back(Point2f(
+                        start[i].x + velocity[i].x * frame + noise,
+                        start[i].y + velocity[i].y * frame - noise));
+            noise = -noise;
+        }
+        tracker.Update(detections);
+        if (tracker.GetTracks().size() != 2) {
+            cout << "Frame " << frame << ": " << tracker.GetTracks().size() <<
+                " tracks instead of 2" << endl;
+            failures++;
+        }
+        bool ambiguous = ComputeDistance(detections[0].x, detections[0].y,
+                detections[1].x, detections[1].y) < kCrossingAmbiguousDistance;
+        for (int i = 0; i < 2; i++) {
+            const Track* track = tracker.FindTrack(ids[i]);
+            if (track == NULL) {
+                cout << "Frame " << frame << ": track " << ids[i] <<
+                    " was dropped" << endl;
+                failures++;
+            } else if (track->detection_idx != i && !ambiguous) {
+                cout << "Frame " << frame << ": track " << ids[i] <<
+                    " matched detection " << track->detection_idx <<
+                    " instead of " << i << endl;
+                failures++;
+            }
+        }
+    }
+    if (failures > 0) {
+        cout << "FAILED: " << failures << " errors while the tracks crossed" <<
+            endl;
+        return 1;
+    }
+    cout << "PASSED: both tracks kept their targets over " <<
+        kCrossingFrames << " frames" << endl;
+    return 0;
+}
+
+int Locate(int argc, char* argv[]) {
+    if (argc != 3) {
+        cout << "usage: " << argv[0] << " locate <clip>" << endl;
+        return -1;
+    }
+    VideoCapture video_capture(argv[2]);
+    Mat frame;
+    if (!video_capture.isOpened() || !video_capture.read(frame)) {
+        cout << "Cannot read the first frame of " << argv[2] << endl;
+        return -1;
+    }
+    MultipleKalmanFilter mkf(0, NULL);
+    BballTracker tracker(&mkf);
+    tracker.TrackBall(frame);
+    const TrackResult& result = tracker.GetLastResult();
+    if (!result.found_ball) {
+        cout << "No ball colored region in the first frame of " << argv[2] <<
+            endl;
+        return -1;
+    }
+    cout << lround(result.ball_location.x) << " " <<
+        lround(result.ball_location.y) << endl;
+    return 0;
+}
+
+int Record(int argc, char* argv[]) {
+    if (argc != 6) {
+        cout << "usage: " << argv[0] <<
+            " record <clip> <init_x> <init_y> <golden.csv>" << endl;
+        return -1;
+    }
+    string clip = argv[2];
+    int init_x = atoi(argv[3]);
+    int init_y = atoi(argv[4]);
+    vector<FrameRecord> records;
+    if (!RunTracker(clip, init_x, init_y, records) ||
+            !WriteGolden(argv[5], clip, init_x, init_y, records)) {
+        return -1;
+    }
+    cout << "Recorded " << records.size() << " frames to " << argv[5] << endl;
+    return 0;
+}
+
+int Check(int argc, char* argv[]) {
+    if (argc < 4) {
+        cout << "usage: " << argv[0] << " check <clip> <golden.csv>" <<
+            " [--ball-tolerance <px>] [--net-tolerance <px>]" <<
+            " [--event-slack <frames>] [--max-ball-mismatches <n>]" << endl;
+        return -1;
+    }
+    Tolerances tolerances;
+    tolerances.ball = kDefaultBallTolerance;
+    tolerances.net = kDefaultNetTolerance;
+    tolerances.event_slack = kDefaultEventSlack;
+    tolerances.max_ball_mismatches = kDefaultMaxBallMismatches;
+    for (int i = 4; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--ball-tolerance" && i + 1 < argc) {
+            tolerances.ball = atof(argv[++i]);
+        } else if (arg == "--net-tolerance" && i + 1 < argc) {
+            tolerances.net = atoi(argv[++i]);
+        } else if (arg == "--event-slack" && i + 1 < argc) {
+            tolerances.event_slack = atoi(argv[++i]);
+        } else if (arg == "--max-ball-mismatches" && i + 1 < argc) {
+            tolerances.max_ball_mismatches = atoi(argv[++i]);
+        } else {
+            cout << "Unknown argument: " << arg << endl;
+            return -1;
+        }
+    }
+    int init_x, init_y;
+    vector<FrameRecord> golden;
+    if (!ReadGolden(argv[3], init_x, init_y, golden)) {
+        return -1;
+    }
+    vector<FrameRecord> actual;
+    if (!RunTracker(argv[2], init_x, init_y, actual)) {
+        return -1;
+    }
+    int failures = CompareRecords(golden, actual, tolerances);
+    if (failures > 0) {
+        cout << "FAILED: " << failures << " differences from " << argv[3] <<
+            endl;
+        return 1;
+    }
+    cout << "PASSED: " << actual.size() << " frames match " << argv[3] << endl;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    string mode = argc > 1 ? argv[1] : "";
+    if (mode == "locate") {
+        return Locate(argc, argv);
+    } else if (mode == "record") {
+        return Record(argc, argv);
+    } else if (mode == "check") {
+        return Check(argc, argv);
+    } else if (mode == "labeling") {
+        return Labeling(argc, argv);
+    } else if (mode == "crossing") {
+        return Crossing(argc, argv);
+    }
+    cout << "usage: " << argv[0] <<
+        " locate|record|check|labeling|crossing ..." << endl;
+    return -1;
+}
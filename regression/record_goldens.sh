@@ -0,0 +1,42 @@
+#!/bin/bash
+# Records regression/golden/<clip>.csv for every data-samples/<clip>.mov with
+# the tracker of a known good commit, by default the one that added the
+# regression harness, before any of the later rewrites.
+#
+# usage: regression/record_goldens.sh [<commit>] [<nba_vision_regression>]
+#
+# The initial ball location of each clip is the one the tracker of this tree
+# finds on its own in the first frame (nba_vision_regression locate, which
+# defaults to build/nba_vision_regression), and is stored in the first line of
+# the golden file, so later checks start from the same point.
+
+set -e
+
+cd "$(dirname "$0")/.."
+repo=$(pwd)
+commit=${1:-b7ccd91}
+locate_tool=${2:-build/nba_vision_regression}
+if [ ! -x "$locate_tool" ]; then
+    echo "Build $locate_tool first, e.g. mkdir -p build && cd build && cmake .. && make"
+    exit 1
+fi
+
+worktree=$(mktemp -d)
+trap 'git worktree remove --force "$worktree"' EXIT
+git worktree add --detach "$worktree" "$commit"
+(
+    cd "$worktree"
+    g++ -O2 -std=c++11 -I. $(ls *.cpp | grep -v nba_vision_main.cpp) \
+        regression/nba_vision_regression.cpp \
+        $(pkg-config --cflags --libs opencv) -o nba_vision_regression.o
+)
+
+mkdir -p regression/golden
+for clip in data-samples/*.mov; do
+    name=$(basename "$clip" .mov)
+    init=$("$locate_tool" locate "$clip")
+    # The known good tracker loads metadata/ relative to the working
+    # directory, so it runs in its own tree, on its own copy of the clip.
+    (cd "$worktree" && ./nba_vision_regression.o record \
+        "$clip" $init "$repo/regression/golden/$name.csv")
+done
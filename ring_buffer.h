@@ -0,0 +1,113 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <iterator>
+
+namespace nba_vision {
+
+// A fixed-capacity buffer that keeps the last N values pushed into it, e.g.
+// the last N locations of a tracked object. PushBack is O(1) and overwrites
+// the oldest value once the buffer is full. Values are read in place, from
+// oldest to newest, through operator[] or iterators.
+template <typename T, int N>
+class RingBuffer {
+public:
+    // Iterates from oldest to newest without copying.
+    class ConstIterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef int difference_type;
+        typedef const T* pointer;
+        typedef const T& reference;
+
+        ConstIterator(const RingBuffer* buffer, int index) :
+                buffer_(buffer), index_(index) {}
+        const T& operator*() const { return (*buffer_)[index_]; }
+        const T* operator->() const { return &(*buffer_)[index_]; }
+        ConstIterator& operator++() { ++index_; return *this; }
+        ConstIterator operator++(int) {
+            ConstIterator copy = *this;
+            ++index_;
+            return copy;
+        }
+        bool operator==(const ConstIterator& other) const {
+            return index_ == other.index_ && buffer_ == other.buffer_;
+        }
+        bool operator!=(const ConstIterator& other) const {
+            return !(*this == other);
+        }
+
+    private:
+        const RingBuffer* buffer_;
+        int index_;
+    };
+
+    // A view of the newest values, for range-based for loops.
+    class Range {
+    public:
+        Range(ConstIterator begin, ConstIterator end) : begin_(begin), end_(end) {}
+        ConstIterator begin() const { return begin_; }
+        ConstIterator end() const { return end_; }
+
+    private:
+        ConstIterator begin_;
+        ConstIterator end_;
+    };
+
+    RingBuffer() : head_(0), size_(0) {}
+
+    // Appends a value, dropping the oldest one if the buffer is full.
+    void PushBack(const T& value) {
+        if (size_ < N) {
+            data_[Wrap(head_ + size_)] = value;
+            size_++;
+        } else {
+            data_[head_] = value;
+            head_ = Wrap(head_ + 1);
+        }
+    }
+
+    void Clear() {
+        head_ = 0;
+        size_ = 0;
+    }
+
+    // The i-th oldest value.
+    const T& operator[](const int& i) const { return data_[Wrap(head_ + i)]; }
+
+    // The i-th newest value, FromBack(0) being the newest.
+    const T& FromBack(const int& i) const { return (*this)[size_ - 1 - i]; }
+
+    const T& Back() const { return FromBack(0); }
+
+    int Size() const { return size_; }
+
+    bool Empty() const { return size_ == 0; }
+
+    bool Full() const { return size_ == N; }
+
+    static int Capacity() { return N; }
+
+    ConstIterator begin() const { return ConstIterator(this, 0); }
+
+    ConstIterator end() const { return ConstIterator(this, size_); }
+
+    // The newest n values (or all of them if there are fewer), oldest first.
+    Range Last(const int& n) const {
+        int first = n < size_ ? size_ - n : 0;
+        return Range(ConstIterator(this, first), end());
+    }
+
+private:
+    static int Wrap(const int& index) { return index < N ? index : index - N; }
+
+    T data_[N];
+    // Index in data_ of the oldest value.
+    int head_;
+    int size_;
+};
+
+}
+
+#endif  // RING_BUFFER_H
@@ -0,0 +1,54 @@
+#include "serialization.h"
+
+namespace nba_vision {
+
+// The most a stream that can't seek may claim to hold.
+const uint64_t kMaxUnseekableBytes = 1ULL << 30;
+
+bool HasBytesLeft(istream& input, const uint64_t& num_bytes) {
+    istream::pos_type position = input.tellg();
+    if (position == istream::pos_type(-1)) {
+        return num_bytes <= kMaxUnseekableBytes;
+    }
+    input.seekg(0, ios::end);
+    istream::pos_type end = input.tellg();
+    input.seekg(position);
+    if (end == istream::pos_type(-1) || !input) {
+        return false;
+    }
+    return num_bytes <= (uint64_t) (end - position);
+}
+
+void WriteMat(ostream& output, const Mat& mat) {
+    WriteValue(output, (int32_t) mat.rows);
+    WriteValue(output, (int32_t) mat.cols);
+    WriteValue(output, (int32_t) mat.type());
+    size_t row_bytes = mat.cols * mat.elemSize();
+    for (int r = 0; r < mat.rows; r++) {
+        output.write((const char*) mat.ptr(r), row_bytes);
+    }
+}
+
+bool ReadMat(istream& input, Mat& mat) {
+    int32_t rows, cols, type;
+    if (!ReadValue(input, rows) || !ReadValue(input, cols) ||
+            !ReadValue(input, type) || rows < 0 || cols < 0 ||
+            type != CV_MAT_TYPE(type) || !HasBytesLeft(input,
+                (uint64_t) rows * cols * CV_ELEM_SIZE(type))) {
+        return false;
+    }
+    if (rows == 0 || cols == 0) {
+        mat = Mat();
+        return true;
+    }
+    mat.create(rows, cols, type);
+    size_t row_bytes = mat.cols * mat.elemSize();
+    for (int r = 0; r < mat.rows; r++) {
+        if (!input.read((char*) mat.ptr(r), row_bytes)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,93 @@
+#ifndef SERIALIZATION_H
+#define SERIALIZATION_H
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include "ring_buffer.h"
+
+using namespace cv;
+using namespace std;
+
+namespace nba_vision {
+
+// Helpers for the binary snapshots of the tracking state. Values are written
+// in the native byte order, so snapshots are only read back on the machine
+// type that wrote them. Read functions return false on a truncated or
+// malformed stream.
+
+// Writes a trivially copyable value.
+template <typename T>
+void WriteValue(ostream& output, const T& value) {
+    output.write((const char*) &value, sizeof(T));
+}
+
+template <typename T>
+bool ReadValue(istream& input, T& value) {
+    return (bool) input.read((char*) &value, sizeof(T));
+}
+
+// Writes a vector of trivially copyable values.
+template <typename T>
+void WriteVector(ostream& output, const vector<T>& values) {
+    WriteValue(output, (uint64_t) values.size());
+    if (!values.empty()) {
+        output.write((const char*) values.data(), values.size() * sizeof(T));
+    }
+}
+
+// Returns true if input still holds num_bytes, so that a corrupt size can't
+// make a reader allocate more than the stream could fill. Streams that can't
+// seek are trusted up to a fixed maximum.
+bool HasBytesLeft(istream& input, const uint64_t& num_bytes);
+
+template <typename T>
+bool ReadVector(istream& input, vector<T>& values) {
+    uint64_t size;
+    if (!ReadValue(input, size) || size > UINT64_MAX / sizeof(T) ||
+            !HasBytesLeft(input, size * sizeof(T))) {
+        return false;
+    }
+    values.resize(size);
+    return size == 0 ||
+        (bool) input.read((char*) values.data(), size * sizeof(T));
+}
+
+// Writes the values of a RingBuffer, oldest first.
+template <typename T, int N>
+void WriteRingBuffer(ostream& output, const RingBuffer<T, N>& buffer) {
+    WriteValue(output, (int32_t) buffer.Size());
+    for (const auto& value : buffer) {
+        WriteValue(output, value);
+    }
+}
+
+template <typename T, int N>
+bool ReadRingBuffer(istream& input, RingBuffer<T, N>& buffer) {
+    int32_t size;
+    if (!ReadValue(input, size) || size < 0 || size > N) {
+        return false;
+    }
+    buffer.Clear();
+    for (int i = 0; i < size; i++) {
+        T value;
+        if (!ReadValue(input, value)) {
+            return false;
+        }
+        buffer.PushBack(value);
+    }
+    return true;
+}
+
+// Writes the size, type and pixels of a matrix.
+void WriteMat(ostream& output, const Mat& mat);
+
+bool ReadMat(istream& input, Mat& mat);
+
+}
+
+#endif  // SERIALIZATION_H
@@ -0,0 +1,300 @@
+#include "shot_statistics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+#include "serialization.h"
+
+namespace nba_vision {
+
+const uint32_t kShotStatisticsMagic = 0x4e425653;  // "NBVS"
+const uint32_t kShotStatisticsVersion = 1;
+// Histogram bins of each feature. Heights are in net heights and the entry
+// angle in degrees.
+const double kHeightLow = -5;
+const double kHeightHigh = 20;
+const int kHeightBins = 100;
+const double kAngleLow = 0;
+const double kAngleHigh = 90;
+const int kAngleBins = 90;
+
+RunningMoments::RunningMoments() : count_(0), mean_(0), m2_(0),
+        min_(numeric_limits<double>::infinity()),
+        max_(-numeric_limits<double>::infinity()) {}
+
+void RunningMoments::Add(const double& value) {
+    count_++;
+    double delta = value - mean_;
+    mean_ += delta / count_;
+    m2_ += delta * (value - mean_);
+    min_ = min(min_, value);
+    max_ = max(max_, value);
+}
+
+void RunningMoments::Merge(const RunningMoments& other) {
+    if (other.count_ == 0) {
+        return;
+    }
+    int64_t count = count_ + other.count_;
+    double delta = other.mean_ - mean_;
+    mean_ += delta * other.count_ / count;
+    m2_ += other.m2_ + delta * delta * ((double) count_ * other.count_ / count);
+    count_ = count;
+    min_ = min(min_, other.min_);
+    max_ = max(max_, other.max_);
+}
+
+int64_t RunningMoments::Count() const {
+    return count_;
+}
+
+double RunningMoments::Mean() const {
+    return mean_;
+}
+
+double RunningMoments::Variance() const {
+    return count_ > 1 ? m2_ / count_ : 0;
+}
+
+double RunningMoments::Min() const {
+    return min_;
+}
+
+double RunningMoments::Max() const {
+    return max_;
+}
+
+void RunningMoments::Save(ostream& output) const {
+    WriteValue(output, count_);
+    WriteValue(output, mean_);
+    WriteValue(output, m2_);
+    WriteValue(output, min_);
+    WriteValue(output, max_);
+}
+
+bool RunningMoments::Load(istream& input) {
+    return ReadValue(input, count_) && ReadValue(input, mean_) &&
+        ReadValue(input, m2_) && ReadValue(input, min_) &&
+        ReadValue(input, max_) && count_ >= 0;
+}
+
+FixedHistogram::FixedHistogram(const double& low, const double& high,
+        const int& num_bins) : low_(low), high_(high), counts_(num_bins, 0),
+        total_(0) {}
+
+void FixedHistogram::Add(const double& value) {
+    int bin = floor((value - low_) / (high_ - low_) * counts_.size());
+    bin = min(max(bin, 0), (int) counts_.size() - 1);
+    counts_[bin]++;
+    total_++;
+}
+
+bool FixedHistogram::Merge(const FixedHistogram& other) {
+    if (other.low_ != low_ || other.high_ != high_ ||
+            other.counts_.size() != counts_.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < counts_.size(); i++) {
+        counts_[i] += other.counts_[i];
+    }
+    total_ += other.total_;
+    return true;
+}
+
+double FixedHistogram::Quantile(const double& q) const {
+    if (total_ == 0) {
+        return 0;
+    }
+    // The rank of the value, counting from 1.
+    int64_t rank = max((int64_t) 1, (int64_t) ceil(q * total_));
+    int64_t seen = 0;
+    size_t bin = 0;
+    for (; bin + 1 < counts_.size(); bin++) {
+        seen += counts_[bin];
+        if (seen >= rank) {
+            break;
+        }
+    }
+    double width = (high_ - low_) / counts_.size();
+    return low_ + (bin + 0.5) * width;
+}
+
+void FixedHistogram::Save(ostream& output) const {
+    WriteValue(output, low_);
+    WriteValue(output, high_);
+    WriteVector(output, counts_);
+    WriteValue(output, total_);
+}
+
+bool FixedHistogram::Load(istream& input) {
+    double low, high;
+    vector<int64_t> counts;
+    int64_t total;
+    if (!ReadValue(input, low) || !ReadValue(input, high) ||
+            !ReadVector(input, counts) || !ReadValue(input, total) ||
+            low != low_ || high != high_ || counts.size() != counts_.size()) {
+        return false;
+    }
+    counts_ = counts;
+    total_ = total;
+    return true;
+}
+
+ShotStatistics::ShotStatistics() : attempts_(0), makes_(0) {
+    for (int feature = 0; feature < NUM_FEATURES; feature++) {
+        for (int made = 0; made < 2; made++) {
+            if (feature == ENTRY_ANGLE) {
+                features_.push_back(FeatureStatistics(kAngleLow, kAngleHigh,
+                            kAngleBins));
+            } else {
+                features_.push_back(FeatureStatistics(kHeightLow,
+                            kHeightHigh, kHeightBins));
+            }
+        }
+    }
+}
+
+void ShotStatistics::AddShot(const ShotFeatures& features) {
+    attempts_++;
+    makes_ += features.made;
+    if (features.num_points < 1) {
+        return;
+    }
+    double values[NUM_FEATURES] = {features.release_height,
+        features.apex_height, features.entry_angle};
+    for (int feature = 0; feature < NUM_FEATURES; feature++) {
+        if (feature == ENTRY_ANGLE && !features.has_entry_angle) {
+            continue;
+        }
+        FeatureStatistics& statistics = Statistics(feature, features.made);
+        statistics.moments.Add(values[feature]);
+        statistics.histogram.Add(values[feature]);
+    }
+}
+
+bool ShotStatistics::Merge(const ShotStatistics& other) {
+    // Check every histogram first, so that a failed merge changes nothing.
+    for (size_t i = 0; i < features_.size(); i++) {
+        FixedHistogram histogram = features_[i].histogram;
+        if (!histogram.Merge(other.features_[i].histogram)) {
+            return false;
+        }
+    }
+    attempts_ += other.attempts_;
+    makes_ += other.makes_;
+    for (size_t i = 0; i < features_.size(); i++) {
+        features_[i].moments.Merge(other.features_[i].moments);
+        features_[i].histogram.Merge(other.features_[i].histogram);
+    }
+    return true;
+}
+
+int64_t ShotStatistics::Attempts() const {
+    return attempts_;
+}
+
+int64_t ShotStatistics::Makes() const {
+    return makes_;
+}
+
+void ShotStatistics::Print(ostream& output) const {
+    output << makes_ << " of " << attempts_ << " shots made";
+    if (attempts_ > 0) {
+        output << " (" << 100.0 * makes_ / attempts_ << "%)";
+    }
+    output << endl;
+    for (int feature = 0; feature < NUM_FEATURES; feature++) {
+        for (int made = 1; made >= 0; made--) {
+            const FeatureStatistics& statistics = Statistics(feature, made);
+            if (statistics.moments.Count() == 0) {
+                continue;
+            }
+            output << "  " << FeatureName(feature) << ", " <<
+                (made ? "makes" : "misses") << ": mean " <<
+                statistics.moments.Mean() << ", stddev " <<
+                sqrt(statistics.moments.Variance()) << ", median " <<
+                statistics.histogram.Quantile(0.5) << ", range " <<
+                statistics.moments.Min() << " to " <<
+                statistics.moments.Max() << " over " <<
+                statistics.moments.Count() << " shots" << endl;
+        }
+    }
+}
+
+bool ShotStatistics::LoadFromFile(const string& filename) {
+    ifstream input(filename.c_str(), ios::binary);
+    uint32_t magic, version;
+    if (!input.is_open() || !ReadValue(input, magic) ||
+            magic != kShotStatisticsMagic || !ReadValue(input, version) ||
+            version != kShotStatisticsVersion) {
+        return false;
+    }
+    ShotStatistics loaded;
+    if (!ReadValue(input, loaded.attempts_) ||
+            !ReadValue(input, loaded.makes_)) {
+        return false;
+    }
+    for (auto& statistics : loaded.features_) {
+        if (!statistics.moments.Load(input) ||
+                !statistics.histogram.Load(input)) {
+            return false;
+        }
+    }
+    *this = loaded;
+    return true;
+}
+
+bool ShotStatistics::SaveToFile(const string& filename) const {
+    string temp_filename = filename + ".tmp";
+    {
+        ofstream output(temp_filename.c_str(), ios::binary | ios::trunc);
+        WriteValue(output, kShotStatisticsMagic);
+        WriteValue(output, kShotStatisticsVersion);
+        WriteValue(output, attempts_);
+        WriteValue(output, makes_);
+        for (const auto& statistics : features_) {
+            statistics.moments.Save(output);
+            statistics.histogram.Save(output);
+        }
+        output.flush();
+        if (!output) {
+            cout << "Cannot write the shot statistics: " << temp_filename <<
+                endl;
+            remove(temp_filename.c_str());
+            return false;
+        }
+    }
+    if (rename(temp_filename.c_str(), filename.c_str()) != 0) {
+        cout << "Cannot write the shot statistics: " << filename << endl;
+        remove(temp_filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+const char* ShotStatistics::FeatureName(const int& feature) {
+    switch (feature) {
+        case RELEASE_HEIGHT:
+            return "Release height (net heights)";
+        case APEX_HEIGHT:
+            return "Apex height (net heights)";
+        default:
+            return "Entry angle (degrees)";
+    }
+}
+
+ShotStatistics::FeatureStatistics& ShotStatistics::Statistics(
+        const int& feature, const bool& made) {
+    return features_[2 * feature + made];
+}
+
+const ShotStatistics::FeatureStatistics& ShotStatistics::Statistics(
+        const int& feature, const bool& made) const {
+    return features_[2 * feature + made];
+}
+
+}
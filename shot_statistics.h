@@ -0,0 +1,149 @@
+#ifndef SHOT_STATISTICS_H
+#define SHOT_STATISTICS_H
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace nba_vision {
+
+// The arc of one shot, from the path the tracker followed while the ball
+// was in the air. Heights are above the top of the net, in net heights, so
+// that they compare between cameras and resolutions.
+struct ShotFeatures {
+    bool made;
+    // Path points the features come from. The heights need at least one and
+    // the entry angle two.
+    int num_points;
+    // Of the lowest point of the rise that took the ball above the net,
+    // where it left the shooter's hands.
+    double release_height;
+    double apex_height;
+    // Degrees below horizontal of the last downward step that ends above the
+    // top of the net.
+    double entry_angle;
+    bool has_entry_angle;
+};
+
+// Count, mean, variance and range of a stream of values. Values are added
+// one at a time with Welford's update and two sets are merged in constant
+// time with Chan's formula, so partial results of workers or games combine
+// exactly without keeping the values.
+class RunningMoments {
+public:
+    RunningMoments();
+
+    void Add(const double& value);
+
+    void Merge(const RunningMoments& other);
+
+    int64_t Count() const;
+    double Mean() const;
+    // Of the population, 0 for fewer than two values.
+    double Variance() const;
+    double Min() const;
+    double Max() const;
+
+    void Save(ostream& output) const;
+    bool Load(istream& input);
+
+private:
+    int64_t count_;
+    double mean_;
+    // Sum of squared differences from the mean.
+    double m2_;
+    double min_;
+    double max_;
+};
+
+// Counts of values in num_bins equal bins over [low, high), with values
+// outside counted in the first or last bin. Histograms with the same bins
+// merge by adding their counts, which takes the same time however many
+// values they hold. Quantiles are read to within a bin.
+class FixedHistogram {
+public:
+    FixedHistogram(const double& low, const double& high,
+            const int& num_bins);
+
+    void Add(const double& value);
+
+    // Returns false, and changes nothing, if other has different bins.
+    bool Merge(const FixedHistogram& other);
+
+    // The middle of the bin that holds quantile q, 0 <= q <= 1, or 0 if the
+    // histogram is empty.
+    double Quantile(const double& q) const;
+
+    void Save(ostream& output) const;
+    bool Load(istream& input);
+
+private:
+    double low_;
+    double high_;
+    vector<int64_t> counts_;
+    int64_t total_;
+};
+
+// Shot attempts, makes and the distribution of each arc feature, for makes
+// and misses apart. Shots are added as they end and statistics of clips,
+// chunks or games are merged into larger ones, so a season builds up with
+// memory that doesn't grow with the number of shots.
+class ShotStatistics {
+public:
+    ShotStatistics();
+
+    void AddShot(const ShotFeatures& features);
+
+    // Returns false if other was built with other histogram bins.
+    bool Merge(const ShotStatistics& other);
+
+    int64_t Attempts() const;
+    int64_t Makes() const;
+
+    // A summary of each feature, for makes and misses.
+    void Print(ostream& output) const;
+
+    // Replaces the statistics with those in filename. Returns false if the
+    // file can't be read or isn't a statistics file.
+    bool LoadFromFile(const string& filename);
+
+    // Writes through a temporary file and a rename, so that a season file
+    // is never left half written.
+    bool SaveToFile(const string& filename) const;
+
+private:
+    enum Feature {
+        RELEASE_HEIGHT,
+        APEX_HEIGHT,
+        ENTRY_ANGLE,
+        NUM_FEATURES
+    };
+
+    struct FeatureStatistics {
+        FeatureStatistics(const double& low, const double& high,
+                const int& num_bins) : histogram(low, high, num_bins) {}
+
+        RunningMoments moments;
+        FixedHistogram histogram;
+    };
+
+    static const char* FeatureName(const int& feature);
+
+    // The statistics of feature for makes or misses.
+    FeatureStatistics& Statistics(const int& feature, const bool& made);
+    const FeatureStatistics& Statistics(const int& feature,
+            const bool& made) const;
+
+    int64_t attempts_;
+    int64_t makes_;
+    // Misses then makes for each feature.
+    vector<FeatureStatistics> features_;
+};
+
+}
+
+#endif  // SHOT_STATISTICS_H
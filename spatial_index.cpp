@@ -0,0 +1,174 @@
+#include "spatial_index.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace nba_vision {
+
+// Keeps the grid from growing far beyond the number of points when the
+// points are spread out.
+const int kMaxCellsPerPoint = 4;
+const int kMinMaxCells = 1024;
+// Cell coordinates are clamped to this range so that far away queries
+// cannot overflow.
+const int kMaxCellCoord = 1 << 20;
+
+SpatialIndex::SpatialIndex(const float& cell_size) :
+        cell_size_(cell_size), inv_cell_size_(1.0f / cell_size),
+        min_x_(0), min_y_(0), num_cols_(0), num_rows_(0) {
+}
+
+void SpatialIndex::Build(const vector<Point2f>& points) {
+    points_.assign(points.begin(), points.end());
+    BuildGrid();
+}
+
+void SpatialIndex::Build(const vector<RegionMetrics*>& region_metrics_list) {
+    points_.clear();
+    for (auto region_metrics : region_metrics_list) {
+        points_.push_back(Point2f(region_metrics->avg_x, region_metrics->avg_y));
+    }
+    BuildGrid();
+}
+
+int SpatialIndex::CellCoord(const float& value, const float& min_value) const {
+    float coord = floor((value - min_value) * inv_cell_size_);
+    coord = max(coord, (float) -kMaxCellCoord);
+    coord = min(coord, (float) kMaxCellCoord);
+    return coord;
+}
+
+void SpatialIndex::BuildGrid() {
+    const int n = points_.size();
+    if (n == 0) {
+        num_cols_ = 0;
+        num_rows_ = 0;
+        sorted_points_.clear();
+        sorted_indices_.clear();
+        cell_start_.assign(1, 0);
+        return;
+    }
+    float max_x = points_[0].x;
+    float max_y = points_[0].y;
+    min_x_ = points_[0].x;
+    min_y_ = points_[0].y;
+    for (const auto& point : points_) {
+        min_x_ = min(min_x_, point.x);
+        min_y_ = min(min_y_, point.y);
+        max_x = max(max_x, point.x);
+        max_y = max(max_y, point.y);
+    }
+    // Coarsen the grid if the points are too sparse for the cell size.
+    inv_cell_size_ = 1.0f / cell_size_;
+    double max_cells = max(kMaxCellsPerPoint * n, kMinMaxCells);
+    double area_in_cells = ((max_x - min_x_) * inv_cell_size_ + 1) *
+        ((max_y - min_y_) * inv_cell_size_ + 1);
+    if (area_in_cells > max_cells) {
+        inv_cell_size_ /= sqrt(area_in_cells / max_cells);
+    }
+    num_cols_ = CellCoord(max_x, min_x_) + 1;
+    num_rows_ = CellCoord(max_y, min_y_) + 1;
+
+    // Counting sort of the points by cell.
+    cell_start_.assign(num_cols_ * num_rows_ + 1, 0);
+    point_cells_.resize(n);
+    for (int i = 0; i < n; ++i) {
+        int cell = CellCoord(points_[i].y, min_y_) * num_cols_ +
+            CellCoord(points_[i].x, min_x_);
+        point_cells_[i] = cell;
+        cell_start_[cell + 1]++;
+    }
+    for (int c = 0; c < num_cols_ * num_rows_; ++c) {
+        cell_start_[c + 1] += cell_start_[c];
+    }
+    sorted_points_.resize(n);
+    sorted_indices_.resize(n);
+    cell_fill_.assign(cell_start_.begin(), cell_start_.end() - 1);
+    for (int i = 0; i < n; ++i) {
+        int pos = cell_fill_[point_cells_[i]]++;
+        sorted_points_[pos] = points_[i];
+        sorted_indices_[pos] = i;
+    }
+}
+
+int SpatialIndex::FindNearest(const float& x, const float& y,
+        const float& max_distance) const {
+    if (sorted_points_.empty()) {
+        return -1;
+    }
+    const int cx = CellCoord(x, min_x_);
+    const int cy = CellCoord(y, min_y_);
+    const float cell_size = 1.0f / inv_cell_size_;
+    // Rings before first_ring and after last_ring are outside the grid.
+    const int first_ring = max(max(max(-cx, cx - (num_cols_ - 1)),
+            max(-cy, cy - (num_rows_ - 1))), 0);
+    const int last_ring = max(max(abs(cx), abs(cx - (num_cols_ - 1))),
+            max(abs(cy), abs(cy - (num_rows_ - 1))));
+    float best_distance_squared = max_distance * max_distance;
+    int best = -1;
+    // Visit square rings of cells around the query cell, nearest first.
+    for (int ring = first_ring; ring <= last_ring; ++ring) {
+        // Every point in this ring is at least (ring - 1) cells away.
+        float ring_distance = (ring - 1) * cell_size;
+        if (ring > 1 && ring_distance * ring_distance >= best_distance_squared) {
+            break;
+        }
+        int row_begin = max(cy - ring, 0);
+        int row_end = min(cy + ring, num_rows_ - 1);
+        int col_begin = max(cx - ring, 0);
+        int col_end = min(cx + ring, num_cols_ - 1);
+        for (int r = row_begin; r <= row_end; ++r) {
+            // The top and bottom rows of the ring are full, the rest only
+            // have the leftmost and rightmost cell.
+            bool full_row = (r == cy - ring || r == cy + ring);
+            for (int c = col_begin; c <= col_end; ++c) {
+                if (!full_row && c != cx - ring && c != cx + ring) {
+                    // Skip ahead to the rightmost cell of the ring.
+                    c = cx + ring - 1;
+                    continue;
+                }
+                int cell = r * num_cols_ + c;
+                for (int i = cell_start_[cell]; i < cell_start_[cell + 1]; ++i) {
+                    float x_diff = sorted_points_[i].x - x;
+                    float y_diff = sorted_points_[i].y - y;
+                    float distance_squared = x_diff * x_diff + y_diff * y_diff;
+                    if (distance_squared < best_distance_squared) {
+                        best_distance_squared = distance_squared;
+                        best = sorted_indices_[i];
+                    }
+                }
+            }
+        }
+    }
+    return best;
+}
+
+void SpatialIndex::FindWithinRadius(const float& x, const float& y,
+        const float& radius, vector<int>& indices) const {
+    if (sorted_points_.empty()) {
+        return;
+    }
+    const float radius_squared = radius * radius;
+    int col_begin = max(CellCoord(x - radius, min_x_), 0);
+    int col_end = min(CellCoord(x + radius, min_x_), num_cols_ - 1);
+    int row_begin = max(CellCoord(y - radius, min_y_), 0);
+    int row_end = min(CellCoord(y + radius, min_y_), num_rows_ - 1);
+    for (int r = row_begin; r <= row_end; ++r) {
+        for (int c = col_begin; c <= col_end; ++c) {
+            int cell = r * num_cols_ + c;
+            for (int i = cell_start_[cell]; i < cell_start_[cell + 1]; ++i) {
+                float x_diff = sorted_points_[i].x - x;
+                float y_diff = sorted_points_[i].y - y;
+                if (x_diff * x_diff + y_diff * y_diff <= radius_squared) {
+                    indices.push_back(sorted_indices_[i]);
+                }
+            }
+        }
+    }
+}
+
+int SpatialIndex::Size() const {
+    return points_.size();
+}
+
+}
@@ -0,0 +1,69 @@
+#ifndef SPATIAL_INDEX_H
+#define SPATIAL_INDEX_H
+
+#include <vector>
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include "util.h"
+
+using namespace cv;
+using namespace std;
+
+namespace nba_vision {
+
+// A uniform grid over a set of points, rebuilt every frame from the candidate
+// centroids. Points are bucketed by cell with a counting sort so building is
+// linear, and queries only visit the cells near the query point. All
+// distances are compared squared.
+class SpatialIndex {
+public:
+    // cell_size is in pixels. It should be around the typical query radius.
+    explicit SpatialIndex(const float& cell_size);
+
+    // Rebuilds the index. Storage is reused between calls.
+    void Build(const vector<Point2f>& points);
+
+    // Rebuilds the index from the centroids of the regions. Returned indices
+    // refer to positions in region_metrics_list.
+    void Build(const vector<RegionMetrics*>& region_metrics_list);
+
+    // Returns the index of the point closest to (x, y) that is strictly within
+    // max_distance, or -1 if there is none.
+    int FindNearest(const float& x, const float& y,
+            const float& max_distance) const;
+
+    // Appends the indices of all points within radius of (x, y).
+    void FindWithinRadius(const float& x, const float& y, const float& radius,
+            vector<int>& indices) const;
+
+    int Size() const;
+
+private:
+    // Buckets points_ into the grid.
+    void BuildGrid();
+
+    // Cell coordinate of a position along one axis, not clamped to the grid.
+    int CellCoord(const float& value, const float& min_value) const;
+
+    float cell_size_;
+    float inv_cell_size_;
+    float min_x_;
+    float min_y_;
+    int num_cols_;
+    int num_rows_;
+    // Input points, in input order.
+    vector<Point2f> points_;
+    // Points and their input indices, sorted by cell.
+    vector<Point2f> sorted_points_;
+    vector<int> sorted_indices_;
+    // Points of cell c are sorted_points_[cell_start_[c]..cell_start_[c + 1]).
+    vector<int> cell_start_;
+    // Scratch space for the counting sort.
+    vector<int> point_cells_;
+    vector<int> cell_fill_;
+};
+
+}
+
+#endif  // SPATIAL_INDEX_H
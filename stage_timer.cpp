@@ -0,0 +1,184 @@
+#include "stage_timer.h"
+
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+namespace nba_vision {
+
+// The histograms of one thread, created on first use. Never freed, so the
+// timings of threads that have exited still show up in the dump.
+struct ThreadStageStats {
+    atomic<StageHistogram*> histograms[kMaxStages];
+
+    ThreadStageStats() {
+        for (int i = 0; i < kMaxStages; ++i) {
+            histograms[i].store(NULL, memory_order_relaxed);
+        }
+    }
+};
+
+// Guards stage registration and the list of threads. Never taken while
+// recording a duration.
+static mutex registry_mutex;
+static vector<ThreadStageStats*> all_thread_stats;
+static const char* stage_names[kMaxStages];
+static atomic<int> num_stages(0);
+static thread_local ThreadStageStats* thread_stats = NULL;
+static atomic<bool> dump_requested(false);
+
+StageHistogram::StageHistogram() : total_count_(0), max_nanos_(0) {
+    for (int i = 0; i < kNumBuckets; ++i) {
+        counts_[i].store(0, memory_order_relaxed);
+    }
+}
+
+void StageHistogram::Record(const uint64_t& nanos) {
+    // There is a single writer, so plain loads and stores are enough and
+    // avoid locked instructions.
+    atomic<uint64_t>& count = counts_[BucketIndex(nanos)];
+    count.store(count.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    total_count_.store(total_count_.load(memory_order_relaxed) + 1,
+            memory_order_relaxed);
+    if (nanos > max_nanos_.load(memory_order_relaxed)) {
+        max_nanos_.store(nanos, memory_order_relaxed);
+    }
+}
+
+void StageHistogram::MergeInto(uint64_t* counts, uint64_t* total_count,
+        uint64_t* max_nanos) const {
+    for (int i = 0; i < kNumBuckets; ++i) {
+        counts[i] += counts_[i].load(memory_order_relaxed);
+    }
+    *total_count += total_count_.load(memory_order_relaxed);
+    uint64_t max_value = max_nanos_.load(memory_order_relaxed);
+    if (max_value > *max_nanos) {
+        *max_nanos = max_value;
+    }
+}
+
+int StageHistogram::BucketIndex(const uint64_t& nanos) {
+    const uint64_t kLinearLimit = 1 << kSubBucketBits;
+    if (nanos < kLinearLimit) {
+        return nanos;
+    }
+    // Values in [2^(group + 4), 2^(group + 5)) fall into group, which has
+    // 16 sub-buckets of width 2^group.
+    int most_significant_bit = 63 - __builtin_clzll(nanos);
+    int group = most_significant_bit - kSubBucketBits + 1;
+    int sub_bucket = (nanos >> group) - (1 << (kSubBucketBits - 1));
+    return kLinearLimit + (group - 1) * (1 << (kSubBucketBits - 1)) + sub_bucket;
+}
+
+uint64_t StageHistogram::BucketLowerBound(const int& index) {
+    const int kLinearLimit = 1 << kSubBucketBits;
+    if (index < kLinearLimit) {
+        return index;
+    }
+    const int kSubBuckets = 1 << (kSubBucketBits - 1);
+    int group = (index - kLinearLimit) / kSubBuckets + 1;
+    uint64_t sub_bucket = (index - kLinearLimit) % kSubBuckets + kSubBuckets;
+    return sub_bucket << group;
+}
+
+int RegisterStage(const char* name) {
+    lock_guard<mutex> lock(registry_mutex);
+    int count = num_stages.load(memory_order_relaxed);
+    for (int i = 0; i < count; ++i) {
+        if (strcmp(stage_names[i], name) == 0) {
+            return i;
+        }
+    }
+    if (count == kMaxStages) {
+        cout << "Too many stages, timing " << name << " as " <<
+            stage_names[kMaxStages - 1] << endl;
+        return kMaxStages - 1;
+    }
+    stage_names[count] = name;
+    num_stages.store(count + 1, memory_order_release);
+    return count;
+}
+
+void RecordStageTime(const int& stage_id, const uint64_t& nanos) {
+    if (thread_stats == NULL) {
+        thread_stats = new ThreadStageStats();
+        lock_guard<mutex> lock(registry_mutex);
+        all_thread_stats.push_back(thread_stats);
+    }
+    StageHistogram* histogram =
+        thread_stats->histograms[stage_id].load(memory_order_relaxed);
+    if (histogram == NULL) {
+        histogram = new StageHistogram();
+        thread_stats->histograms[stage_id].store(histogram, memory_order_release);
+    }
+    histogram->Record(nanos);
+}
+
+// Returns the value at percentile (0 to 1) of a merged histogram.
+static double PercentileMillis(const vector<uint64_t>& counts,
+        const uint64_t& total_count, const double& percentile) {
+    uint64_t rank = percentile * total_count;
+    uint64_t seen = 0;
+    for (int i = 0; i < StageHistogram::kNumBuckets; ++i) {
+        seen += counts[i];
+        if (seen > rank) {
+            return StageHistogram::BucketLowerBound(i) / 1e6;
+        }
+    }
+    return 0;
+}
+
+void DumpStageTimings(ostream& output) {
+    lock_guard<mutex> lock(registry_mutex);
+    int count = num_stages.load(memory_order_acquire);
+    output << "Stage timings (ms):" << endl;
+    output << left << setw(28) << "  stage" << right << setw(10) << "count" <<
+        setw(10) << "p50" << setw(10) << "p99" << setw(10) << "max" << endl;
+    vector<uint64_t> counts(StageHistogram::kNumBuckets);
+    for (int stage_id = 0; stage_id < count; ++stage_id) {
+        counts.assign(StageHistogram::kNumBuckets, 0);
+        uint64_t total_count = 0;
+        uint64_t max_nanos = 0;
+        for (auto stats : all_thread_stats) {
+            StageHistogram* histogram =
+                stats->histograms[stage_id].load(memory_order_acquire);
+            if (histogram != NULL) {
+                histogram->MergeInto(counts.data(), &total_count, &max_nanos);
+            }
+        }
+        if (total_count == 0) {
+            continue;
+        }
+        output << "  " << left << setw(26) << stage_names[stage_id] << right <<
+            setw(10) << total_count << fixed << setprecision(3) <<
+            setw(10) << PercentileMillis(counts, total_count, 0.5) <<
+            setw(10) << PercentileMillis(counts, total_count, 0.99) <<
+            setw(10) << max_nanos / 1e6 << endl;
+    }
+}
+
+static void DumpStageTimingsAtExit() {
+    DumpStageTimings(cout);
+}
+
+static void HandleDumpSignal(int signal) {
+    dump_requested.store(true);
+}
+
+void InitStageTiming() {
+    atexit(DumpStageTimingsAtExit);
+    signal(SIGUSR1, HandleDumpSignal);
+}
+
+void PollStageTiming() {
+    if (dump_requested.load(memory_order_relaxed) &&
+            dump_requested.exchange(false)) {
+        DumpStageTimings(cout);
+    }
+}
+
+}
@@ -0,0 +1,111 @@
+#ifndef STAGE_TIMER_H
+#define STAGE_TIMER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+using namespace std;
+
+// Per-stage latency instrumentation. Build with -DNBA_VISION_PROFILING to
+// enable it, otherwise the macros below compile to nothing.
+//
+//   void FindNet(...) {
+//       STAGE_TIMER("FindNet");
+//       ...
+//   }
+//
+// Each thread records into its own histograms without locks. The timings of
+// all threads are merged and printed (p50, p99 and max per stage) at exit,
+// or on SIGUSR1 at the next STAGE_TIMING_POLL().
+#ifdef NBA_VISION_PROFILING
+
+#define NBA_VISION_CONCAT_INNER(a, b) a##b
+#define NBA_VISION_CONCAT(a, b) NBA_VISION_CONCAT_INNER(a, b)
+#define STAGE_TIMER(name) \
+    static const int NBA_VISION_CONCAT(stage_id_, __LINE__) = \
+        nba_vision::RegisterStage(name); \
+    nba_vision::ScopedStageTimer NBA_VISION_CONCAT(stage_timer_, __LINE__)( \
+        NBA_VISION_CONCAT(stage_id_, __LINE__))
+#define STAGE_TIMING_INIT() nba_vision::InitStageTiming()
+#define STAGE_TIMING_POLL() nba_vision::PollStageTiming()
+
+#else
+
+#define STAGE_TIMER(name)
+#define STAGE_TIMING_INIT()
+#define STAGE_TIMING_POLL()
+
+#endif  // NBA_VISION_PROFILING
+
+namespace nba_vision {
+
+// Maximum number of distinct stage names.
+const int kMaxStages = 64;
+
+// A log-linear (HDR style) histogram of durations in nanoseconds. Values
+// below 32ns get their own bucket, larger values share buckets that are
+// 1/16th of their power of two wide, so percentiles are within ~6%. Only the
+// owning thread writes to it; other threads may read it at any time.
+class StageHistogram {
+public:
+    static const int kSubBucketBits = 5;
+    static const int kNumBuckets = (1 << kSubBucketBits) +
+        (64 - kSubBucketBits) * (1 << (kSubBucketBits - 1));
+
+    StageHistogram();
+
+    void Record(const uint64_t& nanos);
+
+    // Adds the contents of this histogram to the plain arrays of a merged
+    // histogram.
+    void MergeInto(uint64_t* counts, uint64_t* total_count,
+            uint64_t* max_nanos) const;
+
+    static int BucketIndex(const uint64_t& nanos);
+
+    // The smallest value that falls into the bucket.
+    static uint64_t BucketLowerBound(const int& index);
+
+private:
+    atomic<uint64_t> counts_[kNumBuckets];
+    atomic<uint64_t> total_count_;
+    atomic<uint64_t> max_nanos_;
+};
+
+// Returns the id of the stage with this name, registering it if needed.
+int RegisterStage(const char* name);
+
+// Records one duration for a stage on the calling thread.
+void RecordStageTime(const int& stage_id, const uint64_t& nanos);
+
+// Times the enclosing scope.
+class ScopedStageTimer {
+public:
+    explicit ScopedStageTimer(const int& stage_id) :
+            stage_id_(stage_id), start_(chrono::steady_clock::now()) {}
+
+    ~ScopedStageTimer() {
+        RecordStageTime(stage_id_, chrono::duration_cast<chrono::nanoseconds>(
+                    chrono::steady_clock::now() - start_).count());
+    }
+
+private:
+    int stage_id_;
+    chrono::steady_clock::time_point start_;
+};
+
+// Prints the merged timings of every stage.
+void DumpStageTimings(ostream& output);
+
+// Dumps the timings at exit and on SIGUSR1.
+void InitStageTiming();
+
+// Dumps the timings if SIGUSR1 was received since the last call. Dumping is
+// not async-signal-safe, so the signal handler only sets a flag.
+void PollStageTiming();
+
+}
+
+#endif  // STAGE_TIMER_H
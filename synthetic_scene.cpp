@@ -0,0 +1,269 @@
+#include "synthetic_scene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "color_model.h"
+
+namespace nba_vision {
+
+const char kSyntheticNetTemplateFilename[] = "metadata/net_template.jpg";
+// Middle of the scales FindNet searches.
+const double kDefaultNetScale = 0.15;
+// Top part of the frame taken by the crowd.
+const double kCrowdFraction = 0.3;
+// Default ball radius per pixel of frame height, but never so small that the
+// tracker's area filter drops it.
+const double kBallRadiusFraction = 0.012;
+const double kMinBallRadius = 6.5;
+// Height of the top of the arc above the straight line to the hoop.
+const double kArcHeightFraction = 0.3;
+// A dribble goes down and back up this often.
+const double kDribbleSeconds = 0.5;
+// Distractors move at most this many frame heights per second.
+const double kMaxDistractorSpeed = 0.1;
+// Sub-pixel precision of the ball and distractors, in bits.
+const int kDrawShift = 4;
+
+// A number in [low, high) from the raw output of rng.
+static double Uniform(mt19937& rng, const double& low, const double& high) {
+    return low + (high - low) * (rng() / 4294967296.0);
+}
+
+// A ball-like color: red near the ball's mean, and green and blue near the
+// middle of the bands of DefaultBballColorModel.
+static Scalar BallLikeColor(mt19937& rng) {
+    const ChannelGaussian red = DefaultBballColorModel::Red();
+    double r = red.mean + Uniform(rng, -1, 1) * red.stddev;
+    double g = 0.7618 * r - 10.14 + Uniform(rng, -4, 4);
+    double b = ((r - 80) + (5 * r / 8 - 45.0 / 4)) / 2 + Uniform(rng, -4, 4);
+    return Scalar(b, g, r);
+}
+
+// A point wrapped into [0, size).
+static double Wrap(const double& value, const double& size) {
+    double wrapped = fmod(value, size);
+    return wrapped < 0 ? wrapped + size : wrapped;
+}
+
+SyntheticSceneConfig::SyntheticSceneConfig() : width(1280), height(720),
+        fps(30), num_frames(0), num_distractors(20), seed(1), ball_radius(0),
+        net_scale(kDefaultNetScale), cycle_seconds(3), shot_seconds(1.2) {}
+
+SyntheticScene::SyntheticScene(const SyntheticSceneConfig& config) :
+        config_(config), next_frame_(0) {
+    if (config_.ball_radius <= 0) {
+        config_.ball_radius = max(kMinBallRadius,
+                config_.height * kBallRadiusFraction);
+    }
+    DrawBackground();
+    DrawNet();
+    // Seeded apart from the background so that adding distractors doesn't
+    // change the court.
+    mt19937 rng(config_.seed + 1);
+    const double max_speed = kMaxDistractorSpeed * config_.height /
+        config_.fps;
+    for (int i = 0; i < config_.num_distractors; i++) {
+        Distractor distractor;
+        distractor.start = Point2f(Uniform(rng, 0, config_.width),
+                Uniform(rng, 0, config_.height));
+        distractor.velocity = Point2f(Uniform(rng, -max_speed, max_speed),
+                Uniform(rng, -max_speed, max_speed));
+        double radius = config_.ball_radius * Uniform(rng, 0.5, 2.5);
+        distractor.axes = Size(radius * (1 << kDrawShift),
+                radius * Uniform(rng, 0.3, 1) * (1 << kDrawShift));
+        distractor.angle = Uniform(rng, 0, 180);
+        distractor.color = BallLikeColor(rng);
+        distractors_.push_back(distractor);
+    }
+}
+
+bool SyntheticScene::Read(Mat& frame) {
+    if (config_.num_frames > 0 && next_frame_ >= config_.num_frames) {
+        return false;
+    }
+    Render(next_frame_++, buffer_, last_truth_);
+    frame = buffer_;
+    return true;
+}
+
+bool SyntheticScene::Skip() {
+    if (config_.num_frames > 0 && next_frame_ >= config_.num_frames) {
+        return false;
+    }
+    next_frame_++;
+    return true;
+}
+
+Size SyntheticScene::FrameSize() const {
+    return Size(config_.width, config_.height);
+}
+
+bool SyntheticScene::SkipTo(const int& frame_idx) {
+    next_frame_ = frame_idx;
+    return true;
+}
+
+void SyntheticScene::Render(const int& frame_idx, Mat& frame,
+        SyntheticGroundTruth& truth) const {
+    background_.copyTo(frame);
+    const double scale = 1 << kDrawShift;
+    for (const auto& distractor : distractors_) {
+        double x = distractor.start.x + distractor.velocity.x * frame_idx;
+        double y = distractor.start.y + distractor.velocity.y * frame_idx;
+        ellipse(frame, Point(Wrap(x, config_.width) * scale,
+                    Wrap(y, config_.height) * scale), distractor.axes,
+                distractor.angle, 0, 360, distractor.color, CV_FILLED,
+                LINE_AA, kDrawShift);
+    }
+    ComputeBall(frame_idx, truth);
+    const ChannelGaussian red = DefaultBballColorModel::Red();
+    const ChannelGaussian green = DefaultBballColorModel::Green();
+    const ChannelGaussian blue = DefaultBballColorModel::Blue();
+    circle(frame, Point(truth.ball_location.x * scale,
+                truth.ball_location.y * scale), truth.ball_radius * scale,
+            Scalar(blue.mean, green.mean, red.mean), CV_FILLED, LINE_AA,
+            kDrawShift);
+    truth.net_rect = net_rect_;
+}
+
+const SyntheticGroundTruth& SyntheticScene::LastGroundTruth() const {
+    return last_truth_;
+}
+
+const SyntheticSceneConfig& SyntheticScene::Config() const {
+    return config_;
+}
+
+void SyntheticScene::DrawBackground() {
+    const int width = config_.width, height = config_.height;
+    const int crowd_height = height * kCrowdFraction;
+    background_.create(height, width, CV_8UC3);
+    mt19937 rng(config_.seed);
+    // The crowd is blocks of random colors, some of them ball colored.
+    const int block = max(2, height / 120);
+    for (int y = 0; y < crowd_height; y += block) {
+        for (int x = 0; x < width; x += block) {
+            Scalar color(rng() % 160, rng() % 160, rng() % 200);
+            rectangle(background_, Rect(x, y, block, block) &
+                    Rect(0, 0, width, crowd_height), color, CV_FILLED);
+        }
+    }
+    // Floor planks of slightly different shades.
+    const int plank = max(2, height / 90);
+    for (int y = crowd_height; y < height; y += plank) {
+        double shade = Uniform(rng, -12, 12);
+        rectangle(background_, Rect(0, y, width, min(plank, height - y)),
+                Scalar(100 + shade, 160 + shade, 210 + shade), CV_FILLED);
+    }
+    // The painted key under the hoop, the baseline and the center circle.
+    const int line_width = max(1, height / 180);
+    const Scalar white(235, 235, 235);
+    Rect key(width * 0.62, crowd_height, width * 0.22, height * 0.45);
+    rectangle(background_, key, Scalar(150, 80, 30), CV_FILLED);
+    rectangle(background_, key, white, line_width);
+    line(background_, Point(0, crowd_height + line_width),
+            Point(width, crowd_height + line_width), white, line_width);
+    circle(background_, Point(width * 0.2, height * 0.75), height * 0.15,
+            white, line_width);
+}
+
+void SyntheticScene::DrawNet() {
+    Mat net_template = imread(kSyntheticNetTemplateFilename);
+    Size net_size;
+    if (net_template.empty()) {
+        cout << "Cannot read " << kSyntheticNetTemplateFilename <<
+            ", drawing a plain backboard." << endl;
+        net_size = Size(config_.height * 0.08, config_.height * 0.08);
+    } else {
+        net_size = Size(max(1.0, net_template.cols * config_.net_scale),
+                max(1.0, net_template.rows * config_.net_scale));
+    }
+    net_size.width = min(net_size.width, config_.width);
+    net_size.height = min(net_size.height, config_.height);
+    net_rect_ = Rect(config_.width * 0.73 - net_size.width / 2,
+            config_.height * kCrowdFraction - net_size.height * 0.2,
+            net_size.width, net_size.height);
+    net_rect_.x = min(max(0, net_rect_.x), config_.width - net_size.width);
+    net_rect_.y = min(max(0, net_rect_.y), config_.height - net_size.height);
+    Mat area = background_(net_rect_);
+    if (net_template.empty()) {
+        area.setTo(Scalar(235, 235, 235));
+    } else {
+        resize(net_template, area, net_size, 0, 0, INTER_AREA);
+    }
+}
+
+void SyntheticScene::ComputeBall(const int& frame_idx,
+        SyntheticGroundTruth& truth) const {
+    const int cycle_frames = max(2, (int) round(config_.cycle_seconds *
+                config_.fps));
+    const int shot_frames = min(cycle_frames - 1, max(1,
+                (int) round(config_.shot_seconds * config_.fps)));
+    const int hold_frames = cycle_frames - shot_frames;
+    const int cycle = frame_idx / cycle_frames;
+    const int phase = frame_idx % cycle_frames;
+    // Each cycle shoots from its own spot.
+    mt19937 rng(config_.seed ^ (0x9e3779b9u * (cycle + 1)));
+    Point2f release(Uniform(rng, 0.1, 0.55) * config_.width,
+            Uniform(rng, 0.55, 0.85) * config_.height);
+    Point2f target(net_rect_.x + net_rect_.width / 2.0f,
+            net_rect_.y + net_rect_.height * 0.35f);
+    truth.ball_radius = config_.ball_radius;
+    if (phase < hold_frames) {
+        // Dribbling in place.
+        double bounce = fabs(sin(M_PI * phase / (kDribbleSeconds *
+                        config_.fps)));
+        truth.ball_location = release + Point2f(0,
+                bounce * 3 * config_.ball_radius);
+        truth.in_shot = false;
+    } else {
+        double t = (phase - hold_frames + 1) / (double) shot_frames;
+        double arc_height = kArcHeightFraction * config_.height;
+        truth.ball_location = Point2f(
+                release.x + (target.x - release.x) * t,
+                release.y + (target.y - release.y) * t -
+                4 * arc_height * t * (1 - t));
+        truth.in_shot = true;
+    }
+}
+
+bool ParseSyntheticSpec(const string& spec, SyntheticSceneConfig& config) {
+    const char* text = spec.c_str();
+    int consumed = 0;
+    if (sscanf(text, "%dx%d%n", &config.width, &config.height,
+                &consumed) != 2) {
+        return false;
+    }
+    text += consumed;
+    if (*text == '@') {
+        if (sscanf(text + 1, "%lf%n", &config.fps, &consumed) != 1) {
+            return false;
+        }
+        text += 1 + consumed;
+    }
+    if (*text == ':') {
+        if (sscanf(text + 1, "%d%n", &config.num_distractors,
+                    &consumed) != 1) {
+            return false;
+        }
+        text += 1 + consumed;
+    }
+    if (*text == ':') {
+        unsigned int seed;
+        if (sscanf(text + 1, "%u%n", &seed, &consumed) != 1) {
+            return false;
+        }
+        config.seed = seed;
+        text += 1 + consumed;
+    }
+    return *text == '\0' && config.width > 0 && config.height > 0 &&
+        config.fps > 0 && config.num_distractors >= 0;
+}
+
+}
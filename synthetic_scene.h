@@ -0,0 +1,116 @@
+#ifndef SYNTHETIC_SCENE_H
+#define SYNTHETIC_SCENE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include "frame_source.h"
+
+using namespace cv;
+using namespace std;
+
+namespace nba_vision {
+
+struct SyntheticSceneConfig {
+    // 1280x720 at 30 fps with 20 distractors, endless.
+    SyntheticSceneConfig();
+
+    int width;
+    int height;
+    double fps;
+    // 0 for a scene that never ends.
+    int num_frames;
+    // Ball colored blobs that drift over the court.
+    int num_distractors;
+    uint32_t seed;
+    // In pixels. 0 scales the ball with the frame height.
+    double ball_radius;
+    // Scale of net_template.jpg for the hoop, by default one that FindNet
+    // searches.
+    double net_scale;
+    // Each shot cycle holds the ball at the shooter, then throws it at the
+    // hoop for shot_seconds.
+    double cycle_seconds;
+    double shot_seconds;
+};
+
+// Where things are in a synthetic frame.
+struct SyntheticGroundTruth {
+    Point2f ball_location;
+    float ball_radius;
+    // Whether the ball is on its way to the hoop.
+    bool in_shot;
+    Rect net_rect;
+};
+
+// A court-like scene drawn from scratch for scaling tests: a crowd band and
+// a wooden floor with painted lines, the hoop from metadata/net_template.jpg,
+// ball colored blobs drifting around, and a ball that is thrown at the hoop
+// on a parabolic arc every cycle. Works at any size and frame rate.
+//
+// Frames are a function of the config and the frame index alone, so a scene
+// is deterministic for a given build and can be rendered in any order. The
+// random numbers come straight from mt19937, whose output the standard
+// fixes, rather than from the library's distributions, which it doesn't.
+// Pixels may still differ between OpenCV builds, which can antialias
+// LINE_AA shapes, decode the JPEG template and resize it with INTER_AREA
+// differently.
+class SyntheticScene : public FrameSource {
+public:
+    explicit SyntheticScene(const SyntheticSceneConfig& config);
+
+    // Renders the next frame into a buffer owned by the scene.
+    bool Read(Mat& frame);
+
+    // Moves past the next frame without rendering it.
+    bool Skip();
+
+    Size FrameSize() const;
+
+    bool SkipTo(const int& frame_idx);
+
+    // Draws frame frame_idx into frame and fills truth.
+    void Render(const int& frame_idx, Mat& frame,
+            SyntheticGroundTruth& truth) const;
+
+    // The ground truth of the last frame returned by Read.
+    const SyntheticGroundTruth& LastGroundTruth() const;
+
+    const SyntheticSceneConfig& Config() const;
+
+private:
+    struct Distractor {
+        Point2f start;
+        // In pixels per frame.
+        Point2f velocity;
+        Size axes;
+        double angle;
+        Scalar color;
+    };
+
+    void DrawBackground();
+
+    void DrawNet();
+
+    // Where the ball is in frame_idx.
+    void ComputeBall(const int& frame_idx, SyntheticGroundTruth& truth) const;
+
+    SyntheticSceneConfig config_;
+    Mat background_;
+    Rect net_rect_;
+    vector<Distractor> distractors_;
+    Mat buffer_;
+    int next_frame_;
+    SyntheticGroundTruth last_truth_;
+};
+
+// Parses "<width>x<height>[@<fps>][:<distractors>[:<seed>]]", e.g.
+// 3840x2160@60:200, into config. Returns false if spec is malformed.
+bool ParseSyntheticSpec(const string& spec, SyntheticSceneConfig& config);
+
+}
+
+#endif  // SYNTHETIC_SCENE_H
@@ -5,6 +5,9 @@
 #include <stack>
 #include <set>
 
+#include "multiversion.h"
+#include "stage_timer.h"
+
 using namespace std;
 using namespace cv;
 
@@ -46,83 +49,143 @@ void ComputeEminEmax(const double& a, const double& b, const double& c,
 
 vector<RegionMetrics*> ComputeRegionMetrics(const Mat& components_image,
         const int& num_components) {
-	// Computes the area, orientation, and circularity.
-	// Also, identify and count the boundary pixels of each region,
-	// and compute compactness, the ratio of the area to the perimeter.
-	vector<RegionMetrics*> region_metrics_list = vector<RegionMetrics*>();
-	for (int i = 0; i < num_components; ++i) {
-		region_metrics_list.emplace_back(new RegionMetrics());
-	}
+	STAGE_TIMER("ComputeRegionMetrics");
+	vector<RegionMoments> moments(num_components);
+	AccumulateRegionMoments(components_image, 0, components_image.rows, moments);
+	return ComputeRegionMetricsFromMoments(moments);
+}
 
-	for (int i = 0; i < components_image.rows; ++i) {
+NBA_VISION_HOT_KERNEL
+void AccumulateRegionMoments(const Mat& components_image, const int& row_begin,
+        const int& row_end, vector<RegionMoments>& moments) {
+	// Identify and count the boundary pixels of each region, and sum the
+	// coordinates for the centroid and second moments.
+	for (int i = row_begin; i < row_end; ++i) {
+		const uchar* row = components_image.ptr<uchar>(i);
 		for (int j = 0; j < components_image.cols; ++j) {
-			int component_index = components_image.at<uchar>(i, j);
-			if (component_index != 1) {
-				RegionMetrics* region_metrics =
-                                    region_metrics_list[component_index - 2];
-				region_metrics->component_index = component_index;
-				region_metrics->area += 1;
-				if (IsBoundaryPixel(PixelLoc(i, j), component_index,
-                                            components_image)) {
-					region_metrics->num_boundary_pixels += 1;
-				}
-				region_metrics->avg_x += j;
-				region_metrics->avg_y += i;
+			int component_index = row[j];
+			if (component_index < 2) {
+				continue;
+			}
+			RegionMoments& region_moments = moments[component_index - 2];
+			region_moments.area += 1;
+			if (IsBoundaryPixel(PixelLoc(i, j), component_index,
+                                    components_image)) {
+				region_moments.num_boundary_pixels += 1;
 			}
+			region_moments.sum_x += j;
+			region_moments.sum_y += i;
+			region_moments.sum_xx += (int64_t) j * j;
+			region_moments.sum_yy += (int64_t) i * i;
+			region_moments.sum_xy += (int64_t) i * j;
 		}
 	}
+}
+
+RegionMetrics* CreateRegionMetrics(const RegionMoments& region_moments,
+        const int& component_index) {
+	// Computes the area, orientation, and circularity, and compactness, the
+	// ratio of the area to the perimeter.
+	RegionMetrics* region_metrics = new RegionMetrics();
+	region_metrics->component_index = component_index;
+	region_metrics->area = region_moments.area;
+	region_metrics->num_boundary_pixels = region_moments.num_boundary_pixels;
+	region_metrics->area_perimeter_ratio =
+		region_metrics->area / (double)
+                region_metrics->num_boundary_pixels;
+	region_metrics->avg_x = region_moments.sum_x / region_metrics->area;
+	region_metrics->avg_y = region_moments.sum_y / region_metrics->area;
+	region_metrics->compactness = pow(region_metrics->num_boundary_pixels,
+                2) / region_metrics->area;
+	// Central second moments, from the raw sums.
+	region_metrics->x_second_moment = (region_moments.sum_xx -
+                region_moments.sum_x * region_metrics->avg_x) /
+            region_metrics->area;
+	region_metrics->y_second_moment = (region_moments.sum_yy -
+                region_moments.sum_y * region_metrics->avg_y) /
+            region_metrics->area;
+	region_metrics->cross_second_moment = (region_moments.sum_xy -
+                region_moments.sum_x * region_metrics->avg_y) /
+                region_metrics->area;
+	// Compute orientation and circularity.
+	region_metrics->orientation = atan(2 *
+                region_metrics->cross_second_moment /
+		(region_metrics->x_second_moment -
+                 region_metrics->y_second_moment)) / 2;
+	double e_min, e_max;
+	ComputeEminEmax(region_metrics->x_second_moment,
+		2 * region_metrics->cross_second_moment,
+		region_metrics->y_second_moment,
+		&e_min, &e_max);
+	region_metrics->circularity = e_min / e_max;
+	return region_metrics;
+}
 
-	for (auto region_metrics : region_metrics_list) {
-		// Compute more metrics post-parsing the photo.
-		region_metrics->area_perimeter_ratio =
-			region_metrics->area / (double)
-                        region_metrics->num_boundary_pixels;
-		region_metrics->avg_x = region_metrics->avg_x / region_metrics->area;
-		region_metrics->avg_y = region_metrics->avg_y / region_metrics->area;
-		region_metrics->compactness = pow(region_metrics->num_boundary_pixels,
-                        2) / region_metrics->area;
+vector<RegionMetrics*> ComputeRegionMetricsFromMoments(
+        const vector<RegionMoments>& moments) {
+	vector<RegionMetrics*> region_metrics_list = vector<RegionMetrics*>();
+	for (size_t i = 0; i < moments.size(); ++i) {
+		// Labels that were never seen keep component index 0.
+		region_metrics_list.emplace_back(CreateRegionMetrics(moments[i],
+                        moments[i].area > 0 ? (int) i + 2 : 0));
 	}
+	return region_metrics_list;
+}
+
+vector<ComponentStats> ComputeComponentStats(const Mat& components_image,
+        const int& num_components) {
+	STAGE_TIMER("ComputeComponentStats");
+	vector<ComponentStats> stats(num_components);
+	AccumulateComponentStats(components_image, 0, components_image.rows,
+                stats);
+	return stats;
+}
 
-	// Second pass through the image to compute more properties.
-	for (int i = 0; i < components_image.rows; ++i) {
+void AccumulateComponentStats(const Mat& components_image,
+        const int& row_begin, const int& row_end,
+        vector<ComponentStats>& stats) {
+	for (int i = row_begin; i < row_end; ++i) {
+		const uchar* row = components_image.ptr<uchar>(i);
 		for (int j = 0; j < components_image.cols; ++j) {
-			int component_index = components_image.at<uchar>(i, j);
-			if (component_index != 1) {
-				RegionMetrics* region_metrics = region_metrics_list[
-                                    component_index - 2];
-				region_metrics->x_second_moment +=
-                                    pow(j - region_metrics->avg_x, 2);
-				region_metrics->y_second_moment +=
-                                    pow(i - region_metrics->avg_y, 2);
-				region_metrics->cross_second_moment +=
-                                    (j - region_metrics->avg_x) *
-                                    (i - region_metrics->avg_y);
+			int component_index = row[j];
+			if (component_index < 2) {
+				continue;
 			}
+			ComponentStats& component = stats[component_index - 2];
+			component.component_index = component_index;
+			component.area += 1;
+			component.sum_x += j;
+			component.sum_y += i;
+			component.min_x = min(component.min_x, j);
+			component.max_x = max(component.max_x, j);
+			component.min_y = min(component.min_y, i);
+			component.max_y = max(component.max_y, i);
 		}
 	}
+}
 
-	for (auto region_metrics : region_metrics_list) {
-		// Compute more metrics post-parsing the photo.
-		region_metrics->x_second_moment = region_metrics->x_second_moment /
-                    region_metrics->area;
-		region_metrics->y_second_moment = region_metrics->y_second_moment /
-                    region_metrics->area;
-		region_metrics->cross_second_moment =
-			region_metrics->cross_second_moment /
-                        region_metrics->area;
-		// Compute orientation and circularity.
-		region_metrics->orientation = atan(2 *
-                        region_metrics->cross_second_moment /
-			(region_metrics->x_second_moment -
-                         region_metrics->y_second_moment)) / 2;
-		double e_min, e_max;
-		ComputeEminEmax(region_metrics->x_second_moment,
-			2 * region_metrics->cross_second_moment,
-			region_metrics->y_second_moment,
-			&e_min, &e_max);
-		region_metrics->circularity = e_min / e_max;
+RegionMetrics* ComputeRegionMetricsForComponent(const Mat& components_image,
+        const ComponentStats& stats) {
+	RegionMoments region_moments;
+	for (int i = stats.min_y; i <= stats.max_y; ++i) {
+		const uchar* row = components_image.ptr<uchar>(i);
+		for (int j = stats.min_x; j <= stats.max_x; ++j) {
+			if (row[j] != stats.component_index) {
+				continue;
+			}
+			region_moments.area += 1;
+			if (IsBoundaryPixel(PixelLoc(i, j), stats.component_index,
+                                    components_image)) {
+				region_moments.num_boundary_pixels += 1;
+			}
+			region_moments.sum_x += j;
+			region_moments.sum_y += i;
+			region_moments.sum_xx += (int64_t) j * j;
+			region_moments.sum_yy += (int64_t) i * i;
+			region_moments.sum_xy += (int64_t) i * j;
+		}
 	}
-	return region_metrics_list;
+	return CreateRegionMetrics(region_moments, stats.component_index);
 }
 
 bool SearchForObject(const Mat& binary_image, const PixelLoc& starting_point,
@@ -169,7 +232,7 @@ bool SearchForObject(const Mat& binary_image, const PixelLoc& starting_point,
 			}
 		}
 	}
-        if (pixel_vec.size() < 50) {
+        if (pixel_vec.size() < MIN_COMPONENT_AREA) {
             for (const auto& pixel_loc : pixel_vec) {
                 output_image.at<uchar>(pixel_loc.first, pixel_loc.second) = 1;
             }
@@ -179,6 +242,7 @@ bool SearchForObject(const Mat& binary_image, const PixelLoc& starting_point,
 }
 
 int ComputeConnectedComponents(const Mat& binary_image, Mat& output_image) {
+	STAGE_TIMER("ComputeConnectedComponents");
 	output_image = Mat::zeros(binary_image.rows, binary_image.cols, CV_8UC1);
 	// 1 will mean not part of an object (part of background).
 	int current_component_label = 2;
@@ -197,20 +261,22 @@ int ComputeConnectedComponents(const Mat& binary_image, Mat& output_image) {
 			}
 			else {  // If the binary image value here is high, search for
                                 // the corresponding object.
-				output_image.at<uchar>(r, c) = current_component_label;
+				// Once the labels run out, the remaining objects are
+                                // searched as background so that they still get
+                                // marked as looked at.
+				output_image.at<uchar>(r, c) =
+                                    current_component_label <= MAX_COMPONENT_LABEL ?
+                                    current_component_label : 1;
 				// Recursively search for this entire object based on
                                 // neighboring pixels.
 				bool new_obj = SearchForObject(binary_image, PixelLoc(r, c),
                                         output_image);
 				// Increment the current component label so that
                                 // the next object gets a new label.
-                                if (new_obj) {
+                                if (new_obj &&
+                                        current_component_label <= MAX_COMPONENT_LABEL) {
 				    current_component_label++;
                                 }
-                                if (current_component_label > 255) {
-                                    cout << "Current component label: " << current_component_label << endl;
-                                    return current_component_label - 1;
-                                }
 			}
 		}
 	}
@@ -248,6 +314,7 @@ double Phi(const double& x, const double& mean, const double& stddev) {
 void FilterRegionMetrics(Mat& components_image,
         vector<RegionMetrics*>& region_metrics_list,
         bool (*filter)(RegionMetrics* region_metrics)) {
+    STAGE_TIMER("FilterRegionMetrics");
     set<int> removed_indices;    
     for (int i = region_metrics_list.size() - 1; i >= 0; i--) {
         RegionMetrics* region_metrics = region_metrics_list[i];
@@ -283,7 +350,13 @@ void ConvertComponentsImageToBinary(const Mat& components_image, Mat& output_ima
 double ComputeDistance(double x1, double y1, double x2, double y2) {
     double x_diff = x2 - x1;
     double y_diff = y2 - y1;
-    return sqrt(pow(x_diff, 2) + pow(y_diff, 2));
+    return sqrt(x_diff * x_diff + y_diff * y_diff);
+}
+
+double ComputeSquaredDistance(double x1, double y1, double x2, double y2) {
+    double x_diff = x2 - x1;
+    double y_diff = y2 - y1;
+    return x_diff * x_diff + y_diff * y_diff;
 }
 
 }
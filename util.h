@@ -2,6 +2,9 @@
 #define UTIL_H
 
 #include <opencv2/highgui/highgui.hpp>
+#include <algorithm>
+#include <climits>
+#include <cstdint>
 #include <vector>
 
 using namespace cv;
@@ -9,6 +12,11 @@ using namespace std;
 
 namespace nba_vision {
 
+// Objects with fewer pixels are labeled as background.
+#define MIN_COMPONENT_AREA 50
+// Labels are stored in a CV_8UC1 image.
+#define MAX_COMPONENT_LABEL 255
+
 class RegionMetrics {
 public:
 	int component_index;
@@ -60,13 +68,115 @@ public:
 	}
 };
 
+// Sums over the pixels of one component, from which its RegionMetrics are
+// computed. Being integers, the sums over parts of an image add up to exactly
+// the sums over the whole image, in any order.
+class RegionMoments {
+public:
+	int64_t area;
+	int64_t num_boundary_pixels;
+	int64_t sum_x;
+	int64_t sum_y;
+	int64_t sum_xx;
+	int64_t sum_yy;
+	int64_t sum_xy;
+
+	RegionMoments() {
+		area = 0;
+		num_boundary_pixels = 0;
+		sum_x = 0;
+		sum_y = 0;
+		sum_xx = 0;
+		sum_yy = 0;
+		sum_xy = 0;
+	}
+
+	void Add(const RegionMoments& other) {
+		area += other.area;
+		num_boundary_pixels += other.num_boundary_pixels;
+		sum_x += other.sum_x;
+		sum_y += other.sum_y;
+		sum_xx += other.sum_xx;
+		sum_yy += other.sum_yy;
+		sum_xy += other.sum_xy;
+	}
+};
+
+// The cheap properties of one component, gathered in a single pass without
+// looking at neighboring pixels. Used to rule out most components before
+// computing their RegionMetrics.
+class ComponentStats {
+public:
+	int component_index;
+	int area;
+	int64_t sum_x;
+	int64_t sum_y;
+	// Bounding box, inclusive.
+	int min_x;
+	int min_y;
+	int max_x;
+	int max_y;
+
+	ComponentStats() {
+		component_index = 0;
+		area = 0;
+		sum_x = 0;
+		sum_y = 0;
+		min_x = INT_MAX;
+		min_y = INT_MAX;
+		max_x = INT_MIN;
+		max_y = INT_MIN;
+	}
+
+	void Add(const ComponentStats& other) {
+		if (other.area > 0) {
+			component_index = other.component_index;
+		}
+		area += other.area;
+		sum_x += other.sum_x;
+		sum_y += other.sum_y;
+		min_x = min(min_x, other.min_x);
+		min_y = min(min_y, other.min_y);
+		max_x = max(max_x, other.max_x);
+		max_y = max(max_y, other.max_y);
+	}
+};
+
 // Given a binary segmented image, find all distinct objects and assign labels
-// to those objects.
+// to those objects. Label 1 is the background and objects are labeled from 2
+// in the order of their first pixel. Objects under 50 pixels, and objects
+// past label 255, are left as background.
 int ComputeConnectedComponents(const Mat& binary_image, Mat& output_image);
 
 // Computes all of the metrics for the output_image from ComputeConnectedComponents.
 vector<RegionMetrics*> ComputeRegionMetrics(const Mat& components_image, const int& num_components);
 
+// Adds the moments of the components in rows [row_begin, row_end) of the
+// components_image to moments, which has num_components entries.
+void AccumulateRegionMoments(const Mat& components_image, const int& row_begin,
+        const int& row_end, vector<RegionMoments>& moments);
+
+// Computes the metrics of each component from its moments over the whole
+// image.
+vector<RegionMetrics*> ComputeRegionMetricsFromMoments(
+        const vector<RegionMoments>& moments);
+
+// Computes the stats of every component of the output_image from
+// ComputeConnectedComponents.
+vector<ComponentStats> ComputeComponentStats(const Mat& components_image,
+        const int& num_components);
+
+// Adds the stats of the components in rows [row_begin, row_end) of the
+// components_image to stats, which has num_components entries.
+void AccumulateComponentStats(const Mat& components_image,
+        const int& row_begin, const int& row_end,
+        vector<ComponentStats>& stats);
+
+// Computes the metrics of a single component, only looking at its bounding
+// box. Same result as its entry from ComputeRegionMetrics.
+RegionMetrics* ComputeRegionMetricsForComponent(const Mat& components_image,
+        const ComponentStats& stats);
+
 // CDF of the standard normal distrobution.
 double Phi(const double& x, const double& mean, const double& stddev);
 
@@ -83,6 +193,10 @@ void ConvertComponentsImageToBinary(const Mat& components_image, Mat& output_ima
 // Compute the distance between two points.
 double ComputeDistance(double x1, double y1, double x2, double y2);
 
+// Compute the squared distance between two points. Cheaper than
+// ComputeDistance when only comparing distances.
+double ComputeSquaredDistance(double x1, double y1, double x2, double y2);
+
 }
 
 #endif  // UTIL_H